@@ -0,0 +1,31 @@
+EXTRA_PROGRAMS += \
+src/bench/eguebfs_bench
+
+src_bench_eguebfs_bench_LDADD = \
+$(top_builddir)/src/lib/libeguebfs.la \
+@EGUEBFS_LIBS@
+
+src_bench_eguebfs_bench_CPPFLAGS = \
+-I$(top_srcdir)/src/lib \
+@EGUEBFS_CFLAGS@
+
+src_bench_eguebfs_bench_SOURCES = \
+src/bench/eguebfs_bench.c
+
+# The options of the benchmark, i.e make bench BENCH_OPTIONS="-d 8 -f 3"
+BENCH_OPTIONS =
+BENCH_DIR = $(top_builddir)/bench
+BENCH_RESULTS = $(BENCH_DIR)/results.txt
+
+CLEAN_LOCAL += $(BENCH_DIR)
+
+bench: src/bench/eguebfs_bench$(EXEEXT)
+	@mkdir -p $(BENCH_DIR)
+	$(top_builddir)/src/bench/eguebfs_bench $(BENCH_OPTIONS) $(BENCH_DIR) | tee $(BENCH_RESULTS)
+
+# The same workloads without the kernel, no FUSE device is needed
+bench-process: src/bench/eguebfs_bench$(EXEEXT)
+	@mkdir -p $(BENCH_DIR)
+	$(top_builddir)/src/bench/eguebfs_bench -p $(BENCH_OPTIONS) $(BENCH_DIR) | tee $(BENCH_DIR)/results-process.txt
+
+.PHONY: bench bench-process
@@ -0,0 +1,1000 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <Eguebfs.h>
+
+/*
+ * Generates a document of the requested depth, fan-out and attributes per
+ * element, mounts it on DIR/mnt and runs a set of workloads on it, one after
+ * the other. Every workload does a fixed number of operations chosen with a
+ * seeded generator, so two runs with the same options do the same thing.
+ * The results are printed one line per workload:
+ * workload clients ops errors bytes seconds ops_per_s mb_per_s p50_us p99_us
+ *
+ * The workloads either go through the kernel, with the system calls on the
+ * mountpoint, or do the same operations in process with eguebfs_op_*() on a
+ * filesystem that is not mounted, which leaves only the filesystem code to
+ * profile. In process, every path is looked up from the root like the
+ * kernel does when it caches nothing
+ */
+
+typedef enum _Bench_Kind
+{
+	BENCH_KIND_COLOR,
+	BENCH_KIND_NUMBER,
+	BENCH_KIND_LENGTH,
+} Bench_Kind;
+
+typedef struct _Bench_Attr
+{
+	const char *name;
+	Bench_Kind kind;
+} Bench_Attr;
+
+typedef struct _Bench_Backend Bench_Backend;
+
+typedef struct _Bench
+{
+	const Bench_Backend *backend;
+	Eguebfs *efs;
+	int depth;
+	int fanout;
+	int attrs;
+	unsigned int seed;
+	int clients;
+	int ops;
+	size_t block;
+	char *mnt;
+	/* the paths found once mounted, from the root */
+	Eina_Array *paths;
+	Eina_Array *dirs;
+	Eina_Array *deep;
+	Eina_Array *bases;
+	char *xml;
+	unsigned int elements;
+} Bench;
+
+typedef struct _Bench_File
+{
+	int fd;
+	uint64_t ino;
+	Eguebfs_Op_File *f;
+} Bench_File;
+
+/* The operations of the workloads */
+struct _Bench_Backend
+{
+	const char *name;
+	Eina_Bool (*stat)(Bench *b, const char *path, struct stat *st);
+	Eina_Bool (*list)(Bench *b, const char *path, Eguebfs_Op_Filler filler,
+			void *data);
+	Eina_Bool (*open)(Bench *b, const char *path, int flags, Bench_File *f);
+	ssize_t (*read)(Bench *b, Bench_File *f, char *buf, size_t size,
+			off_t offset);
+	ssize_t (*write)(Bench *b, Bench_File *f, const char *buf, size_t size,
+			off_t offset);
+	Eina_Bool (*close)(Bench *b, Bench_File *f);
+};
+
+typedef struct _Bench_Client
+{
+	Bench *b;
+	uint64_t state;
+	uint64_t *latencies;
+	int count;
+	int ops;
+	uint64_t errors;
+	uint64_t bytes;
+	/* the file being read sequentially */
+	Bench_File file;
+	Eina_Bool opened;
+	off_t offset;
+	char *buf;
+} Bench_Client;
+
+typedef void (*Bench_Op)(Bench_Client *c);
+
+typedef struct _Bench_Workload
+{
+	const char *name;
+	Bench_Op op;
+	/* run by every client at once instead of by a single one */
+	Eina_Bool concurrent;
+} Bench_Workload;
+
+/* The attributes every element gets, in order, up to the requested count */
+static const Bench_Attr _bench_attrs[] = {
+	{ "fill", BENCH_KIND_COLOR },
+	{ "stroke", BENCH_KIND_COLOR },
+	{ "opacity", BENCH_KIND_NUMBER },
+	{ "stroke-width", BENCH_KIND_LENGTH },
+	{ "fill-opacity", BENCH_KIND_NUMBER },
+	{ "stroke-opacity", BENCH_KIND_NUMBER },
+	{ "color", BENCH_KIND_COLOR },
+	{ "stop-color", BENCH_KIND_COLOR },
+	{ "stop-opacity", BENCH_KIND_NUMBER },
+	{ "flood-color", BENCH_KIND_COLOR },
+	{ "flood-opacity", BENCH_KIND_NUMBER },
+	{ "lighting-color", BENCH_KIND_COLOR },
+	{ "stroke-miterlimit", BENCH_KIND_LENGTH },
+	{ "font-size", BENCH_KIND_LENGTH },
+};
+#define BENCH_ATTRS (int)(sizeof(_bench_attrs) / sizeof(_bench_attrs[0]))
+
+static uint64_t _bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift64, the state must not be zero */
+static uint64_t _bench_random(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+static void _bench_value(uint64_t *state, Bench_Kind kind, char *value,
+		size_t len)
+{
+	uint64_t r = _bench_random(state);
+
+	switch (kind)
+	{
+		case BENCH_KIND_COLOR:
+		snprintf(value, len, "#%06x", (unsigned int)(r & 0xffffff));
+		break;
+
+		case BENCH_KIND_NUMBER:
+		snprintf(value, len, "%.2f", (r % 101) / 100.0);
+		break;
+
+		case BENCH_KIND_LENGTH:
+		snprintf(value, len, "%d", (int)(r % 20) + 1);
+		break;
+	}
+}
+
+static const Bench_Attr * _bench_attr_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < BENCH_ATTRS; i++)
+	{
+		if (!strcmp(_bench_attrs[i].name, name))
+			return &_bench_attrs[i];
+	}
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*
+ *                             The document                                   *
+ *----------------------------------------------------------------------------*/
+static void _bench_generate_element(Bench *b, FILE *f, uint64_t *state,
+		int level)
+{
+	const char *name = level == b->depth ? "rect" : "g";
+	char value[32];
+	int i;
+
+	fprintf(f, "%*s<%s", level * 2, "", name);
+	for (i = 0; i < b->attrs; i++)
+	{
+		_bench_value(state, _bench_attrs[i].kind, value, sizeof(value));
+		fprintf(f, " %s=\"%s\"", _bench_attrs[i].name, value);
+	}
+	if (level == b->depth)
+	{
+		fprintf(f, " x=\"%d\" y=\"%d\" width=\"10\" height=\"10\"/>\n",
+				(int)(_bench_random(state) % 1000),
+				(int)(_bench_random(state) % 1000));
+		return;
+	}
+	fprintf(f, ">\n");
+	for (i = 0; i < b->fanout; i++)
+		_bench_generate_element(b, f, state, level + 1);
+	fprintf(f, "%*s</%s>\n", level * 2, "", name);
+}
+
+static Eina_Bool _bench_generate(Bench *b, const char *file)
+{
+	uint64_t state = b->seed;
+	FILE *f;
+	int i;
+
+	f = fopen(file, "w");
+	if (!f)
+		return EINA_FALSE;
+	fprintf(f, "<svg xmlns=\"http://www.w3.org/2000/svg\" "
+			"width=\"1000\" height=\"1000\">\n");
+	for (i = 0; i < b->fanout; i++)
+		_bench_generate_element(b, f, &state, 1);
+	fprintf(f, "</svg>\n");
+	return !fclose(f);
+}
+
+/*----------------------------------------------------------------------------*
+ *                              The kernel                                    *
+ *----------------------------------------------------------------------------*/
+static void _bench_kernel_path(Bench *b, const char *path, char *full)
+{
+	snprintf(full, PATH_MAX, "%s%s", b->mnt, path);
+}
+
+static Eina_Bool _bench_kernel_stat(Bench *b, const char *path,
+		struct stat *st)
+{
+	char full[PATH_MAX];
+
+	_bench_kernel_path(b, path, full);
+	return !lstat(full, st);
+}
+
+static Eina_Bool _bench_kernel_list(Bench *b, const char *path,
+		Eguebfs_Op_Filler filler, void *data)
+{
+	char full[PATH_MAX];
+	struct dirent *de;
+	DIR *dir;
+
+	_bench_kernel_path(b, path, full);
+	dir = opendir(full);
+	if (!dir)
+		return EINA_FALSE;
+	while ((de = readdir(dir)))
+	{
+		if (!filler(data, de->d_name, de->d_off))
+			break;
+	}
+	closedir(dir);
+	return EINA_TRUE;
+}
+
+static Eina_Bool _bench_kernel_open(Bench *b, const char *path, int flags,
+		Bench_File *f)
+{
+	char full[PATH_MAX];
+
+	_bench_kernel_path(b, path, full);
+	f->fd = open(full, flags);
+	return f->fd >= 0;
+}
+
+static ssize_t _bench_kernel_read(Bench *b, Bench_File *f, char *buf,
+		size_t size, off_t offset)
+{
+	return pread(f->fd, buf, size, offset);
+}
+
+static ssize_t _bench_kernel_write(Bench *b, Bench_File *f, const char *buf,
+		size_t size, off_t offset)
+{
+	return pwrite(f->fd, buf, size, offset);
+}
+
+static Eina_Bool _bench_kernel_close(Bench *b, Bench_File *f)
+{
+	return !close(f->fd);
+}
+
+static const Bench_Backend _bench_kernel = {
+	"kernel",
+	_bench_kernel_stat,
+	_bench_kernel_list,
+	_bench_kernel_open,
+	_bench_kernel_read,
+	_bench_kernel_write,
+	_bench_kernel_close,
+};
+
+/*----------------------------------------------------------------------------*
+ *                              In process                                    *
+ *----------------------------------------------------------------------------*/
+static Eina_Bool _bench_process_stat(Bench *b, const char *path,
+		struct stat *st)
+{
+	uint64_t ino;
+
+	if (eguebfs_op_resolve(b->efs, path, &ino, st))
+		return EINA_FALSE;
+	eguebfs_op_forget(b->efs, ino, 1);
+	return EINA_TRUE;
+}
+
+static Eina_Bool _bench_process_list(Bench *b, const char *path,
+		Eguebfs_Op_Filler filler, void *data)
+{
+	uint64_t ino;
+	int err;
+
+	if (eguebfs_op_resolve(b->efs, path, &ino, NULL))
+		return EINA_FALSE;
+	err = eguebfs_op_readdir(b->efs, ino, 0, filler, data);
+	eguebfs_op_forget(b->efs, ino, 1);
+	return !err;
+}
+
+/* The inode is forgotten once closed, like the kernel does */
+static Eina_Bool _bench_process_open(Bench *b, const char *path, int flags,
+		Bench_File *f)
+{
+	if (eguebfs_op_resolve(b->efs, path, &f->ino, NULL))
+		return EINA_FALSE;
+	if (eguebfs_op_open(b->efs, f->ino, flags, &f->f))
+	{
+		eguebfs_op_forget(b->efs, f->ino, 1);
+		return EINA_FALSE;
+	}
+	return EINA_TRUE;
+}
+
+static ssize_t _bench_process_read(Bench *b, Bench_File *f, char *buf,
+		size_t size, off_t offset)
+{
+	size_t length;
+
+	if (eguebfs_op_read(b->efs, f->f, buf, size, offset, &length))
+		return -1;
+	return length;
+}
+
+static ssize_t _bench_process_write(Bench *b, Bench_File *f, const char *buf,
+		size_t size, off_t offset)
+{
+	size_t written;
+
+	if (eguebfs_op_write(b->efs, f->f, buf, size, offset, &written))
+		return -1;
+	return written;
+}
+
+static Eina_Bool _bench_process_close(Bench *b, Bench_File *f)
+{
+	int err;
+
+	err = eguebfs_op_release(b->efs, f->f);
+	eguebfs_op_forget(b->efs, f->ino, 1);
+	return !err;
+}
+
+static const Bench_Backend _bench_process = {
+	"process",
+	_bench_process_stat,
+	_bench_process_list,
+	_bench_process_open,
+	_bench_process_read,
+	_bench_process_write,
+	_bench_process_close,
+};
+
+/*----------------------------------------------------------------------------*
+ *                               The tree                                     *
+ *----------------------------------------------------------------------------*/
+static Eina_Bool _bench_names_add(void *data, const char *name,
+		off_t next EINA_UNUSED)
+{
+	/* skip the control files and the serialization */
+	if (name[0] != '.')
+		eina_array_push(data, strdup(name));
+	return EINA_TRUE;
+}
+
+/* Walk the tree keeping the paths the workloads use. The entries are listed
+ * first, nothing else can be done while listing in process
+ */
+static void _bench_walk(Bench *b, const char *path, int level, int *deepest)
+{
+	Eina_Array *names;
+	unsigned int i;
+
+	names = eina_array_new(16);
+	if (!b->backend->list(b, path, _bench_names_add, names))
+		goto done;
+	eina_array_push(b->dirs, strdup(path));
+	for (i = 0; i < eina_array_count(names); i++)
+	{
+		const char *name = eina_array_data_get(names, i);
+		struct stat st;
+		char *child;
+
+		if (asprintf(&child, "%s/%s", path, name) < 0)
+			continue;
+		if (!b->backend->stat(b, child, &st))
+		{
+			free(child);
+			continue;
+		}
+		eina_array_push(b->paths, child);
+		if (S_ISDIR(st.st_mode))
+		{
+			/* elements are the topmost and the directories with an
+			 * index
+			 */
+			if (!level || strchr(name, '@'))
+			{
+				b->elements++;
+				if (level + 1 > *deepest)
+					*deepest = level + 1;
+			}
+			_bench_walk(b, child, level + 1, deepest);
+		}
+		else if (!strcmp(name, "base"))
+		{
+			const char *attr;
+
+			/* only the attributes we know how to write */
+			attr = strrchr(path, '/');
+			if (attr && _bench_attr_find(attr + 1))
+				eina_array_push(b->bases, child);
+		}
+	}
+done:
+	for (i = 0; i < eina_array_count(names); i++)
+		free(eina_array_data_get(names, i));
+	eina_array_free(names);
+}
+
+static Eina_Bool _bench_discover(Bench *b)
+{
+	unsigned int i;
+	int deepest = 0;
+
+	_bench_walk(b, "", 0, &deepest);
+	for (i = 0; i < eina_array_count(b->dirs); i++)
+	{
+		const char *dir = eina_array_data_get(b->dirs, i);
+		const char *name = strrchr(dir, '/');
+		const char *p;
+		int level = 0;
+
+		if (!name || !strchr(name, '@'))
+			continue;
+		for (p = dir; *p; p++)
+		{
+			if (*p == '/')
+				level++;
+		}
+		if (level == deepest)
+			eina_array_push(b->deep, dir);
+	}
+	b->xml = strdup("/svg/.xml");
+	return eina_array_count(b->paths) && eina_array_count(b->deep) &&
+			eina_array_count(b->bases);
+}
+
+static const char * _bench_pick(Bench_Client *c, Eina_Array *a)
+{
+	return eina_array_data_get(a, _bench_random(&c->state) %
+			eina_array_count(a));
+}
+
+/*----------------------------------------------------------------------------*
+ *                             The workloads                                  *
+ *----------------------------------------------------------------------------*/
+static void _bench_record(Bench_Client *c, uint64_t start, Eina_Bool ok)
+{
+	c->latencies[c->count++] = _bench_now() - start;
+	if (!ok)
+		c->errors++;
+}
+
+static void _bench_stat(Bench_Client *c)
+{
+	Bench *b = c->b;
+	struct stat st;
+	uint64_t start;
+
+	start = _bench_now();
+	_bench_record(c, start, b->backend->stat(b, _bench_pick(c, b->paths),
+			&st));
+}
+
+/* Every component of the path is looked up again, nothing is cached */
+static void _bench_lookup(Bench_Client *c)
+{
+	Bench *b = c->b;
+	struct stat st;
+	uint64_t start;
+
+	start = _bench_now();
+	_bench_record(c, start, b->backend->stat(b, _bench_pick(c, b->deep),
+			&st));
+}
+
+static Eina_Bool _bench_names_skip(void *data, const char *name,
+		off_t next EINA_UNUSED)
+{
+	return EINA_TRUE;
+}
+
+/* The directories are listed in the order of a recursive walk */
+static void _bench_list(Bench_Client *c)
+{
+	Bench *b = c->b;
+	uint64_t start;
+
+	start = _bench_now();
+	_bench_record(c, start, b->backend->list(b, eina_array_data_get(b->dirs,
+			c->count % eina_array_count(b->dirs)),
+			_bench_names_skip, NULL));
+}
+
+/* Read the serialization of the whole document a block at a time */
+static void _bench_read(Bench_Client *c)
+{
+	Bench *b = c->b;
+	uint64_t start;
+	ssize_t ret;
+
+	start = _bench_now();
+	if (!c->opened)
+	{
+		c->opened = b->backend->open(b, b->xml, O_RDONLY, &c->file);
+		c->offset = 0;
+	}
+	if (!c->opened)
+	{
+		_bench_record(c, start, EINA_FALSE);
+		return;
+	}
+	ret = b->backend->read(b, &c->file, c->buf, b->block, c->offset);
+	if (ret > 0)
+	{
+		c->bytes += ret;
+		c->offset += ret;
+	}
+	else
+	{
+		b->backend->close(b, &c->file);
+		c->opened = EINA_FALSE;
+	}
+	_bench_record(c, start, ret >= 0);
+}
+
+static Eina_Bool _bench_write_value(Bench_Client *c, const char *path)
+{
+	Bench *b = c->b;
+	Bench_File f;
+	const Bench_Attr *attr;
+	const char *start;
+	const char *end;
+	char name[64];
+	char value[32];
+	size_t len;
+
+	/* the attribute is the directory of the base file */
+	end = strrchr(path, '/');
+	for (start = end; start > path && start[-1] != '/'; start--)
+		;
+	len = end - start;
+	if (len >= sizeof(name))
+		return EINA_FALSE;
+	memcpy(name, start, len);
+	name[len] = '\0';
+	attr = _bench_attr_find(name);
+	if (!attr)
+		return EINA_FALSE;
+	_bench_value(&c->state, attr->kind, value, sizeof(value));
+	len = strlen(value);
+
+	if (!b->backend->open(b, path, O_WRONLY | O_TRUNC, &f))
+		return EINA_FALSE;
+	if (b->backend->write(b, &f, value, len, 0) != (ssize_t)len)
+	{
+		b->backend->close(b, &f);
+		return EINA_FALSE;
+	}
+	c->bytes += len;
+	/* the value is set when closed */
+	return b->backend->close(b, &f);
+}
+
+/* Open, write a single value and close, like a shell redirection does */
+static void _bench_write(Bench_Client *c)
+{
+	uint64_t start;
+
+	start = _bench_now();
+	_bench_record(c, start, _bench_write_value(c, _bench_pick(c,
+			c->b->bases)));
+}
+
+static Eina_Bool _bench_read_file(Bench_Client *c, const char *path)
+{
+	Bench *b = c->b;
+	Bench_File f;
+	char buf[4096];
+	off_t offset = 0;
+	ssize_t ret;
+
+	if (!b->backend->open(b, path, O_RDONLY, &f))
+		return EINA_FALSE;
+	while ((ret = b->backend->read(b, &f, buf, sizeof(buf), offset)) > 0)
+	{
+		c->bytes += ret;
+		offset += ret;
+	}
+	b->backend->close(b, &f);
+	return ret == 0;
+}
+
+/* Half of the operations are stats, the rest listings, reads and writes */
+static void _bench_mixed(Bench_Client *c)
+{
+	Bench *b = c->b;
+	uint64_t start;
+	uint64_t r;
+	Eina_Bool ok;
+
+	r = _bench_random(&c->state) % 10;
+	start = _bench_now();
+	if (r < 5)
+	{
+		struct stat st;
+
+		ok = b->backend->stat(b, _bench_pick(c, b->paths), &st);
+	}
+	else if (r < 7)
+		ok = b->backend->list(b, _bench_pick(c, b->dirs),
+				_bench_names_skip, NULL);
+	else if (r < 9)
+		ok = _bench_read_file(c, _bench_pick(c, b->bases));
+	else
+		ok = _bench_write_value(c, _bench_pick(c, b->bases));
+	_bench_record(c, start, ok);
+}
+
+static const Bench_Workload _bench_workloads[] = {
+	{ "stat", _bench_stat, EINA_FALSE },
+	{ "list", _bench_list, EINA_FALSE },
+	{ "read", _bench_read, EINA_FALSE },
+	{ "write", _bench_write, EINA_FALSE },
+	{ "lookup", _bench_lookup, EINA_FALSE },
+	{ "mixed", _bench_mixed, EINA_TRUE },
+};
+#define BENCH_WORKLOADS \
+	(int)(sizeof(_bench_workloads) / sizeof(_bench_workloads[0]))
+
+typedef struct _Bench_Run
+{
+	Bench_Client *c;
+	Bench_Op op;
+} Bench_Run;
+
+static void * _bench_client_main(void *data, Eina_Thread t)
+{
+	Bench_Run *r = data;
+
+	while (r->c->count < r->c->ops)
+		r->op(r->c);
+	return NULL;
+}
+
+static int _bench_latency_cmp(const void *a, const void *b)
+{
+	uint64_t la = *(const uint64_t *)a;
+	uint64_t lb = *(const uint64_t *)b;
+
+	return la < lb ? -1 : la > lb;
+}
+
+static void _bench_workload_run(Bench *b, const Bench_Workload *w)
+{
+	Bench_Client *clients;
+	Bench_Run *runs;
+	Eina_Thread *threads;
+	Eina_Bool *created;
+	uint64_t *latencies;
+	uint64_t errors = 0;
+	uint64_t bytes = 0;
+	uint64_t start;
+	double seconds;
+	int nclients = w->concurrent ? b->clients : 1;
+	int count = 0;
+	int i;
+
+	clients = calloc(nclients, sizeof(Bench_Client));
+	runs = calloc(nclients, sizeof(Bench_Run));
+	threads = calloc(nclients, sizeof(Eina_Thread));
+	created = calloc(nclients, sizeof(Eina_Bool));
+	/* the operations are shared between the clients */
+	for (i = 0; i < nclients; i++)
+	{
+		Bench_Client *c = &clients[i];
+
+		c->b = b;
+		c->state = ((uint64_t)b->seed << 16) + i + 1;
+		c->ops = b->ops / nclients + (i < b->ops % nclients);
+		c->latencies = malloc(sizeof(uint64_t) * (c->ops + 1));
+		c->buf = malloc(b->block);
+		runs[i].c = c;
+		runs[i].op = w->op;
+	}
+
+	start = _bench_now();
+	for (i = 0; i < nclients; i++)
+	{
+		created[i] = eina_thread_create(&threads[i],
+				EINA_THREAD_NORMAL, -1, _bench_client_main,
+				&runs[i]);
+		/* run it here instead, the results would still be right */
+		if (!created[i])
+			_bench_client_main(&runs[i], threads[i]);
+	}
+	for (i = 0; i < nclients; i++)
+	{
+		if (created[i])
+			eina_thread_join(threads[i]);
+	}
+	seconds = (_bench_now() - start) / 1e9;
+
+	latencies = malloc(sizeof(uint64_t) * (b->ops + 1));
+	for (i = 0; i < nclients; i++)
+	{
+		Bench_Client *c = &clients[i];
+
+		memcpy(latencies + count, c->latencies,
+				sizeof(uint64_t) * c->count);
+		count += c->count;
+		errors += c->errors;
+		bytes += c->bytes;
+		if (c->opened)
+			b->backend->close(b, &c->file);
+		free(c->buf);
+		free(c->latencies);
+	}
+	qsort(latencies, count, sizeof(uint64_t), _bench_latency_cmp);
+
+	printf("%s %d %d %" PRIu64 " %" PRIu64 " %.3f %.1f %.3f %.1f %.1f\n",
+			w->name, nclients, count, errors, bytes, seconds,
+			seconds > 0 ? count / seconds : 0.0,
+			seconds > 0 ? bytes / seconds / (1024 * 1024) : 0.0,
+			count ? latencies[count * 50 / 100] / 1000.0 : 0.0,
+			count ? latencies[count * 99 / 100] / 1000.0 : 0.0);
+	fflush(stdout);
+
+	free(latencies);
+	free(created);
+	free(threads);
+	free(runs);
+	free(clients);
+}
+
+static void help(void)
+{
+	printf("Usage: eguebfs_bench [OPTIONS] DIR\n");
+	printf("Generates DIR/bench.svg, mounts it on DIR/mnt and runs the\n");
+	printf("workloads on it. Where OPTIONS can be one of the following:\n");
+	printf("-h Print this screen\n");
+	printf("-p Do the operations in process, without mounting\n");
+	printf("-d DEPTH Levels of elements under the topmost one (5)\n");
+	printf("-f FANOUT Children of every element but the deepest (4)\n");
+	printf("-a ATTRIBUTES Attributes of every element, at most %d (4)\n",
+			BENCH_ATTRS);
+	printf("-r SEED Seed of the document and the workloads (1)\n");
+	printf("-n OPERATIONS Operations done by every workload (10000)\n");
+	printf("-c CLIENTS Threads running the mixed workload (4)\n");
+	printf("-b BYTES Size of the blocks of the read workload (65536)\n");
+	printf("-w WORKLOAD Only run one of stat, list, read, write,\n");
+	printf("           lookup or mixed\n");
+	printf("-t THREADS Number of threads processing requests\n");
+	printf("-C SECONDS Time the kernel caches names and attributes (0)\n");
+	printf("-l MEGABYTES Keep at most MEGABYTES of the document parsed\n");
+	printf("-i KILOBYTES Largest read and write requests of the kernel\n");
+	printf("-W Let the kernel keep the writes and send them together\n");
+	printf("-S Let the kernel send only one read of a file at a time\n");
+}
+
+int main(int argc, char **argv)
+{
+	Eguebfs_Options opts;
+	Bench b;
+	const char *only = NULL;
+	char *file = NULL;
+	char *short_options = "hpWSd:f:a:r:n:c:b:w:t:C:l:i:";
+	struct option long_options[] = {
+		{ "help", 0, 0, 'h' },
+		{ "process", 0, 0, 'p' },
+		{ "depth", 1, 0, 'd' },
+		{ "fanout", 1, 0, 'f' },
+		{ "attributes", 1, 0, 'a' },
+		{ "seed", 1, 0, 'r' },
+		{ "operations", 1, 0, 'n' },
+		{ "clients", 1, 0, 'c' },
+		{ "block", 1, 0, 'b' },
+		{ "workload", 1, 0, 'w' },
+		{ "threads", 1, 0, 't' },
+		{ "cache", 1, 0, 'C' },
+		{ "lazy", 1, 0, 'l' },
+		{ "io", 1, 0, 'i' },
+		{ "writeback", 0, 0, 'W' },
+		{ "sync-read", 0, 0, 'S' },
+		{ 0, 0, 0, 0 },
+	};
+	int option;
+	int ret;
+	int i;
+	int err = 1;
+
+	memset(&b, 0, sizeof(Bench));
+	b.backend = &_bench_kernel;
+	b.depth = 5;
+	b.fanout = 4;
+	b.attrs = 4;
+	b.seed = 1;
+	b.ops = 10000;
+	b.clients = 4;
+	b.block = 65536;
+
+	eguebfs_options_default_get(&opts);
+	opts.entry_timeout = 0;
+	opts.attr_timeout = 0;
+	/* parse the options */
+	while ((ret = getopt_long(argc, argv, short_options, long_options,
+			&option)) != -1)
+	{
+		switch (ret)
+		{
+			case 'h':
+			help();
+			return 0;
+
+			case 'p':
+			b.backend = &_bench_process;
+			break;
+
+			case 'd':
+			b.depth = atoi(optarg);
+			break;
+
+			case 'f':
+			b.fanout = atoi(optarg);
+			break;
+
+			case 'a':
+			b.attrs = atoi(optarg);
+			break;
+
+			case 'r':
+			b.seed = strtoul(optarg, NULL, 10);
+			break;
+
+			case 'n':
+			b.ops = atoi(optarg);
+			break;
+
+			case 'c':
+			b.clients = atoi(optarg);
+			break;
+
+			case 'b':
+			b.block = strtoul(optarg, NULL, 10);
+			break;
+
+			case 'w':
+			only = optarg;
+			break;
+
+			case 't':
+			opts.workers = atoi(optarg);
+			break;
+
+			case 'C':
+			opts.entry_timeout = atof(optarg);
+			opts.attr_timeout = opts.entry_timeout;
+			break;
+
+			case 'l':
+			opts.lazy_budget = atof(optarg) * 1024 * 1024;
+			break;
+
+			case 'i':
+			opts.max_read = strtoul(optarg, NULL, 10) * 1024;
+			opts.max_write = opts.max_read;
+			break;
+
+			case 'W':
+			opts.writeback_cache = EINA_TRUE;
+			break;
+
+			case 'S':
+			opts.async_read = EINA_FALSE;
+			break;
+
+			default:
+			break;
+		}
+	}
+
+	if (argc - optind != 1 || b.depth < 1 || b.fanout < 1 ||
+			b.attrs < 0 || b.attrs > BENCH_ATTRS || b.ops < 1 ||
+			b.clients < 1 || !b.block || b.block > 1024 * 1024 ||
+			!b.seed)
+	{
+		help();
+		return 1;
+	}
+
+	if (asprintf(&file, "%s/bench.svg", argv[optind]) < 0 ||
+			asprintf(&b.mnt, "%s/mnt", argv[optind]) < 0)
+		return 1;
+	mkdir(argv[optind], 0755);
+	mkdir(b.mnt, 0755);
+	if (!_bench_generate(&b, file))
+	{
+		fprintf(stderr, "Fail to generate %s\n", file);
+		goto done;
+	}
+
+	eguebfs_init();
+	b.paths = eina_array_new(1024);
+	b.dirs = eina_array_new(1024);
+	b.deep = eina_array_new(1024);
+	b.bases = eina_array_new(1024);
+
+	b.efs = eguebfs_mount_file(file, b.backend == &_bench_process ?
+			NULL : b.mnt, &opts);
+	if (!b.efs)
+	{
+		fprintf(stderr, "Fail to mount %s on %s\n", file, b.mnt);
+		goto shutdown;
+	}
+	if (!_bench_discover(&b))
+	{
+		fprintf(stderr, "Fail to walk %s\n", file);
+		goto umount;
+	}
+
+	printf("# %s depth %d fanout %d attributes %d seed %u operations %d "
+			"paths %u elements %u\n", b.backend->name, b.depth,
+			b.fanout, b.attrs, b.seed, b.ops,
+			eina_array_count(b.paths), b.elements);
+	printf("# workload clients ops errors bytes seconds ops_per_s "
+			"mb_per_s p50_us p99_us\n");
+	for (i = 0; i < BENCH_WORKLOADS; i++)
+	{
+		if (only && strcmp(only, _bench_workloads[i].name))
+			continue;
+		_bench_workload_run(&b, &_bench_workloads[i]);
+	}
+	err = 0;
+
+umount:
+	eguebfs_umount(b.efs);
+shutdown:
+	/* the deep ones are also dirs and the bases are also paths */
+	for (i = 0; i < (int)eina_array_count(b.paths); i++)
+		free(eina_array_data_get(b.paths, i));
+	for (i = 0; i < (int)eina_array_count(b.dirs); i++)
+		free(eina_array_data_get(b.dirs, i));
+	eina_array_free(b.paths);
+	eina_array_free(b.dirs);
+	eina_array_free(b.deep);
+	eina_array_free(b.bases);
+	free(b.xml);
+	eguebfs_shutdown();
+done:
+	free(b.mnt);
+	free(file);
+	return err;
+}
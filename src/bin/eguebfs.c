@@ -1,6 +1,7 @@
 #define _GNU_SOURCE
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <getopt.h>
 
 #include <Eguebfs.h>
@@ -13,6 +14,41 @@ static void help(void)
 	printf("Where OPTIONS can be one of the following:\n");
 	printf("-h Print this screen\n");
 	printf("-v Create a window to visualize the file\n");
+	printf("-t THREADS Number of threads processing requests\n");
+	printf("-c SECONDS Time the kernel caches names and attributes\n");
+	printf("-s SECONDS Save the changes back to FILE once there are none\n");
+	printf("           for SECONDS\n");
+	printf("-l MEGABYTES Parse FILE as it is walked, keeping at most\n");
+	printf("           MEGABYTES of it parsed. Can not be used with -v\n");
+	printf("-b Mount FILE right away and parse it on the background.\n");
+	printf("           Can not be used with -v nor -l\n");
+	printf("-i KILOBYTES Largest read and write requests of the kernel\n");
+	printf("-x MEGABYTES Most of the .xml files kept once serialized\n");
+	printf("-W Let the kernel keep the writes and send them together\n");
+	printf("-S Let the kernel send only one read of a file at a time\n");
+}
+
+static Eguebfs *_efs = NULL;
+static Ecore_Select_Function _select_func = NULL;
+
+/* The main loop owns the document while it is not waiting for events */
+static int _select_unlocked(int nfds, fd_set *readfds, fd_set *writefds,
+		fd_set *exceptfds, struct timeval *timeout)
+{
+	int ret;
+
+	eguebfs_unlock(_efs);
+	ret = _select_func(nfds, readfds, writefds, exceptfds, timeout);
+	eguebfs_lock(_efs);
+
+	return ret;
+}
+
+/* The window processes and animates the document on every frame */
+static Eina_Bool _changed_cb(void *data EINA_UNUSED)
+{
+	eguebfs_changed(_efs);
+	return ECORE_CALLBACK_RENEW;
 }
 
 static void window_close_cb(Egueb_Dom_Event *e,
@@ -23,19 +59,33 @@ static void window_close_cb(Egueb_Dom_Event *e,
 
 int main(int argc, char **argv)
 {
-	Eguebfs *efs;
+	Eguebfs_Options opts;
 	Egueb_Dom_Node *doc = NULL;
 	Egueb_Dom_Window *w = NULL;
+	Ecore_Animator *animator = NULL;
 	Enesim_Stream *stream;
 	Eina_Bool visualize = EINA_FALSE;
-	char *short_options = "hv";
+	Eina_Bool save = EINA_FALSE;
+	Eina_Bool lazy = EINA_FALSE;
+	char *short_options = "hvbWSt:c:s:l:i:x:";
 	struct option long_options[] = {
 		{ "help", 1, 0, 'h' },
 		{ "visualize", 1, 0, 'w' },
+		{ "threads", 1, 0, 't' },
+		{ "cache", 1, 0, 'c' },
+		{ "save", 1, 0, 's' },
+		{ "lazy", 1, 0, 'l' },
+		{ "background", 0, 0, 'b' },
+		{ "io", 1, 0, 'i' },
+		{ "writeback", 0, 0, 'W' },
+		{ "sync-read", 0, 0, 'S' },
+		{ "xml", 1, 0, 'x' },
+		{ 0, 0, 0, 0 }
 	};
 	int option;
 	int ret;
 
+	eguebfs_options_default_get(&opts);
 	/* parse the options */
 	while ((ret = getopt_long(argc, argv, short_options, long_options,
 			&option)) != -1)
@@ -48,6 +98,48 @@ int main(int argc, char **argv)
 
 			case 'v':
 			visualize = EINA_TRUE;
+			break;
+
+			case 't':
+			opts.workers = atoi(optarg);
+			break;
+
+			case 'c':
+			opts.entry_timeout = atof(optarg);
+			opts.attr_timeout = opts.entry_timeout;
+			break;
+
+			case 's':
+			save = EINA_TRUE;
+			opts.save_delay = atof(optarg);
+			break;
+
+			case 'l':
+			lazy = EINA_TRUE;
+			opts.lazy_budget = atof(optarg) * 1024 * 1024;
+			break;
+
+			case 'b':
+			lazy = EINA_TRUE;
+			opts.lazy_load = EINA_TRUE;
+			break;
+
+			case 'i':
+			opts.max_read = strtoul(optarg, NULL, 10) * 1024;
+			opts.max_write = opts.max_read;
+			break;
+
+			case 'x':
+			opts.xml_budget = atof(optarg) * 1024 * 1024;
+			break;
+
+			case 'W':
+			opts.writeback_cache = EINA_TRUE;
+			break;
+
+			case 'S':
+			opts.async_read = EINA_FALSE;
+			break;
 
 			default:
 			break;
@@ -60,11 +152,32 @@ int main(int argc, char **argv)
 		help();
 		return 0;
 	}
+	if (save)
+		opts.save_path = argv[optind];
+	/* the window needs the whole document */
+	if ((lazy && visualize) || (opts.lazy_load && opts.lazy_budget))
+	{
+		help();
+		return 0;
+	}
 
 	ecore_init();
 	eguebfs_init();
 	efl_egueb_init();
 
+	if (lazy)
+	{
+		_efs = eguebfs_mount_file(argv[optind], argv[optind + 1],
+				&opts);
+		if (!_efs)
+		{
+			printf("Fail to mount %s on %s\n", argv[optind],
+					argv[optind + 1]);
+			goto shutdown;
+		}
+		goto mounted;
+	}
+
 	stream = enesim_stream_file_new(argv[optind], "r");
 	if (!stream)
 	{
@@ -96,14 +209,32 @@ int main(int argc, char **argv)
 				EINA_TRUE, NULL);
 	}
 	/* mount and wait */
-	efs = eguebfs_mount(egueb_dom_node_ref(doc), argv[optind + 1]);
+	_efs = eguebfs_mount_with_options(egueb_dom_node_ref(doc),
+			argv[optind + 1], &opts);
+	if (!_efs)
+	{
+		printf("Fail to mount on %s\n", argv[optind + 1]);
+		goto no_mount;
+	}
+	if (w)
+		animator = ecore_animator_add(_changed_cb, NULL);
+mounted:
+	_select_func = ecore_main_loop_select_func_get();
+	ecore_main_loop_select_func_set(_select_unlocked);
+	eguebfs_lock(_efs);
 	ecore_main_loop_begin();
-	eguebfs_umount(efs);
+	eguebfs_unlock(_efs);
+	ecore_main_loop_select_func_set(_select_func);
+	if (animator)
+		ecore_animator_del(animator);
+	eguebfs_umount(_efs);
+no_mount:
 	if (w)
 		egueb_dom_window_unref(w);
 
 no_window:
-	egueb_dom_node_unref(doc);
+	if (doc)
+		egueb_dom_node_unref(doc);
 shutdown:
 	eguebfs_shutdown();
 	efl_egueb_shutdown();
@@ -22,6 +22,10 @@
 #include <Eina.h>
 #include <Egueb_Dom.h>
 
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -29,13 +33,207 @@ extern "C" {
 #include "eguebfs_build.h"
 
 typedef struct _Eguebfs Eguebfs;
+typedef struct _Eguebfs_Document Eguebfs_Document;
+typedef struct _Eguebfs_Op_File Eguebfs_Op_File;
+
+/* Called with every entry of a directory listed with eguebfs_op_readdir(),
+ * next is the offset the listing resumes from after the entry. Return
+ * EINA_FALSE to stop the listing
+ */
+typedef Eina_Bool (*Eguebfs_Op_Filler)(void *data, const char *name,
+		off_t next);
+
+/* The inode of the root of every filesystem */
+#define EGUEBFS_OP_ROOT 1
+
+typedef struct _Eguebfs_Options
+{
+	/* number of threads processing requests. The requests on the same
+	 * document are processed one at a time, even the ones that only read
+	 * it, as Egueb references its nodes without any atomic operation.
+	 * Only the requests on different documents run in parallel
+	 */
+	int workers;
+	/* seconds the kernel can cache names and attributes, any change on
+	 * the document makes the kernel forget them
+	 */
+	double entry_timeout;
+	double attr_timeout;
+	/* file where the changes on the document are saved, NULL to not
+	 * save them. The document is saved once it has not changed for
+	 * save_delay seconds and on unmount. The documents of a mount done
+	 * with eguebfs_mount_documents() tell it when added
+	 */
+	const char *save_path;
+	double save_delay;
+	/* bytes of the file a document mounted with eguebfs_mount_file()
+	 * keeps parsed, the parts not modified and not in use are parsed
+	 * again when needed. Zero keeps everything once parsed
+	 */
+	size_t lazy_budget;
+	/* parse the rest of the file on the background once a document
+	 * mounted with eguebfs_mount_file() is mounted, without any budget.
+	 * The /.progress file tells how much of it has been parsed
+	 */
+	Eina_Bool lazy_load;
+	/* bytes of the .xml files every document keeps once serialized, the
+	 * ones not used lately are serialized again when needed. Zero keeps
+	 * all of them
+	 */
+	size_t xml_budget;
+	/* largest read and write requests, in bytes, the kernel sends. Zero
+	 * lets the kernel and fuse agree on the largest they can, which
+	 * moves big values in few requests
+	 */
+	size_t max_read;
+	size_t max_write;
+	/* let the kernel keep the writes and send them together later, on
+	 * close at the latest, instead of one request per write. The kernel
+	 * then knows the size of a file being written better than the
+	 * document does until it is closed
+	 */
+	Eina_Bool writeback_cache;
+	/* let the kernel send several reads of the same file at once, like
+	 * the ones of the readahead
+	 */
+	Eina_Bool async_read;
+} Eguebfs_Options;
+
+/* The operations counted by eguebfs_stats_get(), a truncate is a setattr
+ * changing the size and a flush includes the fsync
+ */
+typedef enum _Eguebfs_Stats_Op
+{
+	EGUEBFS_STATS_OP_LOOKUP,
+	EGUEBFS_STATS_OP_GETATTR,
+	EGUEBFS_STATS_OP_TRUNCATE,
+	EGUEBFS_STATS_OP_READDIR,
+	EGUEBFS_STATS_OP_OPEN,
+	EGUEBFS_STATS_OP_READ,
+	EGUEBFS_STATS_OP_WRITE,
+	EGUEBFS_STATS_OP_FLUSH,
+	EGUEBFS_STATS_OP_MKDIR,
+	EGUEBFS_STATS_OP_RMDIR,
+	EGUEBFS_STATS_OPS,
+} Eguebfs_Stats_Op;
+
+/* The bucket i of a histogram counts the operations that took less than
+ * 2^i microseconds, the last one counts the rest
+ */
+#define EGUEBFS_STATS_BUCKETS 24
+
+typedef struct _Eguebfs_Stats_Op_Counters
+{
+	uint64_t count;
+	/* operations replied with an error */
+	uint64_t errors;
+	/* bytes read, written or listed */
+	uint64_t bytes;
+	/* nanoseconds spent */
+	uint64_t time;
+	uint64_t histogram[EGUEBFS_STATS_BUCKETS];
+} Eguebfs_Stats_Op_Counters;
+
+typedef struct _Eguebfs_Stats
+{
+	Eguebfs_Stats_Op_Counters ops[EGUEBFS_STATS_OPS];
+	/* path components resolved */
+	uint64_t steps;
+	/* paths of a batch found on the path cache */
+	uint64_t path_hits;
+	uint64_t path_misses;
+	/* attribute lengths known without converting the value */
+	uint64_t length_hits;
+	uint64_t length_misses;
+} Eguebfs_Stats;
 
 EAPI void eguebfs_init(void);
 EAPI void eguebfs_shutdown(void);
 
+EAPI void eguebfs_options_default_get(Eguebfs_Options *opts);
+
 EAPI Eguebfs * eguebfs_mount(Egueb_Dom_Node *doc, const char *to);
+EAPI Eguebfs * eguebfs_mount_with_options(Egueb_Dom_Node *doc,
+		const char *to, const Eguebfs_Options *opts);
+EAPI Eguebfs * eguebfs_mount_file(const char *file, const char *to,
+		const Eguebfs_Options *opts);
+EAPI Eguebfs * eguebfs_mount_documents(const char *to,
+		const Eguebfs_Options *opts);
 EAPI void eguebfs_umount(Eguebfs *thiz);
 
+/*
+ * A filesystem mounted with a NULL mountpoint is not seen by the kernel and
+ * has no workers. Its operations are done with the functions below, on the
+ * calling thread, running the same code a worker runs for the requests of
+ * the kernel, so the filesystem can be profiled and benchmarked without a
+ * FUSE device. They also work on a mounted filesystem. Every function
+ * returns zero or the errno the kernel would get
+ */
+EAPI int eguebfs_op_lookup(Eguebfs *thiz, uint64_t parent, const char *name,
+		uint64_t *ino, struct stat *st);
+EAPI int eguebfs_op_resolve(Eguebfs *thiz, const char *path, uint64_t *ino,
+		struct stat *st);
+EAPI void eguebfs_op_forget(Eguebfs *thiz, uint64_t ino, uint64_t nlookup);
+EAPI int eguebfs_op_getattr(Eguebfs *thiz, uint64_t ino, struct stat *st);
+EAPI int eguebfs_op_truncate(Eguebfs *thiz, uint64_t ino, off_t length);
+EAPI int eguebfs_op_readdir(Eguebfs *thiz, uint64_t ino, off_t offset,
+		Eguebfs_Op_Filler filler, void *data);
+/* The entries are put on buf as the kernel gets them, a struct fuse_dirent
+ * or, for a listing plus, a struct fuse_direntplus of <linux/fuse.h> each.
+ * Every entry with a node id of a listing plus counts as a lookup of it
+ */
+EAPI int eguebfs_op_readdir_buf(Eguebfs *thiz, uint64_t ino, off_t offset,
+		Eina_Bool plus, char *buf, size_t size, size_t *length);
+EAPI int eguebfs_op_open(Eguebfs *thiz, uint64_t ino, int flags,
+		Eguebfs_Op_File **f);
+EAPI int eguebfs_op_read(Eguebfs *thiz, Eguebfs_Op_File *f, char *buf,
+		size_t size, off_t offset, size_t *length);
+EAPI int eguebfs_op_write(Eguebfs *thiz, Eguebfs_Op_File *f, const char *buf,
+		size_t size, off_t offset, size_t *written);
+EAPI int eguebfs_op_release(Eguebfs *thiz, Eguebfs_Op_File *f);
+EAPI int eguebfs_op_mkdir(Eguebfs *thiz, uint64_t parent, const char *name,
+		uint64_t *ino);
+EAPI int eguebfs_op_rmdir(Eguebfs *thiz, uint64_t parent, const char *name);
+
+/*
+ * Once mounted, the document is accessed from the filesystem workers, one
+ * request at a time as Egueb references its nodes without any atomic
+ * operation. Any other thread that touches the document, like
+ * the application main loop, must do it between eguebfs_lock() and
+ * eguebfs_unlock(), which gives it exclusive access. The mutations are seen
+ * right away, but the animated, styled and final values change without
+ * any, so once the document is processed or animated the application calls
+ * eguebfs_changed(), with the document locked, for the kernel to forget them
+ */
+EAPI void eguebfs_lock(Eguebfs *thiz);
+EAPI void eguebfs_unlock(Eguebfs *thiz);
+EAPI void eguebfs_changed(Eguebfs *thiz);
+
+/*
+ * The counters of everything the workers of a mount have done since it was
+ * mounted, the same the /.stats file has
+ */
+EAPI void eguebfs_stats_get(Eguebfs *thiz, Eguebfs_Stats *stats);
+EAPI const char * eguebfs_stats_op_name_get(Eguebfs_Stats_Op op);
+
+/*
+ * A mount done with eguebfs_mount_documents() serves several documents from
+ * the same workers, each one under a directory at the root named after it.
+ * Documents can be added and removed at any time. Every document has a lock
+ * of its own, so the requests on one document do not wait for the ones on
+ * another, and the application locks each document it touches with
+ * eguebfs_document_lock() and eguebfs_document_unlock() and tells when it
+ * processed one with eguebfs_document_changed()
+ */
+EAPI Eguebfs_Document * eguebfs_document_add(Eguebfs *thiz, const char *name,
+		Egueb_Dom_Node *doc, const char *save_path);
+EAPI Eguebfs_Document * eguebfs_document_add_file(Eguebfs *thiz,
+		const char *name, const char *file, const char *save_path);
+EAPI void eguebfs_document_remove(Eguebfs_Document *d);
+EAPI void eguebfs_document_lock(Eguebfs_Document *d);
+EAPI void eguebfs_document_unlock(Eguebfs_Document *d);
+EAPI void eguebfs_document_changed(Eguebfs_Document *d);
+
 #ifdef __cplusplus
 }
 #endif
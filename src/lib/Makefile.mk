@@ -6,7 +6,20 @@ dist_installed_headers_DATA = \
 src/lib/Eguebfs.h
 
 src_lib_libeguebfs_la_SOURCES = \
-src/lib/eguebfs_main.c
+src/lib/eguebfs_batch.c \
+src/lib/eguebfs_cache.c \
+src/lib/eguebfs_events.c \
+src/lib/eguebfs_file.c \
+src/lib/eguebfs_index.c \
+src/lib/eguebfs_inode.c \
+src/lib/eguebfs_lazy.c \
+src/lib/eguebfs_main.c \
+src/lib/eguebfs_notifier.c \
+src/lib/eguebfs_saver.c \
+src/lib/eguebfs_scratch.c \
+src/lib/eguebfs_stats.c \
+src/lib/eguebfs_xml.c \
+src/lib/eguebfs_private.h
 
 src_lib_libeguebfs_la_CPPFLAGS = \
 -I$(top_srcdir)/src/lib \
@@ -0,0 +1,205 @@
+/* EGUEBFS - FUSE based Egueb filesystem
+ * Copyright (C) 2015 - 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+
+#include "eguebfs_private.h"
+
+#include <stdio.h>
+
+/*
+ * The batch file applies several values at once. Every line written to it
+ * is an operation like:
+ * /svg/g@1/color/base red
+ * That is, the path of a file, a single space and the value to set on it,
+ * which is the rest of the line. The operations are applied when the file
+ * is flushed, all of them or none: if a path can not be resolved nothing is
+ * applied and if a value can not be set the values already set are
+ * restored. Every failing line is reported back on the content of the file
+ */
+/*============================================================================*
+ *                                  Local                                     *
+ *============================================================================*/
+typedef struct _Eguebfs_Batch_Op
+{
+	int line;
+	Eguebfs_File f;
+	const char *value;
+	size_t length;
+	/* the value before setting it, to undo the operation, NULL if it
+	 * was not set
+	 */
+	Egueb_Dom_String *old;
+} Eguebfs_Batch_Op;
+
+static Eina_Bool _eguebfs_batch_file_is_writable(Eguebfs_File *f)
+{
+	switch (f->type)
+	{
+		case EGUEBFS_FILE_TYPE_ATTR_BASE:
+		case EGUEBFS_FILE_TYPE_ATTR_ANIM:
+		case EGUEBFS_FILE_TYPE_ATTR_STYLED:
+		return EINA_TRUE;
+
+		case EGUEBFS_FILE_TYPE_NODE:
+		switch (egueb_dom_node_type_get(f->n))
+		{
+			case EGUEB_DOM_NODE_TYPE_TEXT:
+			case EGUEB_DOM_NODE_TYPE_CDATA_SECTION:
+			return EINA_TRUE;
+
+			default:
+			return EINA_FALSE;
+		}
+
+		default:
+		return EINA_FALSE;
+	}
+}
+
+/* Resolve every operation, on failure the offending lines are reported */
+static Eina_Bool _eguebfs_batch_parse(Eguebfs_Cache *cache, char *buf,
+		size_t length, Eina_Inarray *ops, Eina_Strbuf *report)
+{
+	Eina_Bool ret = EINA_TRUE;
+	char *end = buf + length;
+	char *p = buf;
+	int line = 0;
+
+	while (p < end)
+	{
+		Eguebfs_Batch_Op op;
+		char *eol;
+		char *sep;
+
+		line++;
+		eol = memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+		*eol = '\0';
+		/* skip empty lines */
+		if (p == eol)
+			goto next;
+
+		sep = strchr(p, ' ');
+		if (!sep)
+		{
+			eina_strbuf_append_printf(report,
+					"%d: missing value\n", line);
+			ret = EINA_FALSE;
+			goto next;
+		}
+		*sep = '\0';
+		if (!eguebfs_cache_find(cache, p, &op.f))
+		{
+			eina_strbuf_append_printf(report,
+					"%d: no such file '%s'\n", line, p);
+			ret = EINA_FALSE;
+			goto next;
+		}
+		if (!_eguebfs_batch_file_is_writable(&op.f))
+		{
+			eina_strbuf_append_printf(report,
+					"%d: file '%s' is not writable\n", line, p);
+			egueb_dom_node_unref(op.f.n);
+			ret = EINA_FALSE;
+			goto next;
+		}
+		op.line = line;
+		op.value = sep + 1;
+		op.length = eol - op.value;
+		op.old = NULL;
+		eina_inarray_push(ops, &op);
+next:
+		p = eol + 1;
+	}
+	return ret;
+}
+
+static void _eguebfs_batch_undo(Eina_Inarray *ops, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = count; i > 0; i--)
+	{
+		Eguebfs_Batch_Op *op;
+		const char *chars;
+		Eina_Bool restored;
+
+		op = eina_inarray_nth(ops, i - 1);
+		if (op->old)
+		{
+			chars = egueb_dom_string_chars_get(op->old);
+			restored = eguebfs_file_value_set(&op->f, chars,
+					strlen(chars));
+		}
+		else
+		{
+			restored = eguebfs_file_value_unset(&op->f);
+		}
+		if (!restored)
+			WRN("Fail to restore the value of line %d", op->line);
+	}
+}
+/*============================================================================*
+ *                                 Global                                     *
+ *============================================================================*/
+/* Apply the operations on buf. Must be called with the document locked for
+ * writing, buf is modified
+ */
+Eina_Bool eguebfs_batch_apply(Eguebfs_Cache *cache, char *buf, size_t length,
+		Eina_Strbuf *report)
+{
+	Eina_Inarray *ops;
+	Eguebfs_Batch_Op *op;
+	Eina_Bool ret;
+	unsigned int i;
+
+	ops = eina_inarray_new(sizeof(Eguebfs_Batch_Op), 64);
+	ret = _eguebfs_batch_parse(cache, buf, length, ops, report);
+	if (!ret)
+		goto done;
+
+	for (i = 0; i < eina_inarray_count(ops); i++)
+	{
+		op = eina_inarray_nth(ops, i);
+		op->old = eguebfs_file_value_get(&op->f);
+		if (!eguebfs_file_value_set(&op->f, op->value, op->length))
+		{
+			eina_strbuf_append_printf(report,
+					"%d: invalid value '%.*s'\n", op->line,
+					(int)op->length, op->value);
+			_eguebfs_batch_undo(ops, i);
+			ret = EINA_FALSE;
+			break;
+		}
+	}
+done:
+	EINA_INARRAY_FOREACH(ops, op)
+	{
+		if (op->old)
+			egueb_dom_string_unref(op->old);
+		egueb_dom_node_unref(op->f.n);
+	}
+	eina_inarray_free(ops);
+
+	return ret;
+}
@@ -0,0 +1,369 @@
+/* EGUEBFS - FUSE based Egueb filesystem
+ * Copyright (C) 2015 - 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+
+#include "eguebfs_private.h"
+
+/*
+ * The path cache maps a full path to the file it resolves to. Entries are
+ * kept in a tree that mirrors the filesystem hierarchy, every cached path
+ * has all of its prefixes cached too, so a lookup that misses can resume
+ * from the longest cached prefix and a mutation on a node only needs to
+ * drop the subtree of entries below it.
+ */
+#define EGUEBFS_CACHE_MAX 65536
+/*============================================================================*
+ *                                  Local                                     *
+ *============================================================================*/
+typedef struct _Eguebfs_Cache_Entry Eguebfs_Cache_Entry;
+
+struct _Eguebfs_Cache_Entry
+{
+	EINA_INLIST;
+	Eguebfs_Cache_Entry *parent;
+	Eina_Inlist *children;
+	/* the full path, used as the key on the paths hash */
+	char *path;
+	/* the last component of the path */
+	const char *name;
+	Eguebfs_File f;
+};
+
+struct _Eguebfs_Cache
+{
+	Eina_Lock lock;
+	Egueb_Dom_Node *doc;
+	Eguebfs_Index *index;
+	/* path -> entry */
+	Eina_Hash *paths;
+	/* node -> entry, only for entries of type EGUEBFS_FILE_TYPE_NODE */
+	Eina_Hash *nodes;
+	Eguebfs_Cache_Entry *root;
+	int count;
+};
+
+static Eguebfs_Cache_Entry * _eguebfs_cache_entry_add(Eguebfs_Cache *thiz,
+		Eguebfs_Cache_Entry *parent, const char *path, int len,
+		Eguebfs_File *f)
+{
+	Eguebfs_Cache_Entry *e;
+
+	e = calloc(1, sizeof(Eguebfs_Cache_Entry));
+	e->path = strndup(path, len);
+	e->name = strrchr(e->path, '/') + 1;
+	e->f = *f;
+	e->parent = parent;
+	if (parent)
+		parent->children = eina_inlist_append(parent->children,
+				EINA_INLIST_GET(e));
+
+	eina_hash_direct_add(thiz->paths, e->path, e);
+	if (f->type == EGUEBFS_FILE_TYPE_NODE)
+		eina_hash_add(thiz->nodes, &e->f.n, e);
+	thiz->count++;
+
+	return e;
+}
+
+static void _eguebfs_cache_entry_del(Eguebfs_Cache *thiz,
+		Eguebfs_Cache_Entry *e)
+{
+	Eguebfs_Cache_Entry *child;
+	Eina_Inlist *l;
+
+	EINA_INLIST_FOREACH_SAFE(e->children, l, child)
+	{
+		_eguebfs_cache_entry_del(thiz, child);
+	}
+	if (e->parent)
+		e->parent->children = eina_inlist_remove(e->parent->children,
+				EINA_INLIST_GET(e));
+
+	eina_hash_del(thiz->paths, e->path, e);
+	if (e->f.type == EGUEBFS_FILE_TYPE_NODE)
+		eina_hash_del(thiz->nodes, &e->f.n, e);
+	thiz->count--;
+
+	egueb_dom_node_unref(e->f.n);
+	free(e->path);
+	free(e);
+}
+
+static void _eguebfs_cache_entry_children_del(Eguebfs_Cache *thiz,
+		Eguebfs_Cache_Entry *e)
+{
+	Eguebfs_Cache_Entry *child;
+	Eina_Inlist *l;
+
+	EINA_INLIST_FOREACH_SAFE(e->children, l, child)
+	{
+		_eguebfs_cache_entry_del(thiz, child);
+	}
+}
+
+/* Drop every child entry of the node whose name is the same as the name of
+ * the node being inserted or removed. The repetition number of those
+ * siblings is what changes, the rest of the children keep their path
+ */
+static void _eguebfs_cache_siblings_invalidate(Eguebfs_Cache *thiz,
+		Egueb_Dom_Node *parent, Egueb_Dom_Node *child)
+{
+	Eguebfs_Cache_Entry *e;
+	Eguebfs_Cache_Entry *sibling;
+	Egueb_Dom_String *name;
+	Eina_Inlist *l;
+	const char *chars;
+	size_t len;
+
+	e = eina_hash_find(thiz->nodes, &parent);
+	if (!e)
+		return;
+
+	name = egueb_dom_node_name_get(child);
+	chars = egueb_dom_string_chars_get(name);
+	len = strlen(chars);
+	EINA_INLIST_FOREACH_SAFE(e->children, l, sibling)
+	{
+		if (strncmp(sibling->name, chars, len))
+			continue;
+		if (sibling->name[len] != '@' && sibling->name[len] != '\0')
+			continue;
+		_eguebfs_cache_entry_del(thiz, sibling);
+	}
+	egueb_dom_string_unref(name);
+}
+
+static void _eguebfs_cache_node_mutation_cb(Egueb_Dom_Event *ev,
+		void *data)
+{
+	Eguebfs_Cache *thiz = data;
+	Egueb_Dom_Node *target;
+	Egueb_Dom_Node *parent;
+
+	target = eguebfs_event_target_node_get(ev);
+	parent = egueb_dom_event_mutation_related_get(ev);
+	if (parent)
+	{
+		eina_lock_take(&thiz->lock);
+		_eguebfs_cache_siblings_invalidate(thiz, parent, target);
+		eina_lock_release(&thiz->lock);
+		egueb_dom_node_unref(parent);
+	}
+	egueb_dom_node_unref(target);
+}
+
+static void _eguebfs_cache_attr_mutation_cb(Egueb_Dom_Event *ev,
+		void *data)
+{
+	Eguebfs_Cache *thiz = data;
+	Eguebfs_Cache_Entry *e;
+	Egueb_Dom_Node *attr;
+
+	/* a value change keeps the attribute node, only its existence matters */
+	if (egueb_dom_event_mutation_attr_modification_type_get(ev) ==
+			EGUEB_DOM_EVENT_MUTATION_ATTR_TYPE_MODIFICATION)
+		return;
+
+	attr = egueb_dom_event_mutation_related_get(ev);
+	if (!attr)
+		return;
+
+	eina_lock_take(&thiz->lock);
+	e = eina_hash_find(thiz->nodes, &attr);
+	if (e)
+		_eguebfs_cache_entry_del(thiz, e);
+	eina_lock_release(&thiz->lock);
+	egueb_dom_node_unref(attr);
+}
+/*============================================================================*
+ *                                 Global                                     *
+ *============================================================================*/
+Eguebfs_Cache * eguebfs_cache_new(Egueb_Dom_Node *doc, Eguebfs_Index *index)
+{
+	Eguebfs_Cache *thiz;
+	Egueb_Dom_Event_Target *et;
+	Eguebfs_File f;
+
+	thiz = calloc(1, sizeof(Eguebfs_Cache));
+	eina_lock_new(&thiz->lock);
+	thiz->doc = egueb_dom_node_ref(doc);
+	thiz->index = index;
+	thiz->paths = eina_hash_string_superfast_new(NULL);
+	thiz->nodes = eina_hash_pointer_new(NULL);
+
+	f.type = EGUEBFS_FILE_TYPE_NODE;
+	f.n = egueb_dom_node_ref(doc);
+	thiz->root = _eguebfs_cache_entry_add(thiz, NULL, "/", 1, &f);
+
+	et = EGUEB_DOM_EVENT_TARGET(doc);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_INSERTED,
+			_eguebfs_cache_node_mutation_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_REMOVED,
+			_eguebfs_cache_node_mutation_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_ATTR_MODIFIED,
+			_eguebfs_cache_attr_mutation_cb, EINA_FALSE, thiz);
+
+	return thiz;
+}
+
+void eguebfs_cache_free(Eguebfs_Cache *thiz)
+{
+	Egueb_Dom_Event_Target *et;
+
+	et = EGUEB_DOM_EVENT_TARGET(thiz->doc);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_INSERTED,
+			_eguebfs_cache_node_mutation_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_REMOVED,
+			_eguebfs_cache_node_mutation_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_ATTR_MODIFIED,
+			_eguebfs_cache_attr_mutation_cb, EINA_FALSE, thiz);
+
+	_eguebfs_cache_entry_del(thiz, thiz->root);
+	eina_hash_free(thiz->paths);
+	eina_hash_free(thiz->nodes);
+	egueb_dom_node_unref(thiz->doc);
+	eina_lock_free(&thiz->lock);
+	free(thiz);
+}
+
+/* Drop the entries below a node whose children are going away without any
+ * mutation event
+ */
+void eguebfs_cache_children_drop(Eguebfs_Cache *thiz, Egueb_Dom_Node *n)
+{
+	Eguebfs_Cache_Entry *e;
+
+	eina_lock_take(&thiz->lock);
+	e = eina_hash_find(thiz->nodes, &n);
+	if (e)
+		_eguebfs_cache_entry_children_del(thiz, e);
+	eina_lock_release(&thiz->lock);
+}
+
+/* Same contract as a full walk, on success f->n holds a new reference */
+Eina_Bool eguebfs_cache_find(Eguebfs_Cache *thiz, const char *path,
+		Eguebfs_File *f)
+{
+	Eguebfs_Cache_Entry *e;
+	Eguebfs_Scratch_Mark m;
+	Eina_Bool ret = EINA_TRUE;
+	char *npath;
+	char *p;
+	int len;
+
+	/* the root is also requested as the empty prefix of "/foo" */
+	if (!*path)
+		path = "/";
+	len = strlen(path);
+	/* remove any trailing slash */
+	while (len > 1 && path[len - 1] == '/')
+		len--;
+	eguebfs_scratch_mark(&m);
+	npath = eguebfs_scratch_strndup(path, len);
+
+	eina_lock_take(&thiz->lock);
+	/* keep the cache bounded, start over whenever it is full */
+	if (thiz->count >= EGUEBFS_CACHE_MAX)
+	{
+		DBG("Path cache full, flushing it");
+		_eguebfs_cache_entry_children_del(thiz, thiz->root);
+	}
+
+	/* find the longest cached prefix */
+	p = npath + len;
+	while (!(e = eina_hash_find(thiz->paths, npath)))
+	{
+		char *sep;
+
+		sep = memrchr(npath, '/', p - npath);
+		if (p != npath + len)
+			*p = '/';
+		if (!sep || sep == npath)
+		{
+			/* only the root is left */
+			e = thiz->root;
+			p = npath;
+			break;
+		}
+		p = sep;
+		*p = '\0';
+	}
+	if (p != npath + len)
+		*p = '/';
+	else
+		p = NULL;
+	eguebfs_stats_path_cache(!p);
+
+	/* walk the missing components from there */
+	while (p)
+	{
+		Eguebfs_File tmp;
+		char *component;
+		char *end;
+
+		if (e->f.type != EGUEBFS_FILE_TYPE_NODE)
+		{
+			/* no child files */
+			ret = EINA_FALSE;
+			break;
+		}
+
+		component = p + 1;
+		end = strchr(component, '/');
+		if (end)
+			*end = '\0';
+		/* skip empty components, i.e "//" */
+		if (*component)
+		{
+			tmp.type = e->f.type;
+			tmp.n = egueb_dom_node_ref(e->f.n);
+			if (!eguebfs_file_step(&tmp, thiz->index, component))
+			{
+				egueb_dom_node_unref(tmp.n);
+				ret = EINA_FALSE;
+				break;
+			}
+			e = _eguebfs_cache_entry_add(thiz, e, npath,
+					component + strlen(component) - npath,
+					&tmp);
+		}
+		if (end)
+			*end = '/';
+		p = end;
+	}
+
+	if (ret)
+	{
+		f->type = e->f.type;
+		f->n = egueb_dom_node_ref(e->f.n);
+	}
+	eina_lock_release(&thiz->lock);
+	eguebfs_scratch_release(&m);
+
+	return ret;
+}
@@ -0,0 +1,520 @@
+/* EGUEBFS - FUSE based Egueb filesystem
+ * Copyright (C) 2015 - 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+
+#include "eguebfs_private.h"
+
+#include <errno.h>
+#include <poll.h>
+
+/*
+ * The events file streams the mutations of the document, one line per
+ * event, with a single character for the type of event and the path of the
+ * file that changed:
+ * + /svg/g@2 -> the node has been inserted
+ * - /svg/g@2 -> the node is going to be removed
+ * a /svg/g@1/color -> the attribute has been added, modified or removed
+ * c /svg/text@1/#text@1 -> the character data has been modified
+ *
+ * Every open of the file is a reader with a buffer of its own, a read
+ * waits until there are events and poll() can be used to wait on several
+ * of them. When a reader does not keep up its buffer fills, the events that
+ * do not fit are lost and the line:
+ * ! overflow
+ * takes their place
+ */
+/*============================================================================*
+ *                                  Local                                     *
+ *============================================================================*/
+#define EGUEBFS_EVENTS_SIZE 65536
+#define EGUEBFS_EVENTS_OVERFLOW "! overflow\n"
+
+/* A read waiting for events */
+typedef struct _Eguebfs_Events_Request
+{
+	EINA_INLIST;
+	fuse_req_t req;
+	size_t size;
+} Eguebfs_Events_Request;
+
+struct _Eguebfs_Events_Reader
+{
+	EINA_INLIST;
+	Eguebfs_Events *events;
+	/* the ring of pending events */
+	char *buf;
+	size_t start;
+	size_t length;
+	/* events have been lost since the last one on the buffer */
+	Eina_Bool overflow;
+	Eina_Inlist *requests;
+	struct fuse_pollhandle *ph;
+};
+
+struct _Eguebfs_Events
+{
+	Egueb_Dom_Node *doc;
+	Eguebfs_Index *index;
+	Eina_Lock lock;
+	Eina_Inlist *readers;
+};
+
+static void _eguebfs_events_reader_push(Eguebfs_Events_Reader *r,
+		const char *data, size_t length)
+{
+	size_t end;
+	size_t first;
+
+	end = (r->start + r->length) % EGUEBFS_EVENTS_SIZE;
+	first = EGUEBFS_EVENTS_SIZE - end;
+	if (first > length)
+		first = length;
+	memcpy(r->buf + end, data, first);
+	memcpy(r->buf, data + first, length - first);
+	r->length += length;
+}
+
+static size_t _eguebfs_events_reader_pop(Eguebfs_Events_Reader *r,
+		char *data, size_t length)
+{
+	size_t first;
+
+	if (length > r->length)
+		length = r->length;
+	first = EGUEBFS_EVENTS_SIZE - r->start;
+	if (first > length)
+		first = length;
+	memcpy(data, r->buf + r->start, first);
+	memcpy(data + first, r->buf, length - first);
+	r->start = (r->start + length) % EGUEBFS_EVENTS_SIZE;
+	r->length -= length;
+
+	return length;
+}
+
+static Eina_Bool _eguebfs_events_reader_readable(Eguebfs_Events_Reader *r)
+{
+	return r->length || r->overflow;
+}
+
+/* Must be called with the reader readable */
+static void _eguebfs_events_reader_reply(Eguebfs_Events_Reader *r,
+		fuse_req_t req, size_t size)
+{
+	char *data;
+
+	/* the overflow is only pending here when everything has been read */
+	if (!r->length)
+	{
+		size_t length = strlen(EGUEBFS_EVENTS_OVERFLOW);
+
+		r->overflow = EINA_FALSE;
+		fuse_reply_buf(req, EGUEBFS_EVENTS_OVERFLOW,
+				size < length ? size : length);
+		return;
+	}
+
+	data = malloc(size);
+	size = _eguebfs_events_reader_pop(r, data, size);
+	fuse_reply_buf(req, data, size);
+	free(data);
+}
+
+/* Reply the waiting reads and wake up the waiting polls */
+static void _eguebfs_events_reader_wakeup(Eguebfs_Events_Reader *r)
+{
+	while (r->requests && _eguebfs_events_reader_readable(r))
+	{
+		Eguebfs_Events_Request *rr;
+
+		rr = EINA_INLIST_CONTAINER_GET(r->requests,
+				Eguebfs_Events_Request);
+		r->requests = eina_inlist_remove(r->requests, r->requests);
+		_eguebfs_events_reader_reply(r, rr->req, rr->size);
+		free(rr);
+	}
+	if (r->ph && _eguebfs_events_reader_readable(r))
+	{
+		fuse_lowlevel_notify_poll(r->ph);
+		fuse_pollhandle_destroy(r->ph);
+		r->ph = NULL;
+	}
+}
+
+static void _eguebfs_events_reader_add(Eguebfs_Events_Reader *r,
+		const char *record, size_t length)
+{
+	size_t needed = length;
+
+	if (r->overflow)
+		needed += strlen(EGUEBFS_EVENTS_OVERFLOW);
+	if (r->length + needed > EGUEBFS_EVENTS_SIZE)
+	{
+		r->overflow = EINA_TRUE;
+		return;
+	}
+	if (r->overflow)
+	{
+		_eguebfs_events_reader_push(r, EGUEBFS_EVENTS_OVERFLOW,
+				strlen(EGUEBFS_EVENTS_OVERFLOW));
+		r->overflow = EINA_FALSE;
+	}
+	_eguebfs_events_reader_push(r, record, length);
+}
+
+static void _eguebfs_events_interrupt_cb(fuse_req_t req, void *data)
+{
+	Eguebfs_Events_Reader *r = data;
+	Eguebfs_Events *thiz = r->events;
+	Eguebfs_Events_Request *rr;
+
+	eina_lock_take(&thiz->lock);
+	EINA_INLIST_FOREACH(r->requests, rr)
+	{
+		if (rr->req != req)
+			continue;
+		r->requests = eina_inlist_remove(r->requests,
+				EINA_INLIST_GET(rr));
+		fuse_reply_err(req, EINTR);
+		free(rr);
+		break;
+	}
+	eina_lock_release(&thiz->lock);
+}
+
+/* The position of n among its previous siblings with the same name, for the
+ * elements that are not indexed
+ */
+static int _eguebfs_events_sibling_position(Egueb_Dom_Node *n,
+		const char *name)
+{
+	Egueb_Dom_Node *prev;
+	int ret = 1;
+
+	prev = egueb_dom_node_sibling_previous_get(n);
+	while (prev)
+	{
+		Egueb_Dom_String *prev_name;
+		Egueb_Dom_Node *tmp;
+
+		prev_name = egueb_dom_node_name_get(prev);
+		if (!strcmp(egueb_dom_string_chars_get(prev_name), name))
+			ret++;
+		egueb_dom_string_unref(prev_name);
+		tmp = egueb_dom_node_sibling_previous_get(prev);
+		egueb_dom_node_unref(prev);
+		prev = tmp;
+	}
+	return ret;
+}
+
+/* Append the path of the file of a node, EINA_FALSE if it is not on the
+ * document
+ */
+static Eina_Bool _eguebfs_events_path_append(Eguebfs_Events *thiz,
+		Eina_Strbuf *b, Egueb_Dom_Node *n)
+{
+	Egueb_Dom_Node *parent;
+	Egueb_Dom_String *name;
+	const char *chars;
+	Eina_Bool ret;
+
+	if (n == thiz->doc)
+		return EINA_TRUE;
+	parent = egueb_dom_node_parent_get(n);
+	if (!parent)
+		return EINA_FALSE;
+
+	ret = _eguebfs_events_path_append(thiz, b, parent);
+	if (!ret)
+		goto done;
+
+	name = egueb_dom_node_name_get(n);
+	chars = egueb_dom_string_chars_get(name);
+	/* the topmost element has no repetition */
+	if (parent == thiz->doc)
+	{
+		eina_strbuf_append_printf(b, "/%s", chars);
+	}
+	else
+	{
+		int nth;
+
+		nth = eguebfs_index_child_position(thiz->index, parent, n);
+		if (!nth)
+			nth = _eguebfs_events_sibling_position(n, chars);
+		eina_strbuf_append_printf(b, "/%s@%d", chars, nth);
+	}
+	egueb_dom_string_unref(name);
+done:
+	egueb_dom_node_unref(parent);
+	return ret;
+}
+
+/* The mutation events happen with the document locked */
+static void _eguebfs_events_add(Eguebfs_Events *thiz, char type,
+		Egueb_Dom_Node *n, Egueb_Dom_Node *attr)
+{
+	Eguebfs_Events_Reader *r;
+	Eina_Strbuf *b;
+	Eina_Bool readers;
+
+	/* nothing to format if nobody is listening */
+	eina_lock_take(&thiz->lock);
+	readers = !!thiz->readers;
+	eina_lock_release(&thiz->lock);
+	if (!readers)
+		return;
+
+	b = eina_strbuf_new();
+	eina_strbuf_append_char(b, type);
+	eina_strbuf_append_char(b, ' ');
+	if (!_eguebfs_events_path_append(thiz, b, n))
+		goto done;
+	if (attr)
+	{
+		Egueb_Dom_String *name;
+
+		name = egueb_dom_node_name_get(attr);
+		eina_strbuf_append_printf(b, "/%s",
+				egueb_dom_string_chars_get(name));
+		egueb_dom_string_unref(name);
+	}
+	eina_strbuf_append_char(b, '\n');
+
+	eina_lock_take(&thiz->lock);
+	EINA_INLIST_FOREACH(thiz->readers, r)
+	{
+		_eguebfs_events_reader_add(r, eina_strbuf_string_get(b),
+				eina_strbuf_length_get(b));
+		_eguebfs_events_reader_wakeup(r);
+	}
+	eina_lock_release(&thiz->lock);
+done:
+	eina_strbuf_free(b);
+}
+
+static void _eguebfs_events_node_inserted_cb(Egueb_Dom_Event *ev, void *data)
+{
+	Eguebfs_Events *thiz = data;
+	Egueb_Dom_Node *target;
+
+	target = eguebfs_event_target_node_get(ev);
+	_eguebfs_events_add(thiz, '+', target, NULL);
+	egueb_dom_node_unref(target);
+}
+
+static void _eguebfs_events_node_removed_cb(Egueb_Dom_Event *ev, void *data)
+{
+	Eguebfs_Events *thiz = data;
+	Egueb_Dom_Node *target;
+
+	target = eguebfs_event_target_node_get(ev);
+	_eguebfs_events_add(thiz, '-', target, NULL);
+	egueb_dom_node_unref(target);
+}
+
+static void _eguebfs_events_attr_modified_cb(Egueb_Dom_Event *ev, void *data)
+{
+	Eguebfs_Events *thiz = data;
+	Egueb_Dom_Node *target;
+	Egueb_Dom_Node *attr;
+
+	attr = egueb_dom_event_mutation_related_get(ev);
+	if (!attr)
+		return;
+	target = eguebfs_event_target_node_get(ev);
+	_eguebfs_events_add(thiz, 'a', target, attr);
+	egueb_dom_node_unref(target);
+	egueb_dom_node_unref(attr);
+}
+
+static void _eguebfs_events_character_data_modified_cb(Egueb_Dom_Event *ev,
+		void *data)
+{
+	Eguebfs_Events *thiz = data;
+	Egueb_Dom_Node *target;
+
+	target = eguebfs_event_target_node_get(ev);
+	_eguebfs_events_add(thiz, 'c', target, NULL);
+	egueb_dom_node_unref(target);
+}
+/*============================================================================*
+ *                                 Global                                     *
+ *============================================================================*/
+Eguebfs_Events * eguebfs_events_new(Egueb_Dom_Node *doc, Eguebfs_Index *index)
+{
+	Eguebfs_Events *thiz;
+	Egueb_Dom_Event_Target *et;
+
+	thiz = calloc(1, sizeof(Eguebfs_Events));
+	thiz->doc = egueb_dom_node_ref(doc);
+	thiz->index = index;
+	eina_lock_new(&thiz->lock);
+
+	et = EGUEB_DOM_EVENT_TARGET(doc);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_INSERTED,
+			_eguebfs_events_node_inserted_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_REMOVED,
+			_eguebfs_events_node_removed_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_ATTR_MODIFIED,
+			_eguebfs_events_attr_modified_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_CHARACTER_DATA_MODIFIED,
+			_eguebfs_events_character_data_modified_cb, EINA_FALSE,
+			thiz);
+
+	return thiz;
+}
+
+void eguebfs_events_free(Eguebfs_Events *thiz)
+{
+	Egueb_Dom_Event_Target *et;
+
+	et = EGUEB_DOM_EVENT_TARGET(thiz->doc);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_INSERTED,
+			_eguebfs_events_node_inserted_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_REMOVED,
+			_eguebfs_events_node_removed_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_ATTR_MODIFIED,
+			_eguebfs_events_attr_modified_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_CHARACTER_DATA_MODIFIED,
+			_eguebfs_events_character_data_modified_cb, EINA_FALSE,
+			thiz);
+
+	/* the handles still open are never going to be released */
+	while (thiz->readers)
+	{
+		eguebfs_events_reader_free(thiz, EINA_INLIST_CONTAINER_GET(
+				thiz->readers, Eguebfs_Events_Reader));
+	}
+	egueb_dom_node_unref(thiz->doc);
+	eina_lock_free(&thiz->lock);
+	free(thiz);
+}
+
+Eguebfs_Events_Reader * eguebfs_events_reader_new(Eguebfs_Events *thiz)
+{
+	Eguebfs_Events_Reader *r;
+
+	r = calloc(1, sizeof(Eguebfs_Events_Reader));
+	r->events = thiz;
+	r->buf = malloc(EGUEBFS_EVENTS_SIZE);
+	eina_lock_take(&thiz->lock);
+	thiz->readers = eina_inlist_append(thiz->readers, EINA_INLIST_GET(r));
+	eina_lock_release(&thiz->lock);
+
+	return r;
+}
+
+/* The reads still waiting are interrupted */
+void eguebfs_events_reader_free(Eguebfs_Events *thiz, Eguebfs_Events_Reader *r)
+{
+	eina_lock_take(&thiz->lock);
+	thiz->readers = eina_inlist_remove(thiz->readers, EINA_INLIST_GET(r));
+	while (r->requests)
+	{
+		Eguebfs_Events_Request *rr;
+
+		rr = EINA_INLIST_CONTAINER_GET(r->requests,
+				Eguebfs_Events_Request);
+		r->requests = eina_inlist_remove(r->requests, r->requests);
+		fuse_reply_err(rr->req, EINTR);
+		free(rr);
+	}
+	eina_lock_release(&thiz->lock);
+
+	if (r->ph)
+		fuse_pollhandle_destroy(r->ph);
+	free(r->buf);
+	free(r);
+}
+
+/* Reply the read with the pending events. Without events a non blocking
+ * read fails with EAGAIN and a blocking one is replied once they arrive
+ */
+void eguebfs_events_read(Eguebfs_Events *thiz, Eguebfs_Events_Reader *r,
+		fuse_req_t req, size_t size, Eina_Bool nonblock)
+{
+	/* the request must not be replied before this, if it is already
+	 * interrupted the callback is called right away and does nothing
+	 */
+	fuse_req_interrupt_func(req, _eguebfs_events_interrupt_cb, r);
+	eina_lock_take(&thiz->lock);
+	/* keep the order of the reads already waiting */
+	if (!r->requests && _eguebfs_events_reader_readable(r))
+	{
+		_eguebfs_events_reader_reply(r, req, size);
+	}
+	else if (nonblock)
+	{
+		fuse_reply_err(req, EAGAIN);
+	}
+	else if (fuse_req_interrupted(req))
+	{
+		fuse_reply_err(req, EINTR);
+	}
+	else
+	{
+		Eguebfs_Events_Request *rr;
+
+		rr = calloc(1, sizeof(Eguebfs_Events_Request));
+		rr->req = req;
+		rr->size = size;
+		r->requests = eina_inlist_append(r->requests,
+				EINA_INLIST_GET(rr));
+	}
+	eina_lock_release(&thiz->lock);
+}
+
+/* Reply the poll with the current state, the poll handle, if any, is
+ * notified once there are events
+ */
+void eguebfs_events_poll(Eguebfs_Events *thiz, Eguebfs_Events_Reader *r,
+		fuse_req_t req, struct fuse_pollhandle *ph)
+{
+	unsigned int revents = 0;
+
+	eina_lock_take(&thiz->lock);
+	if (_eguebfs_events_reader_readable(r))
+	{
+		revents = POLLIN | POLLRDNORM;
+		if (ph)
+			fuse_pollhandle_destroy(ph);
+	}
+	else if (ph)
+	{
+		/* only the last poll needs to be notified */
+		if (r->ph)
+			fuse_pollhandle_destroy(r->ph);
+		r->ph = ph;
+	}
+	eina_lock_release(&thiz->lock);
+	fuse_reply_poll(req, revents);
+}
@@ -0,0 +1,912 @@
+/* EGUEBFS - FUSE based Egueb filesystem
+ * Copyright (C) 2015 - 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+
+#include "eguebfs_private.h"
+
+#include <stdio.h>
+#include <sys/stat.h>
+/*
+ * For a XML file like this:
+ * <svg>
+ *   <g color="red">
+ *   </g>
+ *   <g>
+ *   </g>
+ *   <rect/>
+ * </svg>
+ *
+ * The tree should be like:
+ * / -> doc
+ * /svg@0 -> svg at level 0
+ * /svg@0/g@0 -> g at repetition 0
+ * /svg@0/g@0/color/ -> color attribute
+ * /svg@0/g@0/color/base -> color attribute base value
+ * /svg@0/g@0/color/anim -> color attribute anim value
+ * /svg@0/g@0/color/style -> color attribute style value
+ * /svg@0/g@0/color/final -> color attribute final value
+ * /svg@0/g@1 -> g at repetition 1
+ * /svg@0/rect@0 -> g at repetition 0
+ * /svg@0/.xml -> the serialization of svg, every element has it
+ *
+ * Besides the topmost element, the root has the control files:
+ * /.batch -> set several values at once, see eguebfs_batch.c
+ * /.events -> the stream of mutations, see eguebfs_events.c
+ * /.progress -> the bytes of the file parsed, see eguebfs_lazy.c
+ * /.stats -> the counters of the operations done, see eguebfs_stats.c
+ *
+ * When several documents are mounted, the tree above is under a directory
+ * named after each document, i.e /drawing/svg@0, and the root only has the
+ * /.stats file besides them
+ */
+/*============================================================================*
+ *                                  Local                                     *
+ *============================================================================*/
+typedef struct _Eguebfs_File_List_Data
+{
+	Eguebfs_File_Cursor *c;
+	Eguebfs_File_Filler filler;
+	void *data;
+	/* entries left to skip when seeking */
+	off_t skip;
+	Eina_Bool full;
+} Eguebfs_File_List_Data;
+
+/* Add a single entry moving the cursor after it. The file of the entry is
+ * given to the filler so it can be stated on the same listing
+ */
+static Eina_Bool _eguebfs_file_list_add(Eguebfs_File_List_Data *ld,
+		const char *name, Eguebfs_File *f)
+{
+	if (ld->skip)
+	{
+		ld->skip--;
+	}
+	else if (!ld->filler(ld->data, name, f, ld->c->offset + 1))
+	{
+		ld->full = EINA_TRUE;
+		return EINA_FALSE;
+	}
+	ld->c->offset++;
+	return EINA_TRUE;
+}
+
+/* The . and .. entries */
+static Eina_Bool _eguebfs_file_list_dots(Eguebfs_File_List_Data *ld)
+{
+	while (ld->c->offset < 2)
+	{
+		if (!_eguebfs_file_list_add(ld, ld->c->offset ? ".." : ".",
+				NULL))
+			return EINA_FALSE;
+	}
+	return EINA_TRUE;
+}
+
+static Eina_Bool _eguebfs_file_list_children_cb(void *data, const char *name,
+		Eina_Array *children)
+{
+	Eguebfs_File_List_Data *ld = data;
+	Eguebfs_File_Cursor *c = ld->c;
+	Eguebfs_Scratch_Mark m;
+	Eguebfs_File child;
+	Eina_Bool ret = EINA_TRUE;
+	char *final_name;
+	size_t len;
+	int count;
+	int i = 1;
+
+	count = eina_array_count(children);
+	/* resume the group where it was left */
+	if (c->name && !strcmp(c->name, name))
+		i = c->nth;
+	/* skip the whole group at once when seeking */
+	if (ld->skip)
+	{
+		off_t left = count - i + 1;
+
+		if (ld->skip >= left)
+		{
+			ld->skip -= left;
+			c->offset += left;
+			return EINA_TRUE;
+		}
+		i += ld->skip;
+		c->offset += ld->skip;
+		ld->skip = 0;
+	}
+
+	/* the name and room for the @ and any repetition */
+	len = strlen(name);
+	eguebfs_scratch_mark(&m);
+	final_name = eguebfs_scratch_alloc(len + 16);
+	memcpy(final_name, name, len);
+	child.type = EGUEBFS_FILE_TYPE_NODE;
+	for (; i <= count; i++)
+	{
+		snprintf(final_name + len, 16, "@%d", i);
+		child.n = eina_array_data_get(children, i - 1);
+		if (!_eguebfs_file_list_add(ld, final_name, &child))
+		{
+			if (c->name != name && (!c->name || strcmp(c->name, name)))
+			{
+				free(c->name);
+				c->name = strdup(name);
+			}
+			c->nth = i;
+			ret = EINA_FALSE;
+			break;
+		}
+	}
+	eguebfs_scratch_release(&m);
+	return ret;
+}
+
+static void _eguebfs_file_list_children(Eguebfs_File *f, Eguebfs_Index *index,
+		Eguebfs_File_List_Data *ld)
+{
+	Eguebfs_File_Cursor *c = ld->c;
+
+	if (c->children_done)
+		return;
+
+	if (!eguebfs_index_foreach(index, f->n, c->name,
+			_eguebfs_file_list_children_cb, ld))
+	{
+		off_t offset = c->offset;
+
+		/* the group the cursor was on is gone, seek from the start */
+		eguebfs_file_cursor_reset(c);
+		ld->skip = offset;
+		_eguebfs_file_list_dots(ld);
+		eguebfs_index_foreach(index, f->n, NULL,
+				_eguebfs_file_list_children_cb, ld);
+	}
+	if (ld->full)
+		return;
+
+	c->children_done = EINA_TRUE;
+	free(c->name);
+	c->name = NULL;
+}
+/*============================================================================*
+ *                                 Global                                     *
+ *============================================================================*/
+/* Split a name@nth component in place, len is the length of the name */
+Eina_Bool eguebfs_file_name_is_element(const char *p, size_t *len, int *nth)
+{
+	const char *child_depth;
+
+	child_depth = strchr(p, '@');
+	if (!child_depth)
+		return EINA_FALSE;
+
+	*nth = strtoul(child_depth + 1, NULL, 10);
+	*len = child_depth - p;
+	return EINA_TRUE;
+}
+
+Eina_Bool eguebfs_file_delete(Eguebfs_File *f)
+{
+	Egueb_Dom_Node_Type type;
+
+	type = egueb_dom_node_type_get(f->n);
+	switch (type)
+	{
+		case EGUEB_DOM_NODE_TYPE_ELEMENT:
+		{
+			Egueb_Dom_Node *parent;
+			parent = egueb_dom_node_parent_get(f->n);
+			egueb_dom_node_child_remove(parent,
+					egueb_dom_node_ref(f->n), NULL);
+			egueb_dom_node_unref(parent);
+		}
+		break;
+
+		default:
+		return EINA_FALSE;
+	}
+	return EINA_TRUE;
+}
+
+/* Move the file one path component down. On success the reference of the
+ * previous node is dropped and f->n holds the new one, on failure f is
+ * left untouched
+ */
+Eina_Bool eguebfs_file_step(Eguebfs_File *f, Eguebfs_Index *index,
+		const char *p)
+{
+	Egueb_Dom_Node_Type type;
+
+	eguebfs_stats_step();
+	type = egueb_dom_node_type_get(f->n);
+	switch (type)
+	{
+		/* only topmost element */
+		case EGUEB_DOM_NODE_TYPE_DOCUMENT:
+		{
+			Egueb_Dom_Node *topmost;
+			Egueb_Dom_String *name;
+			Eina_Bool found;
+
+			if (!strcmp(p, EGUEBFS_FILE_BATCH))
+			{
+				f->type = EGUEBFS_FILE_TYPE_BATCH;
+				break;
+			}
+			if (!strcmp(p, EGUEBFS_FILE_EVENTS))
+			{
+				f->type = EGUEBFS_FILE_TYPE_EVENTS;
+				break;
+			}
+			if (!strcmp(p, EGUEBFS_FILE_PROGRESS))
+			{
+				f->type = EGUEBFS_FILE_TYPE_PROGRESS;
+				break;
+			}
+			if (!strcmp(p, EGUEBFS_FILE_STATS))
+			{
+				f->type = EGUEBFS_FILE_TYPE_STATS;
+				break;
+			}
+
+			topmost = egueb_dom_document_document_element_get(f->n);
+			if (!topmost)
+			{
+				return EINA_FALSE;
+			}
+			name = egueb_dom_node_name_get(topmost);
+			found = !strcmp(egueb_dom_string_chars_get(name), p);
+			egueb_dom_string_unref(name);
+			if (found)
+			{
+				egueb_dom_node_unref(f->n);
+				f->n = topmost;
+			}
+			else
+			{
+				egueb_dom_node_unref(topmost);
+				return EINA_FALSE;
+			}
+		}
+		break;
+
+		/* only attributes or child nodes. Nothing is allocated to find
+		 * them, the name of a child is terminated on the scratch and the
+		 * name of an attribute is kept by the thread
+		 */
+		case EGUEB_DOM_NODE_TYPE_ELEMENT:
+		{
+			size_t len;
+			int depth;
+
+			if (!strcmp(p, EGUEBFS_FILE_XML))
+			{
+				f->type = EGUEBFS_FILE_TYPE_XML;
+			}
+			else if (eguebfs_file_name_is_element(p, &len, &depth))
+			{
+				Egueb_Dom_Node *found;
+				Eguebfs_Scratch_Mark m;
+
+				eguebfs_scratch_mark(&m);
+				found = eguebfs_index_child_get(index, f->n,
+						eguebfs_scratch_strndup(p, len),
+						depth);
+				eguebfs_scratch_release(&m);
+				if (!found)
+					return EINA_FALSE;
+				egueb_dom_node_unref(f->n);
+				f->n = found;
+			}
+			else
+			{
+				Egueb_Dom_Node *attr;
+
+				/* check if it is an attribute */
+				attr = egueb_dom_element_attribute_node_get(f->n,
+						eguebfs_scratch_name_get(p));
+				if (!attr)
+				{
+					return EINA_FALSE;
+				}
+				egueb_dom_node_unref(f->n);
+				f->n = attr;
+			}
+		}
+		break;
+
+		/* only final, base, anim, styled */
+		case EGUEB_DOM_NODE_TYPE_ATTRIBUTE:
+		if (!strcmp(p, "base"))
+			f->type = EGUEBFS_FILE_TYPE_ATTR_BASE;
+		else if (!strcmp(p, "anim") && egueb_dom_attr_is_animatable(f->n))
+			f->type = EGUEBFS_FILE_TYPE_ATTR_ANIM;
+		else if (!strcmp(p, "styled") && egueb_dom_attr_is_stylable(f->n))
+			f->type = EGUEBFS_FILE_TYPE_ATTR_STYLED;
+		else if (!strcmp(p, "final"))
+			f->type = EGUEBFS_FILE_TYPE_ATTR_FINAL;
+		else
+			return EINA_FALSE;
+		break;
+
+		default:
+		return EINA_FALSE;
+		break;
+
+	}
+	return EINA_TRUE;
+}
+
+/* List the files of a directory starting at offset. The cursor keeps the
+ * position of the last listing, so continuing from where it was left does not
+ * need to go over the previous entries again. Every entry comes with its
+ * file, so there is no need to step into it to know what it is
+ */
+void eguebfs_file_list(Eguebfs_File *f, Eguebfs_Index *index,
+		Eguebfs_File_Cursor *c, off_t offset, Eguebfs_File_Filler filler,
+		void *data)
+{
+	Eguebfs_File_List_Data ld;
+	Egueb_Dom_Node_Type type;
+	Eguebfs_File entry;
+
+	ld.c = c;
+	ld.filler = filler;
+	ld.data = data;
+	ld.skip = 0;
+	ld.full = EINA_FALSE;
+	if (offset != c->offset)
+	{
+		eguebfs_file_cursor_reset(c);
+		ld.skip = offset;
+	}
+
+	/* default files */
+	if (!_eguebfs_file_list_dots(&ld))
+		return;
+
+	type = egueb_dom_node_type_get(f->n);
+	switch (type)
+	{
+		case EGUEB_DOM_NODE_TYPE_DOCUMENT:
+		{
+			const char *names[] = { EGUEBFS_FILE_BATCH,
+					EGUEBFS_FILE_EVENTS, EGUEBFS_FILE_PROGRESS,
+					EGUEBFS_FILE_STATS };
+			Eguebfs_File_Type types[] = { EGUEBFS_FILE_TYPE_BATCH,
+					EGUEBFS_FILE_TYPE_EVENTS,
+					EGUEBFS_FILE_TYPE_PROGRESS,
+					EGUEBFS_FILE_TYPE_STATS };
+			int length = sizeof(names) / sizeof(const char *);
+
+			if (!c->extra)
+			{
+				Egueb_Dom_Node *topmost;
+
+				topmost = egueb_dom_document_document_element_get(f->n);
+				if (topmost)
+				{
+					Egueb_Dom_String *name;
+					Eina_Bool added;
+
+					name = egueb_dom_node_name_get(topmost);
+					entry.type = EGUEBFS_FILE_TYPE_NODE;
+					entry.n = topmost;
+					added = _eguebfs_file_list_add(&ld,
+							egueb_dom_string_chars_get(name),
+							&entry);
+					egueb_dom_string_unref(name);
+					egueb_dom_node_unref(topmost);
+					if (!added)
+						break;
+				}
+				c->extra++;
+			}
+			/* the control files */
+			entry.n = f->n;
+			while (c->extra <= length)
+			{
+				entry.type = types[c->extra - 1];
+				if (!_eguebfs_file_list_add(&ld, names[c->extra - 1],
+						&entry))
+					break;
+				c->extra++;
+			}
+		}
+		break;
+
+		case EGUEB_DOM_NODE_TYPE_ELEMENT:
+		{
+			Egueb_Dom_Node_Map_Named *attrs;
+			int length;
+
+			/* add every children */
+			_eguebfs_file_list_children(f, index, &ld);
+			if (ld.full)
+				break;
+			/* add every attribute */
+			attrs = egueb_dom_node_attributes_get(f->n);
+			length = egueb_dom_node_map_named_length(attrs);
+			while (c->extra < length)
+			{
+				Egueb_Dom_Node *attr;
+				Egueb_Dom_String *name;
+				Eina_Bool added;
+
+				attr = egueb_dom_node_map_named_at(attrs, c->extra);
+				name = egueb_dom_node_name_get(attr);
+				entry.type = EGUEBFS_FILE_TYPE_NODE;
+				entry.n = attr;
+				added = _eguebfs_file_list_add(&ld,
+						egueb_dom_string_chars_get(name),
+						&entry);
+				egueb_dom_string_unref(name);
+				egueb_dom_node_unref(attr);
+				if (!added)
+					break;
+				c->extra++;
+			}
+			egueb_dom_node_map_named_unref(attrs);
+			/* the serialization after the attributes */
+			if (c->extra == length)
+			{
+				entry.type = EGUEBFS_FILE_TYPE_XML;
+				entry.n = f->n;
+				if (_eguebfs_file_list_add(&ld, EGUEBFS_FILE_XML,
+						&entry))
+					c->extra++;
+			}
+		}
+		break;
+
+		case EGUEB_DOM_NODE_TYPE_ATTRIBUTE:
+		{
+			const char *names[4];
+			Eguebfs_File_Type types[4];
+			int length = 0;
+
+			names[length] = "base";
+			types[length++] = EGUEBFS_FILE_TYPE_ATTR_BASE;
+			names[length] = "final";
+			types[length++] = EGUEBFS_FILE_TYPE_ATTR_FINAL;
+			if (egueb_dom_attr_is_stylable(f->n))
+			{
+				names[length] = "styled";
+				types[length++] = EGUEBFS_FILE_TYPE_ATTR_STYLED;
+			}
+			if (egueb_dom_attr_is_animatable(f->n))
+			{
+				names[length] = "anim";
+				types[length++] = EGUEBFS_FILE_TYPE_ATTR_ANIM;
+			}
+			entry.n = f->n;
+			while (c->extra < length)
+			{
+				entry.type = types[c->extra];
+				if (!_eguebfs_file_list_add(&ld, names[c->extra],
+						&entry))
+					break;
+				c->extra++;
+			}
+		}
+		break;
+
+		default:
+		break;
+	}
+}
+
+void eguebfs_file_cursor_reset(Eguebfs_File_Cursor *c)
+{
+	free(c->name);
+	memset(c, 0, sizeof(Eguebfs_File_Cursor));
+}
+
+/* Fill the stat information for a file. Only the type, permissions and size
+ * are set, the rest of the fields are left untouched. The size of the
+ * attribute files is not set
+ */
+Eina_Bool eguebfs_file_stat(Eguebfs_File *f, struct stat *st)
+{
+	switch (f->type)
+	{
+		case EGUEBFS_FILE_TYPE_NODE:
+		{
+			Egueb_Dom_Node_Type type;
+			type = egueb_dom_node_type_get(f->n);
+			switch (type)
+			{
+				case EGUEB_DOM_NODE_TYPE_DOCUMENT:
+				case EGUEB_DOM_NODE_TYPE_ELEMENT:
+				case EGUEB_DOM_NODE_TYPE_ATTRIBUTE:
+				st->st_mode = S_IFDIR | 0755;
+				st->st_nlink = 2;
+				break;
+
+				case EGUEB_DOM_NODE_TYPE_TEXT:
+				case EGUEB_DOM_NODE_TYPE_CDATA_SECTION:
+				st->st_mode = S_IFREG | 0644;
+				st->st_nlink = 1;
+				st->st_size = egueb_dom_character_data_length_get(f->n);
+				break;
+
+				default:
+				ERR("Unsupported node type '%d'", type);
+				return EINA_FALSE;
+			}
+		}
+		break;
+
+		/* the size is the length of the value, see eguebfs_file_length_get() */
+		case EGUEBFS_FILE_TYPE_ATTR_BASE:
+		case EGUEBFS_FILE_TYPE_ATTR_ANIM:
+		case EGUEBFS_FILE_TYPE_ATTR_STYLED:
+		case EGUEBFS_FILE_TYPE_ATTR_FINAL:
+		if (f->type == EGUEBFS_FILE_TYPE_ATTR_FINAL)
+			st->st_mode = S_IFREG | 0444;
+		else
+			st->st_mode = S_IFREG | 0644;
+		st->st_nlink = 1;
+		break;
+
+		case EGUEBFS_FILE_TYPE_BATCH:
+		st->st_mode = S_IFREG | 0600;
+		st->st_nlink = 1;
+		break;
+
+		/* documents are only added through the API */
+		case EGUEBFS_FILE_TYPE_DOCUMENTS:
+		st->st_mode = S_IFDIR | 0555;
+		st->st_nlink = 2;
+		break;
+
+		/* the size of the serialization is not set either */
+		case EGUEBFS_FILE_TYPE_EVENTS:
+		case EGUEBFS_FILE_TYPE_PROGRESS:
+		case EGUEBFS_FILE_TYPE_STATS:
+		case EGUEBFS_FILE_TYPE_XML:
+		st->st_mode = S_IFREG | 0444;
+		st->st_nlink = 1;
+		break;
+	}
+	return EINA_TRUE;
+}
+
+/* The length of the value of an attribute file. The value needs to be
+ * converted to a string, so this is expensive
+ */
+off_t eguebfs_file_length_get(Eguebfs_File *f)
+{
+	Egueb_Dom_String *value;
+	off_t length = 0;
+
+	value = eguebfs_file_value_get(f);
+	if (value)
+	{
+		length = strlen(egueb_dom_string_chars_get(value));
+		egueb_dom_string_unref(value);
+	}
+	return length;
+}
+
+/* Get the content of a regular file, NULL if there is none */
+Egueb_Dom_String * eguebfs_file_value_get(Eguebfs_File *f)
+{
+	Egueb_Dom_String *value = NULL;
+	Eina_Bool fetched = EINA_FALSE;
+
+	switch (f->type)
+	{
+		case EGUEBFS_FILE_TYPE_NODE:
+		{
+			Egueb_Dom_Node_Type type;
+			type = egueb_dom_node_type_get(f->n);
+			switch (type)
+			{
+				case EGUEB_DOM_NODE_TYPE_TEXT:
+				case EGUEB_DOM_NODE_TYPE_CDATA_SECTION:
+				value = egueb_dom_character_data_data_get(f->n);
+				fetched = EINA_TRUE;
+				break;
+
+				default:
+				ERR("Unsupported node type '%d'", type);
+				break;
+			}
+		}
+		break;
+
+		case EGUEBFS_FILE_TYPE_ATTR_BASE:
+		fetched = egueb_dom_attr_string_get(f->n, EGUEB_DOM_ATTR_TYPE_BASE, &value);
+		break;
+
+		case EGUEBFS_FILE_TYPE_ATTR_ANIM:
+		fetched = egueb_dom_attr_string_get(f->n, EGUEB_DOM_ATTR_TYPE_ANIMATED, &value);
+		break;
+
+		case EGUEBFS_FILE_TYPE_ATTR_STYLED:
+		fetched = egueb_dom_attr_string_get(f->n, EGUEB_DOM_ATTR_TYPE_STYLED, &value);
+		break;
+
+		case EGUEBFS_FILE_TYPE_ATTR_FINAL:
+		fetched = egueb_dom_attr_final_string_get(f->n, &value);
+		break;
+
+		/* the content of the control files is on the handle */
+		case EGUEBFS_FILE_TYPE_BATCH:
+		case EGUEBFS_FILE_TYPE_EVENTS:
+		case EGUEBFS_FILE_TYPE_PROGRESS:
+		case EGUEBFS_FILE_TYPE_STATS:
+		case EGUEBFS_FILE_TYPE_XML:
+		case EGUEBFS_FILE_TYPE_DOCUMENTS:
+		break;
+	}
+
+	if (!fetched)
+		return NULL;
+	if (!egueb_dom_string_is_valid(value))
+	{
+		egueb_dom_string_unref(value);
+		return NULL;
+	}
+	return value;
+}
+
+Eina_Bool eguebfs_file_value_set(Eguebfs_File *f, const char *buf, size_t size)
+{
+	Egueb_Dom_String *value = NULL;
+	Eina_Bool written = EINA_FALSE;
+
+	switch (f->type)
+	{
+		case EGUEBFS_FILE_TYPE_NODE:
+		{
+			Egueb_Dom_Node_Type type;
+			type = egueb_dom_node_type_get(f->n);
+			switch (type)
+			{
+				case EGUEB_DOM_NODE_TYPE_TEXT:
+				case EGUEB_DOM_NODE_TYPE_CDATA_SECTION:
+				value = egueb_dom_string_new_with_length(buf, size);
+				egueb_dom_character_data_data_delete(f->n, 0, -1, NULL);
+				egueb_dom_character_data_data_append(f->n, value, NULL);
+				egueb_dom_string_unref(value);
+				written = EINA_TRUE;
+				break;
+
+				default:
+				ERR("Unsupported node type '%d'", type);
+				break;
+			}
+		}
+		break;
+
+		case EGUEBFS_FILE_TYPE_ATTR_FINAL:
+		case EGUEBFS_FILE_TYPE_BATCH:
+		case EGUEBFS_FILE_TYPE_EVENTS:
+		case EGUEBFS_FILE_TYPE_PROGRESS:
+		case EGUEBFS_FILE_TYPE_STATS:
+		case EGUEBFS_FILE_TYPE_XML:
+		case EGUEBFS_FILE_TYPE_DOCUMENTS:
+		break;
+
+		case EGUEBFS_FILE_TYPE_ATTR_BASE:
+		value = egueb_dom_string_new_with_length(buf, size);
+		written = egueb_dom_attr_string_set(f->n, EGUEB_DOM_ATTR_TYPE_BASE, value);
+		egueb_dom_string_unref(value);
+		break;
+
+		case EGUEBFS_FILE_TYPE_ATTR_ANIM:
+		value = egueb_dom_string_new_with_length(buf, size);
+		written = egueb_dom_attr_string_set(f->n, EGUEB_DOM_ATTR_TYPE_ANIMATED, value);
+		egueb_dom_string_unref(value);
+		break;
+
+		case EGUEBFS_FILE_TYPE_ATTR_STYLED:
+		value = egueb_dom_string_new_with_length(buf, size);
+		written = egueb_dom_attr_string_set(f->n, EGUEB_DOM_ATTR_TYPE_STYLED, value);
+		egueb_dom_string_unref(value);
+		break;
+	}
+	return written;
+}
+
+/* Remove the value of an attribute file, as it was before being set. The
+ * character data always has a value
+ */
+Eina_Bool eguebfs_file_value_unset(Eguebfs_File *f)
+{
+	Eina_Bool ret = EINA_FALSE;
+
+	switch (f->type)
+	{
+		case EGUEBFS_FILE_TYPE_ATTR_BASE:
+		ret = egueb_dom_attr_string_set(f->n, EGUEB_DOM_ATTR_TYPE_BASE, NULL);
+		break;
+
+		case EGUEBFS_FILE_TYPE_ATTR_ANIM:
+		ret = egueb_dom_attr_string_set(f->n, EGUEB_DOM_ATTR_TYPE_ANIMATED, NULL);
+		break;
+
+		case EGUEBFS_FILE_TYPE_ATTR_STYLED:
+		ret = egueb_dom_attr_string_set(f->n, EGUEB_DOM_ATTR_TYPE_STYLED, NULL);
+		break;
+
+		default:
+		break;
+	}
+	return ret;
+}
+
+/* Replace count bytes of the character data at offset with buf, only that
+ * range of the data is modified. A negative offset appends buf. Other files
+ * can only be set as a whole
+ */
+Eina_Bool eguebfs_file_range_set(Eguebfs_File *f, off_t offset, size_t count,
+		const char *buf, size_t size)
+{
+	Egueb_Dom_Node_Type type;
+	Egueb_Dom_String *value = NULL;
+	Eina_Bool ret = EINA_TRUE;
+
+	if (f->type != EGUEBFS_FILE_TYPE_NODE)
+		return EINA_FALSE;
+	type = egueb_dom_node_type_get(f->n);
+	if (type != EGUEB_DOM_NODE_TYPE_TEXT &&
+			type != EGUEB_DOM_NODE_TYPE_CDATA_SECTION)
+		return EINA_FALSE;
+
+	if (size)
+		value = egueb_dom_string_new_with_length(buf, size);
+	if (offset < 0)
+	{
+		if (value)
+			ret = egueb_dom_character_data_data_append(f->n, value,
+					NULL);
+	}
+	else if (!value)
+	{
+		if (count)
+			ret = egueb_dom_character_data_data_delete(f->n, offset,
+					count, NULL);
+	}
+	else if (!count)
+	{
+		ret = egueb_dom_character_data_data_insert(f->n, offset, value,
+				NULL);
+	}
+	else
+	{
+		ret = egueb_dom_character_data_data_replace(f->n, offset, count,
+				value, NULL);
+	}
+	if (value)
+		egueb_dom_string_unref(value);
+
+	return ret;
+}
+
+Eina_Bool eguebfs_file_truncate(Eguebfs_File *f, off_t new_length)
+{
+	Eina_Bool ret = EINA_FALSE;
+
+	switch (f->type)
+	{
+		case EGUEBFS_FILE_TYPE_NODE:
+		{
+			Egueb_Dom_Node_Type type;
+
+			type = egueb_dom_node_type_get(f->n);
+			switch (type)
+			{
+				case EGUEB_DOM_NODE_TYPE_TEXT:
+				case EGUEB_DOM_NODE_TYPE_CDATA_SECTION:
+				{
+					int length;
+
+					length = egueb_dom_character_data_length_get(f->n);
+					ret = EINA_TRUE;
+					/* cut the tail */
+					if (new_length < length)
+					{
+						egueb_dom_character_data_data_delete(f->n, new_length, length - new_length, NULL);
+					}
+				}
+				break;
+
+				default:
+				ERR("Unsupported node type '%d'", type);
+				break;
+			}
+
+		}
+		break;
+
+		case EGUEBFS_FILE_TYPE_ATTR_BASE:
+		case EGUEBFS_FILE_TYPE_ATTR_ANIM:
+		case EGUEBFS_FILE_TYPE_ATTR_STYLED:
+		ret = EINA_TRUE;
+		break;
+
+		default:
+		break;
+	}
+	return ret;
+}
+
+/* Create a new element named as the file name p, i.e "g@3". The index must
+ * be the next one available for that name
+ */
+Egueb_Dom_Node * eguebfs_file_child_create(Eguebfs_File *f,
+		Eguebfs_Index *index, const char *p)
+{
+	Egueb_Dom_Node *child;
+	Egueb_Dom_Node *doc;
+	Egueb_Dom_Node *ret = NULL;
+	Eguebfs_Scratch_Mark m;
+	char *real_name;
+	size_t len;
+	int depth;
+	int count;
+
+	if (f->type != EGUEBFS_FILE_TYPE_NODE)
+		return NULL;
+
+	if (egueb_dom_node_type_get(f->n) != EGUEB_DOM_NODE_TYPE_ELEMENT)
+		return NULL;
+
+	if (!eguebfs_file_name_is_element(p, &len, &depth))
+		return NULL;
+
+	eguebfs_scratch_mark(&m);
+	real_name = eguebfs_scratch_strndup(p, len);
+
+	/* make sure that the child is valid */
+	count = eguebfs_index_child_count(index, f->n, real_name);
+	if (depth == count + 1)
+	{
+		Egueb_Dom_String *name;
+
+		doc = egueb_dom_node_owner_document_get(f->n);
+		name = egueb_dom_string_new_with_chars(real_name);
+		child = egueb_dom_document_element_create(doc, name, NULL);
+		if (child)
+		{
+			if (egueb_dom_node_child_append(f->n,
+					egueb_dom_node_ref(child), NULL))
+				ret = child;
+			else
+				egueb_dom_node_unref(child);
+		}
+		egueb_dom_string_unref(name);
+		egueb_dom_node_unref(doc);
+	}
+	eguebfs_scratch_release(&m);
+
+	return ret;
+}
+
+Egueb_Dom_Node * eguebfs_event_target_node_get(Egueb_Dom_Event *e)
+{
+	return EGUEB_DOM_NODE(egueb_dom_event_target_get(e));
+}
@@ -0,0 +1,527 @@
+/* EGUEBFS - FUSE based Egueb filesystem
+ * Copyright (C) 2015 - 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+
+#include "eguebfs_private.h"
+
+/*
+ * The child index of an element groups its children by name, keeping the
+ * document order inside every group. That is what the name@N files are,
+ * so finding, counting or listing them does not need to walk the children.
+ * The index of an element is built the first time it is needed and is kept
+ * up to date with the insertion and removal events of the document. On a
+ * lazy document the children of an element are created right before its
+ * index is built.
+ */
+/*============================================================================*
+ *                                  Local                                     *
+ *============================================================================*/
+typedef struct _Eguebfs_Index_Name
+{
+	EINA_INLIST;
+	char *name;
+	Eina_Array *children;
+} Eguebfs_Index_Name;
+
+typedef struct _Eguebfs_Index_Element
+{
+	Egueb_Dom_Node *n;
+	/* name -> Eguebfs_Index_Name */
+	Eina_Hash *names;
+	/* the names in order of appearance */
+	Eina_Inlist *order;
+} Eguebfs_Index_Element;
+
+struct _Eguebfs_Index
+{
+	Eina_Lock lock;
+	Egueb_Dom_Node *doc;
+	Eguebfs_Lazy *lazy;
+	/* node -> Eguebfs_Index_Element */
+	Eina_Hash *elements;
+	Eguebfs_Index_Changed changed;
+	void *data;
+};
+
+static Eguebfs_Index_Name * _eguebfs_index_name_get(Eguebfs_Index_Element *ie,
+		const char *name)
+{
+	Eguebfs_Index_Name *in;
+
+	in = eina_hash_find(ie->names, name);
+	if (in)
+		return in;
+
+	in = calloc(1, sizeof(Eguebfs_Index_Name));
+	in->name = strdup(name);
+	in->children = eina_array_new(16);
+	eina_hash_direct_add(ie->names, in->name, in);
+	ie->order = eina_inlist_append(ie->order, EINA_INLIST_GET(in));
+
+	return in;
+}
+
+static int _eguebfs_index_name_position(Eguebfs_Index_Name *in,
+		Egueb_Dom_Node *child)
+{
+	unsigned int i;
+
+	/* children are usually removed from the end */
+	for (i = eina_array_count(in->children); i > 0; i--)
+	{
+		if (eina_array_data_get(in->children, i - 1) == child)
+			return i - 1;
+	}
+	return -1;
+}
+
+/* Every child from position on is going to get a different repetition */
+static void _eguebfs_index_name_changed(Eguebfs_Index *thiz,
+		Eguebfs_Index_Element *ie, Eguebfs_Index_Name *in, int position)
+{
+	unsigned int i;
+
+	if (!thiz->changed)
+		return;
+	for (i = position; i < eina_array_count(in->children); i++)
+		thiz->changed(thiz->data, ie->n, in->name, i + 1,
+				eina_array_data_get(in->children, i));
+}
+
+static void _eguebfs_index_name_insert(Eguebfs_Index_Name *in,
+		Egueb_Dom_Node *child, int position)
+{
+	int i;
+
+	eina_array_push(in->children, child);
+	for (i = eina_array_count(in->children) - 1; i > position; i--)
+	{
+		eina_array_data_set(in->children, i,
+				eina_array_data_get(in->children, i - 1));
+	}
+	eina_array_data_set(in->children, position, child);
+}
+
+static void _eguebfs_index_name_remove(Eguebfs_Index_Name *in,
+		int position)
+{
+	unsigned int i;
+
+	for (i = position; i < eina_array_count(in->children) - 1; i++)
+	{
+		eina_array_data_set(in->children, i,
+				eina_array_data_get(in->children, i + 1));
+	}
+	eina_array_pop(in->children);
+}
+
+static void _eguebfs_index_name_free(void *data)
+{
+	Eguebfs_Index_Name *in = data;
+	Egueb_Dom_Node *child;
+
+	while ((child = eina_array_pop(in->children)))
+		egueb_dom_node_unref(child);
+	eina_array_free(in->children);
+	free(in->name);
+	free(in);
+}
+
+/* The children of a lazy element are created first, that is why every
+ * function that builds the index of an element must be called with the
+ * document locked
+ */
+static Eguebfs_Index_Element * _eguebfs_index_element_build(
+		Eguebfs_Index *thiz, Egueb_Dom_Node *n)
+{
+	Eguebfs_Index_Element *ie;
+	Egueb_Dom_Node *child;
+
+	if (thiz->lazy)
+		eguebfs_lazy_materialize(thiz->lazy, n);
+
+	ie = calloc(1, sizeof(Eguebfs_Index_Element));
+	ie->n = egueb_dom_node_ref(n);
+	ie->names = eina_hash_string_superfast_new(_eguebfs_index_name_free);
+
+	child = egueb_dom_node_child_first_get(n);
+	while (child)
+	{
+		Eguebfs_Index_Name *in;
+		Egueb_Dom_String *name;
+
+		name = egueb_dom_node_name_get(child);
+		in = _eguebfs_index_name_get(ie, egueb_dom_string_chars_get(name));
+		egueb_dom_string_unref(name);
+		/* the index keeps the reference */
+		eina_array_push(in->children, child);
+		child = egueb_dom_node_sibling_next_get(child);
+	}
+	eina_hash_add(thiz->elements, &ie->n, ie);
+
+	return ie;
+}
+
+static Eguebfs_Index_Element * _eguebfs_index_element_get(
+		Eguebfs_Index *thiz, Egueb_Dom_Node *n)
+{
+	Eguebfs_Index_Element *ie;
+
+	ie = eina_hash_find(thiz->elements, &n);
+	if (!ie)
+		ie = _eguebfs_index_element_build(thiz, n);
+	return ie;
+}
+
+/* Drop the index of an element and of every indexed descendant */
+static void _eguebfs_index_element_drop(Eguebfs_Index *thiz,
+		Egueb_Dom_Node *n)
+{
+	Eguebfs_Index_Element *ie;
+	Eguebfs_Index_Name *in;
+
+	ie = eina_hash_find(thiz->elements, &n);
+	if (!ie)
+		return;
+
+	EINA_INLIST_FOREACH(ie->order, in)
+	{
+		unsigned int i;
+
+		for (i = 0; i < eina_array_count(in->children); i++)
+			_eguebfs_index_element_drop(thiz,
+					eina_array_data_get(in->children, i));
+	}
+	eina_hash_del(thiz->elements, &n, ie);
+}
+
+static void _eguebfs_index_element_free_cb(void *data)
+{
+	Eguebfs_Index_Element *ie = data;
+
+	eina_hash_free(ie->names);
+	egueb_dom_node_unref(ie->n);
+	free(ie);
+}
+
+/* The position of the next sibling of child named as chars, -1 if there is
+ * none
+ */
+static int _eguebfs_index_name_next_position(Eguebfs_Index_Name *in,
+		Egueb_Dom_Node *child, const char *chars)
+{
+	Egueb_Dom_Node *next;
+	int position = -1;
+
+	next = egueb_dom_node_sibling_next_get(child);
+	while (next)
+	{
+		Egueb_Dom_String *next_name;
+		Egueb_Dom_Node *tmp;
+		Eina_Bool same;
+
+		next_name = egueb_dom_node_name_get(next);
+		same = !strcmp(egueb_dom_string_chars_get(next_name), chars);
+		egueb_dom_string_unref(next_name);
+		if (same)
+		{
+			position = _eguebfs_index_name_position(in, next);
+			egueb_dom_node_unref(next);
+			break;
+		}
+		tmp = egueb_dom_node_sibling_next_get(next);
+		egueb_dom_node_unref(next);
+		next = tmp;
+	}
+	return position;
+}
+
+static void _eguebfs_index_inserted(Eguebfs_Index *thiz,
+		Eguebfs_Index_Element *ie,  Egueb_Dom_Node *child)
+{
+	Eguebfs_Index_Name *in;
+	Egueb_Dom_String *name;
+	const char *chars;
+	int position;
+
+	name = egueb_dom_node_name_get(child);
+	chars = egueb_dom_string_chars_get(name);
+	in = _eguebfs_index_name_get(ie, chars);
+	position = _eguebfs_index_name_next_position(in, child, chars);
+	egueb_dom_string_unref(name);
+
+	if (position < 0)
+	{
+		eina_array_push(in->children, egueb_dom_node_ref(child));
+	}
+	else
+	{
+		_eguebfs_index_name_changed(thiz, ie, in, position);
+		_eguebfs_index_name_insert(in, egueb_dom_node_ref(child),
+				position);
+	}
+}
+
+static void _eguebfs_index_removed(Eguebfs_Index *thiz,
+		Eguebfs_Index_Element *ie,  Egueb_Dom_Node *child)
+{
+	Eguebfs_Index_Name *in;
+	Egueb_Dom_String *name;
+	int position;
+
+	name = egueb_dom_node_name_get(child);
+	in = eina_hash_find(ie->names, egueb_dom_string_chars_get(name));
+	egueb_dom_string_unref(name);
+	if (!in)
+		return;
+
+	position = _eguebfs_index_name_position(in, child);
+	if (position < 0)
+		return;
+	_eguebfs_index_name_changed(thiz, ie, in, position);
+	_eguebfs_index_name_remove(in, position);
+	egueb_dom_node_unref(child);
+}
+
+static void _eguebfs_index_node_inserted_cb(Egueb_Dom_Event *ev, void *data)
+{
+	Eguebfs_Index *thiz = data;
+	Eguebfs_Index_Element *ie;
+	Egueb_Dom_Node *target;
+	Egueb_Dom_Node *parent;
+
+	parent = egueb_dom_event_mutation_related_get(ev);
+	if (!parent)
+		return;
+
+	target = eguebfs_event_target_node_get(ev);
+	eina_lock_take(&thiz->lock);
+	ie = eina_hash_find(thiz->elements, &parent);
+	if (ie)
+		_eguebfs_index_inserted(thiz, ie, target);
+	eina_lock_release(&thiz->lock);
+	egueb_dom_node_unref(target);
+	egueb_dom_node_unref(parent);
+}
+
+static void _eguebfs_index_node_removed_cb(Egueb_Dom_Event *ev, void *data)
+{
+	Eguebfs_Index *thiz = data;
+	Eguebfs_Index_Element *ie;
+	Egueb_Dom_Node *target;
+	Egueb_Dom_Node *parent;
+
+	parent = egueb_dom_event_mutation_related_get(ev);
+	if (!parent)
+		return;
+
+	target = eguebfs_event_target_node_get(ev);
+	eina_lock_take(&thiz->lock);
+	ie = eina_hash_find(thiz->elements, &parent);
+	if (ie)
+		_eguebfs_index_removed(thiz, ie, target);
+	/* the removed subtree is no longer reachable */
+	_eguebfs_index_element_drop(thiz, target);
+	eina_lock_release(&thiz->lock);
+	egueb_dom_node_unref(target);
+	egueb_dom_node_unref(parent);
+}
+/*============================================================================*
+ *                                 Global                                     *
+ *============================================================================*/
+/* The changed callback is called with the index locked, so it must not
+ * use it
+ */
+Eguebfs_Index * eguebfs_index_new(Egueb_Dom_Node *doc, Eguebfs_Lazy *lazy,
+		Eguebfs_Index_Changed changed, void *data)
+{
+	Eguebfs_Index *thiz;
+	Egueb_Dom_Event_Target *et;
+
+	thiz = calloc(1, sizeof(Eguebfs_Index));
+	eina_lock_new(&thiz->lock);
+	thiz->doc = egueb_dom_node_ref(doc);
+	thiz->lazy = lazy;
+	thiz->elements = eina_hash_pointer_new(_eguebfs_index_element_free_cb);
+	thiz->changed = changed;
+	thiz->data = data;
+
+	et = EGUEB_DOM_EVENT_TARGET(doc);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_INSERTED,
+			_eguebfs_index_node_inserted_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_REMOVED,
+			_eguebfs_index_node_removed_cb, EINA_FALSE, thiz);
+
+	return thiz;
+}
+
+void eguebfs_index_free(Eguebfs_Index *thiz)
+{
+	Egueb_Dom_Event_Target *et;
+
+	et = EGUEB_DOM_EVENT_TARGET(thiz->doc);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_INSERTED,
+			_eguebfs_index_node_inserted_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_REMOVED,
+			_eguebfs_index_node_removed_cb, EINA_FALSE, thiz);
+
+	eina_hash_free(thiz->elements);
+	egueb_dom_node_unref(thiz->doc);
+	eina_lock_free(&thiz->lock);
+	free(thiz);
+}
+
+/* Drop the index of an element and of its descendants, it is built again
+ * the next time it is needed
+ */
+void eguebfs_index_drop(Eguebfs_Index *thiz, Egueb_Dom_Node *n)
+{
+	eina_lock_take(&thiz->lock);
+	_eguebfs_index_element_drop(thiz, n);
+	eina_lock_release(&thiz->lock);
+}
+
+/* Get the nth (starting at 1) child named as name. Must be called with the
+ * document locked
+ */
+Egueb_Dom_Node * eguebfs_index_child_get(Eguebfs_Index *thiz,
+		Egueb_Dom_Node *n, const char *name, int nth)
+{
+	Eguebfs_Index_Element *ie;
+	Eguebfs_Index_Name *in;
+	Egueb_Dom_Node *ret = NULL;
+
+	eina_lock_take(&thiz->lock);
+	ie = _eguebfs_index_element_get(thiz, n);
+	in = eina_hash_find(ie->names, name);
+	if (in && nth > 0 && (unsigned int)nth <= eina_array_count(in->children))
+		ret = egueb_dom_node_ref(eina_array_data_get(in->children, nth - 1));
+	eina_lock_release(&thiz->lock);
+
+	return ret;
+}
+
+int eguebfs_index_child_count(Eguebfs_Index *thiz, Egueb_Dom_Node *n,
+		const char *name)
+{
+	Eguebfs_Index_Element *ie;
+	Eguebfs_Index_Name *in;
+	int ret = 0;
+
+	eina_lock_take(&thiz->lock);
+	ie = _eguebfs_index_element_get(thiz, n);
+	in = eina_hash_find(ie->names, name);
+	if (in)
+		ret = eina_array_count(in->children);
+	eina_lock_release(&thiz->lock);
+
+	return ret;
+}
+
+/* Call the callback with every name and the children with it, in order,
+ * starting at the name from or at the first one if it is NULL. The index is
+ * locked while the callback is called, so it must not use it, and the
+ * children are only valid during the call. Returns
+ * EINA_FALSE if from is not a name of the element
+ */
+Eina_Bool eguebfs_index_foreach(Eguebfs_Index *thiz, Egueb_Dom_Node *n,
+		const char *from, Eguebfs_Index_Foreach cb, void *data)
+{
+	Eguebfs_Index_Element *ie;
+	Eguebfs_Index_Name *in;
+	Eina_Inlist *l;
+	Eina_Bool ret = EINA_TRUE;
+
+	eina_lock_take(&thiz->lock);
+	ie = _eguebfs_index_element_get(thiz, n);
+	l = ie->order;
+	if (from)
+	{
+		in = eina_hash_find(ie->names, from);
+		if (!in)
+		{
+			ret = EINA_FALSE;
+			goto done;
+		}
+		l = EINA_INLIST_GET(in);
+	}
+
+	for (; l; l = l->next)
+	{
+		in = EINA_INLIST_CONTAINER_GET(l, Eguebfs_Index_Name);
+		if (!eina_array_count(in->children))
+			continue;
+		if (!cb(data, in->name, in->children))
+			break;
+	}
+done:
+	eina_lock_release(&thiz->lock);
+	return ret;
+}
+
+/* Get the position (starting at 1) of child among the children of n with
+ * the same name. The child might be in the middle of an insertion or a
+ * removal the index has not seen yet or has already seen, in that case the
+ * position it has on the document is returned. The index of n is not built,
+ * 0 is returned if there is none
+ */
+int eguebfs_index_child_position(Eguebfs_Index *thiz, Egueb_Dom_Node *n,
+		Egueb_Dom_Node *child)
+{
+	Eguebfs_Index_Element *ie;
+	Eguebfs_Index_Name *in;
+	Egueb_Dom_String *name;
+	const char *chars;
+	int ret = 0;
+
+	eina_lock_take(&thiz->lock);
+	ie = eina_hash_find(thiz->elements, &n);
+	if (!ie)
+		goto done;
+
+	name = egueb_dom_node_name_get(child);
+	chars = egueb_dom_string_chars_get(name);
+	in = eina_hash_find(ie->names, chars);
+	if (!in)
+	{
+		ret = 1;
+	}
+	else
+	{
+		ret = _eguebfs_index_name_position(in, child);
+		if (ret < 0)
+		{
+			ret = _eguebfs_index_name_next_position(in, child, chars);
+			if (ret < 0)
+				ret = eina_array_count(in->children);
+		}
+		ret++;
+	}
+	egueb_dom_string_unref(name);
+done:
+	eina_lock_release(&thiz->lock);
+	return ret;
+}
@@ -0,0 +1,387 @@
+/* EGUEBFS - FUSE based Egueb filesystem
+ * Copyright (C) 2015 - 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+
+#include "eguebfs_private.h"
+
+/*
+ * Every file the kernel knows about is an inode. An inode is created the
+ * first time a (node, file type) pair is looked up and lives, holding a
+ * reference to the node, until the kernel forgets every lookup done on it.
+ * Inode numbers are never reused, the root of the filesystem is always the
+ * FUSE_ROOT_ID inode number. Every inode belongs to the document of its node,
+ * the root of a mount of several documents belongs to none.
+ */
+/*============================================================================*
+ *                                  Local                                     *
+ *============================================================================*/
+struct _Eguebfs_Inodes
+{
+	/* lookups and forgets happen concurrently on every worker */
+	Eina_Lock lock;
+	/* ino -> inode */
+	Eina_Hash *inos;
+	/* file -> inode */
+	Eina_Hash *files;
+	Eguebfs_Inode *root;
+	fuse_ino_t last;
+	/* inodes of anim, styled and final values the kernel has seen */
+	Eina_Inlist *computed;
+};
+
+typedef struct _Eguebfs_Inodes_Owner_Drop
+{
+	Eguebfs_Document *owner;
+	Eguebfs_Inode *root;
+	Eina_Array *dropped;
+} Eguebfs_Inodes_Owner_Drop;
+
+static unsigned int _eguebfs_inodes_file_key_length(const void *key EINA_UNUSED)
+{
+	return sizeof(Eguebfs_File);
+}
+
+static int _eguebfs_inodes_file_key_cmp(const void *key1, int key1_length EINA_UNUSED,
+		const void *key2, int key2_length EINA_UNUSED)
+{
+	const Eguebfs_File *f1 = key1;
+	const Eguebfs_File *f2 = key2;
+
+	if (f1->n != f2->n)
+		return f1->n < f2->n ? -1 : 1;
+	return f1->type - f2->type;
+}
+
+static int _eguebfs_inodes_file_key_hash(const void *key, int key_length EINA_UNUSED)
+{
+	const Eguebfs_File *f = key;
+	unsigned long long k;
+
+	k = (unsigned long long)(uintptr_t)f->n ^ f->type;
+	return eina_hash_int64(&k, sizeof(k));
+}
+
+static Eguebfs_Inode * _eguebfs_inodes_add(Eguebfs_Inodes *thiz,
+		fuse_ino_t ino, Eguebfs_File *f, Eguebfs_Document *owner)
+{
+	Eguebfs_Inode *inode;
+
+	inode = calloc(1, sizeof(Eguebfs_Inode));
+	inode->ino = ino;
+	inode->f = *f;
+	inode->owner = owner;
+	eina_hash_add(thiz->inos, &inode->ino, inode);
+	eina_hash_direct_add(thiz->files, &inode->f, inode);
+
+	return inode;
+}
+
+static void _eguebfs_inodes_del(Eguebfs_Inodes *thiz, Eguebfs_Inode *inode)
+{
+	if (inode->computed)
+		thiz->computed = eina_inlist_remove(thiz->computed,
+				EINA_INLIST_GET(inode));
+	eina_hash_del(thiz->files, &inode->f, inode);
+	eina_hash_del(thiz->inos, &inode->ino, inode);
+	if (inode->f.n)
+		egueb_dom_node_unref(inode->f.n);
+	free(inode);
+}
+
+static Eina_Bool _eguebfs_inodes_owner_collect_cb(const Eina_Hash *hash EINA_UNUSED,
+		const void *key EINA_UNUSED, void *data, void *fdata)
+{
+	Eguebfs_Inodes_Owner_Drop *od = fdata;
+	Eguebfs_Inode *inode = data;
+
+	if (inode->owner == od->owner && inode != od->root)
+		eina_array_push(od->dropped, inode);
+	return EINA_TRUE;
+}
+
+static Eina_Bool _eguebfs_inodes_free_cb(const Eina_Hash *hash EINA_UNUSED,
+		const void *key EINA_UNUSED, void *data, void *fdata EINA_UNUSED)
+{
+	Eguebfs_Inode *inode = data;
+
+	if (inode->f.n)
+		egueb_dom_node_unref(inode->f.n);
+	free(inode);
+	return EINA_TRUE;
+}
+/*============================================================================*
+ *                                 Global                                     *
+ *============================================================================*/
+/* The root is the document, or the list of documents without it */
+Eguebfs_Inodes * eguebfs_inodes_new(Egueb_Dom_Node *doc,
+		Eguebfs_Document *owner)
+{
+	Eguebfs_Inodes *thiz;
+	Eguebfs_File f;
+
+	thiz = calloc(1, sizeof(Eguebfs_Inodes));
+	eina_lock_new(&thiz->lock);
+	thiz->inos = eina_hash_int64_new(NULL);
+	thiz->files = eina_hash_new(_eguebfs_inodes_file_key_length,
+			_eguebfs_inodes_file_key_cmp,
+			_eguebfs_inodes_file_key_hash, NULL, 8);
+
+	if (doc)
+	{
+		f.type = EGUEBFS_FILE_TYPE_NODE;
+		f.n = egueb_dom_node_ref(doc);
+	}
+	else
+	{
+		f.type = EGUEBFS_FILE_TYPE_DOCUMENTS;
+		f.n = NULL;
+	}
+	thiz->root = _eguebfs_inodes_add(thiz, FUSE_ROOT_ID, &f, owner);
+	thiz->last = FUSE_ROOT_ID;
+
+	return thiz;
+}
+
+void eguebfs_inodes_free(Eguebfs_Inodes *thiz)
+{
+	eina_hash_foreach(thiz->inos, _eguebfs_inodes_free_cb, NULL);
+	eina_hash_free(thiz->inos);
+	eina_hash_free(thiz->files);
+	eina_lock_free(&thiz->lock);
+	free(thiz);
+}
+
+/* The inode is owned by the table, it is valid until it is forgotten. The
+ * kernel never forgets an inode with requests in flight, so it is safe to
+ * use it for the duration of the request
+ */
+Eguebfs_Inode * eguebfs_inodes_get(Eguebfs_Inodes *thiz, fuse_ino_t ino)
+{
+	Eguebfs_Inode *inode;
+
+	eina_lock_take(&thiz->lock);
+	inode = eina_hash_find(thiz->inos, &ino);
+	eina_lock_release(&thiz->lock);
+
+	return inode;
+}
+
+/* Get the inode for a file of the owner document increasing its lookup
+ * count. The reference of the file node is always stolen
+ */
+Eguebfs_Inode * eguebfs_inodes_lookup(Eguebfs_Inodes *thiz, Eguebfs_File *f,
+		Eguebfs_Document *owner)
+{
+	Eguebfs_Inode *inode;
+
+	eina_lock_take(&thiz->lock);
+	inode = eina_hash_find(thiz->files, f);
+	if (inode)
+	{
+		if (f->n)
+			egueb_dom_node_unref(f->n);
+	}
+	else
+	{
+		inode = _eguebfs_inodes_add(thiz, ++thiz->last, f, owner);
+	}
+	inode->nlookup++;
+	eina_lock_release(&thiz->lock);
+
+	return inode;
+}
+
+/* Get the inode number of a file, zero if the kernel does not know it */
+fuse_ino_t eguebfs_inodes_find(Eguebfs_Inodes *thiz, Egueb_Dom_Node *n,
+		Eguebfs_File_Type type)
+{
+	Eguebfs_Inode *inode;
+	Eguebfs_File f;
+	fuse_ino_t ino = 0;
+
+	f.type = type;
+	f.n = n;
+	eina_lock_take(&thiz->lock);
+	inode = eina_hash_find(thiz->files, &f);
+	if (inode)
+		ino = inode->ino;
+	eina_lock_release(&thiz->lock);
+
+	return ino;
+}
+
+void eguebfs_inodes_forget(Eguebfs_Inodes *thiz, fuse_ino_t ino,
+		uint64_t nlookup)
+{
+	Eguebfs_Inode *inode;
+
+	eina_lock_take(&thiz->lock);
+	inode = eina_hash_find(thiz->inos, &ino);
+	if (!inode || inode == thiz->root)
+		goto done;
+
+	if (inode->nlookup > nlookup)
+		inode->nlookup -= nlookup;
+	else
+		_eguebfs_inodes_del(thiz, inode);
+done:
+	eina_lock_release(&thiz->lock);
+}
+
+/* Forget every inode of a document that is no longer mounted, whatever the
+ * kernel knows of them. The root is kept
+ */
+void eguebfs_inodes_owner_drop(Eguebfs_Inodes *thiz, Eguebfs_Document *owner)
+{
+	Eguebfs_Inodes_Owner_Drop od;
+	unsigned int i;
+
+	od.owner = owner;
+	od.root = thiz->root;
+	od.dropped = eina_array_new(64);
+	eina_lock_take(&thiz->lock);
+	/* the hash can not be modified while walked */
+	eina_hash_foreach(thiz->inos, _eguebfs_inodes_owner_collect_cb, &od);
+	for (i = 0; i < eina_array_count(od.dropped); i++)
+		_eguebfs_inodes_del(thiz, eina_array_data_get(od.dropped, i));
+	eina_lock_release(&thiz->lock);
+	eina_array_free(od.dropped);
+}
+
+/* The length of the value of an inode is cached until the document changes,
+ * the generation is the document mutation count when it was computed. A
+ * length cached at generation zero is kept until it is dropped
+ */
+Eina_Bool eguebfs_inodes_length_get(Eguebfs_Inodes *thiz, Eguebfs_Inode *inode,
+		unsigned int generation, off_t *length)
+{
+	Eina_Bool ret = EINA_FALSE;
+
+	eina_lock_take(&thiz->lock);
+	if (inode->has_length && inode->generation == generation)
+	{
+		*length = inode->length;
+		ret = EINA_TRUE;
+	}
+	eina_lock_release(&thiz->lock);
+
+	return ret;
+}
+
+void eguebfs_inodes_length_set(Eguebfs_Inodes *thiz, Eguebfs_Inode *inode,
+		unsigned int generation, off_t length)
+{
+	eina_lock_take(&thiz->lock);
+	inode->length = length;
+	inode->generation = generation;
+	inode->has_length = EINA_TRUE;
+	eina_lock_release(&thiz->lock);
+}
+
+void eguebfs_inodes_length_drop(Eguebfs_Inodes *thiz, fuse_ino_t ino)
+{
+	Eguebfs_Inode *inode;
+
+	eina_lock_take(&thiz->lock);
+	inode = eina_hash_find(thiz->inos, &ino);
+	if (inode)
+		inode->has_length = EINA_FALSE;
+	eina_lock_release(&thiz->lock);
+}
+
+/* The character data of the node of an inode has been modified */
+void eguebfs_inodes_modified_add(Eguebfs_Inodes *thiz, fuse_ino_t ino)
+{
+	Eguebfs_Inode *inode;
+
+	eina_lock_take(&thiz->lock);
+	inode = eina_hash_find(thiz->inos, &ino);
+	if (inode)
+		inode->modified++;
+	eina_lock_release(&thiz->lock);
+}
+
+/* Get how many times the character data of a file has been modified since
+ * the kernel knows it, fails if it does not know it
+ */
+Eina_Bool eguebfs_inodes_modified_get(Eguebfs_Inodes *thiz, Eguebfs_File *f,
+		unsigned int *modified)
+{
+	Eguebfs_Inode *inode;
+
+	eina_lock_take(&thiz->lock);
+	inode = eina_hash_find(thiz->files, f);
+	if (inode)
+		*modified = inode->modified;
+	eina_lock_release(&thiz->lock);
+
+	return !!inode;
+}
+
+/* The anim, styled and final values change without any mutation event, i.e
+ * on an animation tick, so the inodes of those values handed to the kernel
+ * are kept to be invalidated whenever the document might have changed
+ */
+void eguebfs_inodes_computed_add(Eguebfs_Inodes *thiz, Eguebfs_Inode *inode)
+{
+	switch (inode->f.type)
+	{
+		case EGUEBFS_FILE_TYPE_ATTR_ANIM:
+		case EGUEBFS_FILE_TYPE_ATTR_STYLED:
+		case EGUEBFS_FILE_TYPE_ATTR_FINAL:
+		break;
+
+		default:
+		return;
+	}
+
+	eina_lock_take(&thiz->lock);
+	if (!inode->computed)
+	{
+		inode->computed = EINA_TRUE;
+		thiz->computed = eina_inlist_append(thiz->computed,
+				EINA_INLIST_GET(inode));
+	}
+	eina_lock_release(&thiz->lock);
+}
+
+/* Call cb on every computed inode of the owner document and take them out
+ * of the list
+ */
+void eguebfs_inodes_computed_flush(Eguebfs_Inodes *thiz,
+		Eguebfs_Document *owner, Eguebfs_Inodes_Cb cb, void *data)
+{
+	Eguebfs_Inode *inode;
+	Eina_Inlist *l;
+
+	eina_lock_take(&thiz->lock);
+	EINA_INLIST_FOREACH_SAFE(thiz->computed, l, inode)
+	{
+		if (inode->owner != owner)
+			continue;
+		inode->computed = EINA_FALSE;
+		thiz->computed = eina_inlist_remove(thiz->computed,
+				EINA_INLIST_GET(inode));
+		cb(data, inode->ino);
+	}
+	eina_lock_release(&thiz->lock);
+}
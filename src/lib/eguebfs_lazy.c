@@ -0,0 +1,1114 @@
+/* EGUEBFS - FUSE based Egueb filesystem
+ * Copyright (C) 2015 - 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+
+#include "eguebfs_private.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * A lazy document is built from a file that is mapped in memory instead of
+ * being parsed at once. At first the document only has the topmost element
+ * and the children of an element are created from the file the first time
+ * they are needed, that is, when the element is indexed or serialized. The
+ * elements created that way remember where they are on the file.
+ *
+ * The elements that have not been modified can have their children
+ * destroyed again, which is done from the least recently created ones
+ * whenever the bytes of the file created go over a budget. Only the
+ * elements whose descendants are unknown to the kernel are evicted.
+ *
+ * Creating and destroying the children is not a change of the document,
+ * the mutation events are stopped before anyone else can see them. Any
+ * other mutation marks the element and its ancestors as modified, and a
+ * non modified element serializes as its bytes on the file
+ *
+ * The whole file can also be loaded on the background, level by level, so
+ * it is parsed by the time it is walked. Creating the children modifies the
+ * nodes, so the background load holds the document lock, but only
+ * for a chunk of the file at a time to let the requests in between
+ */
+#define EGUEBFS_LAZY_LOAD_CHUNK 65536
+/*============================================================================*
+ *                                  Local                                     *
+ *============================================================================*/
+typedef struct _Eguebfs_Lazy_Element
+{
+	/* on the list of evictable elements */
+	EINA_INLIST;
+	Egueb_Dom_Node *n;
+	/* the whole element on the file */
+	const char *start;
+	const char *end;
+	/* the content between the start and the end tags */
+	const char *content;
+	const char *content_end;
+	/* the bytes of the file its children are made of */
+	size_t cost;
+	Eina_Bool materialized;
+	Eina_Bool modified;
+} Eguebfs_Lazy_Element;
+
+struct _Eguebfs_Lazy
+{
+	Eina_Lock lock;
+	char *map;
+	size_t size;
+	Egueb_Dom_Node *doc;
+	/* node -> Eguebfs_Lazy_Element */
+	Eina_Hash *elements;
+	/* the materialized elements not modified, the oldest first */
+	Eina_Inlist *lru;
+	size_t used;
+	size_t budget;
+	/* the mutations are ours */
+	Eina_Bool building;
+	/* the elements to load on the background and the next one */
+	Eina_Array *pending;
+	unsigned int pending_next;
+	/* eviction */
+	Eguebfs_Lazy_Busy busy;
+	Eguebfs_Lazy_Evicted evicted;
+	Eguebfs_Lazy_Lock doc_lock;
+	void *data;
+	Eina_Thread thread;
+	Eina_Condition cond;
+	Eina_Bool running;
+	Eina_Bool evict;
+	Eina_Bool done;
+};
+
+/* A start tag on the file */
+typedef struct _Eguebfs_Lazy_Tag
+{
+	const char *name;
+	size_t name_length;
+	/* right after the name */
+	const char *attrs;
+	/* right after the tag */
+	const char *end;
+	Eina_Bool empty;
+} Eguebfs_Lazy_Tag;
+
+static void _eguebfs_lazy_element_free_cb(void *data)
+{
+	Eguebfs_Lazy_Element *le = data;
+
+	egueb_dom_node_unref(le->n);
+	free(le);
+}
+
+static const char * _eguebfs_lazy_find(const char *p, const char *end,
+		const char *what)
+{
+	size_t length = strlen(what);
+
+	for (; p + length <= end; p++)
+	{
+		if (*p == *what && !memcmp(p, what, length))
+			return p;
+	}
+	return NULL;
+}
+
+static Eina_Bool _eguebfs_lazy_name_char(char c)
+{
+	return isalnum((unsigned char)c) || c == ':' || c == '_' || c == '-' ||
+			c == '.' || (unsigned char)c >= 0x80;
+}
+
+/* Skip a comment, a cdata section, a processing instruction or a doctype.
+ * Returns NULL if p is not at any of them
+ */
+static const char * _eguebfs_lazy_skip_markup(const char *p, const char *end)
+{
+	const char *found;
+
+	if (p + 4 <= end && !memcmp(p, "<!--", 4))
+	{
+		found = _eguebfs_lazy_find(p + 4, end, "-->");
+		return found ? found + 3 : end;
+	}
+	if (p + 9 <= end && !memcmp(p, "<![CDATA[", 9))
+	{
+		found = _eguebfs_lazy_find(p + 9, end, "]]>");
+		return found ? found + 3 : end;
+	}
+	if (p + 2 <= end && !memcmp(p, "<?", 2))
+	{
+		found = _eguebfs_lazy_find(p + 2, end, "?>");
+		return found ? found + 2 : end;
+	}
+	if (p + 2 <= end && !memcmp(p, "<!", 2))
+	{
+		int depth = 0;
+
+		/* a doctype might have an internal subset */
+		for (p += 2; p < end; p++)
+		{
+			if (*p == '[')
+				depth++;
+			else if (*p == ']')
+				depth--;
+			else if (*p == '>' && depth <= 0)
+				return p + 1;
+		}
+		return end;
+	}
+	return NULL;
+}
+
+/* Parse the start tag at p */
+static Eina_Bool _eguebfs_lazy_tag_parse(const char *p, const char *end,
+		Eguebfs_Lazy_Tag *t)
+{
+	char quote = 0;
+
+	if (p >= end || *p != '<')
+		return EINA_FALSE;
+	t->name = ++p;
+	while (p < end && _eguebfs_lazy_name_char(*p))
+		p++;
+	t->name_length = p - t->name;
+	if (!t->name_length)
+		return EINA_FALSE;
+	t->attrs = p;
+	for (; p < end; p++)
+	{
+		if (quote)
+		{
+			if (*p == quote)
+				quote = 0;
+		}
+		else if (*p == '"' || *p == '\'')
+		{
+			quote = *p;
+		}
+		else if (*p == '>')
+		{
+			t->empty = *(p - 1) == '/';
+			t->end = p + 1;
+			return EINA_TRUE;
+		}
+	}
+	return EINA_FALSE;
+}
+
+/* Find the end of the element whose start tag ends at p. Returns the start
+ * of its end tag and sets after to right after it
+ */
+static const char * _eguebfs_lazy_element_end(const char *p, const char *end,
+		const char **after)
+{
+	int depth = 1;
+
+	while (p < end)
+	{
+		const char *skip;
+		Eguebfs_Lazy_Tag t;
+
+		p = memchr(p, '<', end - p);
+		if (!p)
+			break;
+		skip = _eguebfs_lazy_skip_markup(p, end);
+		if (skip)
+		{
+			p = skip;
+			continue;
+		}
+		if (p + 1 < end && p[1] == '/')
+		{
+			const char *close = memchr(p, '>', end - p);
+
+			if (!close)
+				break;
+			if (!--depth)
+			{
+				*after = close + 1;
+				return p;
+			}
+			p = close + 1;
+			continue;
+		}
+		if (!_eguebfs_lazy_tag_parse(p, end, &t))
+		{
+			p++;
+			continue;
+		}
+		if (!t.empty)
+			depth++;
+		p = t.end;
+	}
+	*after = end;
+	return end;
+}
+
+/* Append the text from p to end resolving the entities */
+static void _eguebfs_lazy_decode(Eina_Strbuf *b, const char *p,
+		const char *end)
+{
+	static const struct {
+		const char *name;
+		char c;
+	} entities[] = {
+		{ "lt;", '<' },
+		{ "gt;", '>' },
+		{ "amp;", '&' },
+		{ "quot;", '"' },
+		{ "apos;", '\'' },
+	};
+
+	while (p < end)
+	{
+		const char *amp;
+		unsigned int i;
+
+		amp = memchr(p, '&', end - p);
+		if (!amp)
+		{
+			eina_strbuf_append_length(b, p, end - p);
+			return;
+		}
+		eina_strbuf_append_length(b, p, amp - p);
+		p = amp + 1;
+		if (p < end && *p == '#')
+		{
+			const char *code_end = p + 1;
+			unsigned long code = 0;
+			int base = 10;
+
+			/* the file is not terminated, parse it up to the end */
+			if (code_end < end && (*code_end == 'x' ||
+					*code_end == 'X'))
+			{
+				base = 16;
+				code_end++;
+			}
+			for (; code_end < end && code <= 0x10ffff; code_end++)
+			{
+				int digit;
+
+				if (isdigit((unsigned char)*code_end))
+					digit = *code_end - '0';
+				else if (base == 16 &&
+						isxdigit((unsigned char)*code_end))
+					digit = tolower((unsigned char)*code_end)
+							- 'a' + 10;
+				else
+					break;
+				code = code * base + digit;
+			}
+			/* zero and what is beyond unicode are kept as is */
+			if (code_end < end && *code_end == ';' && code &&
+					code <= 0x10ffff)
+			{
+				char utf8[4];
+				int length;
+
+				/* encode it as utf-8 */
+				if (code < 0x80)
+				{
+					utf8[0] = code;
+					length = 1;
+				}
+				else if (code < 0x800)
+				{
+					utf8[0] = 0xc0 | (code >> 6);
+					utf8[1] = 0x80 | (code & 0x3f);
+					length = 2;
+				}
+				else if (code < 0x10000)
+				{
+					utf8[0] = 0xe0 | (code >> 12);
+					utf8[1] = 0x80 | ((code >> 6) & 0x3f);
+					utf8[2] = 0x80 | (code & 0x3f);
+					length = 3;
+				}
+				else
+				{
+					utf8[0] = 0xf0 | (code >> 18);
+					utf8[1] = 0x80 | ((code >> 12) & 0x3f);
+					utf8[2] = 0x80 | ((code >> 6) & 0x3f);
+					utf8[3] = 0x80 | (code & 0x3f);
+					length = 4;
+				}
+				eina_strbuf_append_length(b, utf8, length);
+				p = code_end + 1;
+				continue;
+			}
+		}
+		for (i = 0; i < sizeof(entities) / sizeof(entities[0]); i++)
+		{
+			size_t length = strlen(entities[i].name);
+
+			if (p + length <= end && !memcmp(p, entities[i].name, length))
+			{
+				eina_strbuf_append_char(b, entities[i].c);
+				p += length;
+				break;
+			}
+		}
+		/* an unknown entity is kept as is */
+		if (i == sizeof(entities) / sizeof(entities[0]))
+			eina_strbuf_append_char(b, '&');
+	}
+}
+
+/* Set the attributes of the start tag on the element */
+static void _eguebfs_lazy_attributes_set(Egueb_Dom_Node *n,
+		Eguebfs_Lazy_Tag *t)
+{
+	const char *p = t->attrs;
+	const char *end = t->end - 1;
+	Eina_Strbuf *b;
+
+	b = eina_strbuf_new();
+	while (p < end)
+	{
+		Egueb_Dom_String *name;
+		Egueb_Dom_String *s;
+		Egueb_Dom_Node *attr;
+		const char *name_start;
+		const char *value;
+		char quote;
+
+		while (p < end && !_eguebfs_lazy_name_char(*p))
+			p++;
+		name_start = p;
+		while (p < end && _eguebfs_lazy_name_char(*p))
+			p++;
+		if (p == name_start)
+			break;
+		eina_strbuf_reset(b);
+		eina_strbuf_append_length(b, name_start, p - name_start);
+		while (p < end && (isspace((unsigned char)*p) || *p == '='))
+			p++;
+		if (p >= end || (*p != '"' && *p != '\''))
+			continue;
+		quote = *p++;
+		value = p;
+		while (p < end && *p != quote)
+			p++;
+
+		name = egueb_dom_string_new_with_chars(eina_strbuf_string_get(b));
+		eina_strbuf_reset(b);
+		_eguebfs_lazy_decode(b, value, p);
+		s = egueb_dom_string_new_with_length(eina_strbuf_string_get(b),
+				eina_strbuf_length_get(b));
+		attr = egueb_dom_element_attribute_node_get(n, name);
+		if (attr)
+		{
+			egueb_dom_attr_string_set(attr, EGUEB_DOM_ATTR_TYPE_BASE, s);
+			egueb_dom_node_unref(attr);
+		}
+		/* the unknown and the prefixed ones, like xlink:href, are left
+		 * to the element, the same as the parser does
+		 */
+		else if (!egueb_dom_element_attribute_set(n, name, s, NULL))
+		{
+			WRN("Unknown attribute '%s'",
+					egueb_dom_string_chars_get(name));
+		}
+		egueb_dom_string_unref(name);
+		egueb_dom_string_unref(s);
+		p++;
+	}
+	eina_strbuf_free(b);
+}
+
+static Eguebfs_Lazy_Element * _eguebfs_lazy_element_add(Eguebfs_Lazy *thiz,
+		Egueb_Dom_Node *n, const char *start, const char *content,
+		const char *end)
+{
+	Eguebfs_Lazy_Element *le;
+
+	le = calloc(1, sizeof(Eguebfs_Lazy_Element));
+	le->n = egueb_dom_node_ref(n);
+	le->start = start;
+	le->content = content;
+	le->content_end = _eguebfs_lazy_element_end(content, end, &le->end);
+	eina_hash_add(thiz->elements, &le->n, le);
+	if (thiz->pending)
+		eina_array_push(thiz->pending, egueb_dom_node_ref(n));
+
+	return le;
+}
+
+static void _eguebfs_lazy_character_data_add(Egueb_Dom_Node *n,
+		Egueb_Dom_Node *ref, Egueb_Dom_Node *cd, const char *p,
+		const char *end, Eina_Bool decode)
+{
+	Egueb_Dom_String *s;
+	Eina_Strbuf *b;
+
+	b = eina_strbuf_new();
+	if (decode)
+		_eguebfs_lazy_decode(b, p, end);
+	else
+		eina_strbuf_append_length(b, p, end - p);
+	s = egueb_dom_string_new_with_length(eina_strbuf_string_get(b),
+			eina_strbuf_length_get(b));
+	egueb_dom_character_data_data_append(cd, s, NULL);
+	egueb_dom_string_unref(s);
+	eina_strbuf_free(b);
+	egueb_dom_node_insert_before(n, cd, ref, NULL);
+}
+
+/* Create the children of the element from the file, before the children
+ * it already has. Must be called with building set
+ */
+static void _eguebfs_lazy_element_materialize(Eguebfs_Lazy *thiz,
+		Eguebfs_Lazy_Element *le)
+{
+	Egueb_Dom_Node *ref;
+	const char *p = le->content;
+	const char *end = le->content_end;
+	size_t cost = end - p;
+
+	ref = egueb_dom_node_child_first_get(le->n);
+	while (p < end)
+	{
+		const char *text;
+		const char *skip;
+		Eguebfs_Lazy_Tag t;
+
+		/* the text up to the next markup, whitespace only is ignored
+		 * and any other is kept as is
+		 */
+		text = p;
+		p = memchr(p, '<', end - p);
+		if (!p)
+			p = end;
+		for (skip = text; skip < p; skip++)
+		{
+			if (!isspace((unsigned char)*skip))
+				break;
+		}
+		if (skip < p)
+		{
+			_eguebfs_lazy_character_data_add(le->n, ref,
+					egueb_dom_text_new(), text, p,
+					EINA_TRUE);
+		}
+		if (p == end)
+			break;
+
+		if (p + 9 <= end && !memcmp(p, "<![CDATA[", 9))
+		{
+			skip = _eguebfs_lazy_skip_markup(p, end);
+			_eguebfs_lazy_character_data_add(le->n, ref,
+					egueb_dom_cdata_section_new(), p + 9,
+					skip - 3 >= p + 9 ? skip - 3 : skip,
+					EINA_FALSE);
+			p = skip;
+			continue;
+		}
+		skip = _eguebfs_lazy_skip_markup(p, end);
+		if (skip)
+		{
+			p = skip;
+			continue;
+		}
+		if (!_eguebfs_lazy_tag_parse(p, end, &t))
+		{
+			ERR("Malformed element at byte %zu", (size_t)(p - thiz->map));
+			break;
+		}
+		else
+		{
+			Egueb_Dom_String *name;
+			Egueb_Dom_Node *child;
+
+			name = egueb_dom_string_new_with_length(t.name,
+					t.name_length);
+			child = egueb_dom_document_element_create(thiz->doc,
+					name, NULL);
+			egueb_dom_string_unref(name);
+			if (!child)
+			{
+				WRN("Unknown element '%.*s'", (int)t.name_length,
+						t.name);
+				if (t.empty)
+					p = t.end;
+				else
+					_eguebfs_lazy_element_end(t.end, end, &p);
+				continue;
+			}
+			_eguebfs_lazy_attributes_set(child, &t);
+			if (t.empty)
+			{
+				p = t.end;
+			}
+			else
+			{
+				Eguebfs_Lazy_Element *cle;
+
+				cle = _eguebfs_lazy_element_add(thiz, child, p,
+						t.end, end);
+				/* its content is paid when it is materialized */
+				cost -= cle->content_end - cle->content;
+				p = cle->end;
+			}
+			egueb_dom_node_insert_before(le->n, child, ref, NULL);
+		}
+	}
+	if (ref)
+		egueb_dom_node_unref(ref);
+
+	le->materialized = EINA_TRUE;
+	le->cost = cost;
+	thiz->used += cost;
+	if (!le->modified)
+		thiz->lru = eina_inlist_append(thiz->lru, EINA_INLIST_GET(le));
+}
+
+/* Forget the elements of a subtree, except the root */
+static void _eguebfs_lazy_subtree_forget(Eguebfs_Lazy *thiz,
+		Egueb_Dom_Node *n)
+{
+	Egueb_Dom_Node *child;
+
+	child = egueb_dom_node_child_first_get(n);
+	while (child)
+	{
+		Eguebfs_Lazy_Element *le;
+		Egueb_Dom_Node *tmp;
+
+		_eguebfs_lazy_subtree_forget(thiz, child);
+		le = eina_hash_find(thiz->elements, &child);
+		if (le)
+		{
+			if (le->materialized)
+			{
+				thiz->used -= le->cost;
+				if (!le->modified)
+					thiz->lru = eina_inlist_remove(thiz->lru,
+							EINA_INLIST_GET(le));
+			}
+			eina_hash_del(thiz->elements, &child, le);
+		}
+		tmp = egueb_dom_node_sibling_next_get(child);
+		egueb_dom_node_unref(child);
+		child = tmp;
+	}
+}
+
+/* Check if the kernel knows any file of the descendants of n */
+static Eina_Bool _eguebfs_lazy_subtree_busy(Eguebfs_Lazy *thiz,
+		Egueb_Dom_Node *n)
+{
+	Egueb_Dom_Node *child;
+	Eina_Bool ret = EINA_FALSE;
+
+	child = egueb_dom_node_child_first_get(n);
+	while (child && !ret)
+	{
+		Egueb_Dom_Node *tmp;
+
+		ret = thiz->busy(thiz->data, child) ||
+				_eguebfs_lazy_subtree_busy(thiz, child);
+		tmp = egueb_dom_node_sibling_next_get(child);
+		egueb_dom_node_unref(child);
+		child = tmp;
+	}
+	if (child)
+		egueb_dom_node_unref(child);
+	return ret;
+}
+
+/* Destroy the children of the element. Must be called with the document
+ * locked
+ */
+static Eina_Bool _eguebfs_lazy_element_evict(Eguebfs_Lazy *thiz,
+		Eguebfs_Lazy_Element *le)
+{
+	Egueb_Dom_Node *child;
+
+	if (_eguebfs_lazy_subtree_busy(thiz, le->n))
+		return EINA_FALSE;
+
+	thiz->building = EINA_TRUE;
+	if (thiz->evicted)
+		thiz->evicted(thiz->data, le->n);
+	_eguebfs_lazy_subtree_forget(thiz, le->n);
+	while ((child = egueb_dom_node_child_first_get(le->n)))
+	{
+		egueb_dom_node_child_remove(le->n, child, NULL);
+	}
+	thiz->building = EINA_FALSE;
+
+	thiz->lru = eina_inlist_remove(thiz->lru, EINA_INLIST_GET(le));
+	thiz->used -= le->cost;
+	le->materialized = EINA_FALSE;
+	le->cost = 0;
+
+	return EINA_TRUE;
+}
+
+static void _eguebfs_lazy_load_end(Eguebfs_Lazy *thiz)
+{
+	Egueb_Dom_Node *n;
+
+	while ((n = eina_array_pop(thiz->pending)))
+		egueb_dom_node_unref(n);
+	eina_array_free(thiz->pending);
+	thiz->pending = NULL;
+}
+
+/* Materialize the next chunk of pending elements */
+static void _eguebfs_lazy_load(Eguebfs_Lazy *thiz)
+{
+	size_t loaded = 0;
+
+	while (loaded < EGUEBFS_LAZY_LOAD_CHUNK)
+	{
+		Eguebfs_Lazy_Element *le;
+		Egueb_Dom_Node *n;
+
+		if (thiz->pending_next == eina_array_count(thiz->pending))
+		{
+			INF("Document loaded");
+			_eguebfs_lazy_load_end(thiz);
+			break;
+		}
+		n = eina_array_data_get(thiz->pending, thiz->pending_next++);
+		le = eina_hash_find(thiz->elements, &n);
+		if (!le || le->materialized)
+			continue;
+		thiz->building = EINA_TRUE;
+		_eguebfs_lazy_element_materialize(thiz, le);
+		thiz->building = EINA_FALSE;
+		loaded += le->cost;
+	}
+}
+
+static void * _eguebfs_lazy_main(void *data, Eina_Thread t)
+{
+	Eguebfs_Lazy *thiz = data;
+
+	eina_lock_take(&thiz->lock);
+	while (!thiz->done)
+	{
+		Eguebfs_Lazy_Element *le;
+		Eina_Inlist *l;
+
+		if (thiz->evict)
+		{
+			thiz->evict = EINA_FALSE;
+			eina_lock_release(&thiz->lock);
+
+			/* the document lock always goes first */
+			thiz->doc_lock(thiz->data, EINA_TRUE);
+			eina_lock_take(&thiz->lock);
+			EINA_INLIST_FOREACH_SAFE(thiz->lru, l, le)
+			{
+				if (thiz->used <= thiz->budget)
+					break;
+				_eguebfs_lazy_element_evict(thiz, le);
+			}
+			eina_lock_release(&thiz->lock);
+			thiz->doc_lock(thiz->data, EINA_FALSE);
+		}
+		else if (thiz->pending)
+		{
+			eina_lock_release(&thiz->lock);
+			/* materializing inserts nodes and references them, a
+			 * chunk at a time
+			 */
+			thiz->doc_lock(thiz->data, EINA_TRUE);
+			eina_lock_take(&thiz->lock);
+			_eguebfs_lazy_load(thiz);
+			eina_lock_release(&thiz->lock);
+			thiz->doc_lock(thiz->data, EINA_FALSE);
+		}
+		else
+		{
+			eina_condition_wait(&thiz->cond);
+			continue;
+		}
+		eina_lock_take(&thiz->lock);
+	}
+	eina_lock_release(&thiz->lock);
+
+	return NULL;
+}
+
+/* Mark the element and its ancestors as modified, they can not be evicted
+ * nor serialized from the file anymore
+ */
+static void _eguebfs_lazy_modified(Eguebfs_Lazy *thiz, Egueb_Dom_Node *n)
+{
+	Egueb_Dom_Node *parent;
+
+	n = egueb_dom_node_ref(n);
+	while (n && n != thiz->doc)
+	{
+		Eguebfs_Lazy_Element *le;
+
+		le = eina_hash_find(thiz->elements, &n);
+		if (le)
+		{
+			if (le->modified)
+				break;
+			le->modified = EINA_TRUE;
+			if (le->materialized)
+				thiz->lru = eina_inlist_remove(thiz->lru,
+						EINA_INLIST_GET(le));
+		}
+		parent = egueb_dom_node_parent_get(n);
+		egueb_dom_node_unref(n);
+		n = parent;
+	}
+	if (n)
+		egueb_dom_node_unref(n);
+}
+
+/* Captured before any other listener of the document */
+static void _eguebfs_lazy_node_inserted_cb(Egueb_Dom_Event *ev, void *data)
+{
+	Eguebfs_Lazy *thiz = data;
+	Eguebfs_Lazy_Element *le;
+	Egueb_Dom_Node *parent;
+
+	if (thiz->building)
+	{
+		egueb_dom_event_stop_propagation(ev);
+		return;
+	}
+	parent = egueb_dom_event_mutation_related_get(ev);
+	if (!parent)
+		return;
+
+	eina_lock_take(&thiz->lock);
+	/* the children on the file go before the new one */
+	le = eina_hash_find(thiz->elements, &parent);
+	if (le && !le->materialized)
+	{
+		thiz->building = EINA_TRUE;
+		_eguebfs_lazy_element_materialize(thiz, le);
+		thiz->building = EINA_FALSE;
+	}
+	_eguebfs_lazy_modified(thiz, parent);
+	eina_lock_release(&thiz->lock);
+	egueb_dom_node_unref(parent);
+}
+
+static void _eguebfs_lazy_node_removed_cb(Egueb_Dom_Event *ev, void *data)
+{
+	Eguebfs_Lazy *thiz = data;
+	Eguebfs_Lazy_Element *le;
+	Egueb_Dom_Node *target;
+	Egueb_Dom_Node *parent;
+
+	if (thiz->building)
+	{
+		egueb_dom_event_stop_propagation(ev);
+		return;
+	}
+	parent = egueb_dom_event_mutation_related_get(ev);
+	if (!parent)
+		return;
+
+	target = eguebfs_event_target_node_get(ev);
+	eina_lock_take(&thiz->lock);
+	_eguebfs_lazy_modified(thiz, parent);
+	/* what it has not created from the file is lost */
+	_eguebfs_lazy_subtree_forget(thiz, target);
+	le = eina_hash_find(thiz->elements, &target);
+	if (le)
+	{
+		if (le->materialized)
+		{
+			thiz->used -= le->cost;
+			if (!le->modified)
+				thiz->lru = eina_inlist_remove(thiz->lru,
+						EINA_INLIST_GET(le));
+		}
+		eina_hash_del(thiz->elements, &target, le);
+	}
+	eina_lock_release(&thiz->lock);
+	egueb_dom_node_unref(target);
+	egueb_dom_node_unref(parent);
+}
+
+static void _eguebfs_lazy_modified_cb(Egueb_Dom_Event *ev, void *data)
+{
+	Eguebfs_Lazy *thiz = data;
+	Egueb_Dom_Node *target;
+
+	if (thiz->building)
+	{
+		egueb_dom_event_stop_propagation(ev);
+		return;
+	}
+	target = eguebfs_event_target_node_get(ev);
+	eina_lock_take(&thiz->lock);
+	_eguebfs_lazy_modified(thiz, target);
+	eina_lock_release(&thiz->lock);
+	egueb_dom_node_unref(target);
+}
+
+/* Create the document with the topmost element only */
+static Eina_Bool _eguebfs_lazy_document_create(Eguebfs_Lazy *thiz)
+{
+	Enesim_Stream *stream;
+	Eguebfs_Lazy_Element *le;
+	Egueb_Dom_Node *topmost;
+	Eguebfs_Lazy_Tag t;
+	const char *end = thiz->map + thiz->size;
+	const char *p = thiz->map;
+	char *skeleton;
+	size_t length;
+
+	/* skip the prolog */
+	while (p < end)
+	{
+		const char *skip;
+
+		p = memchr(p, '<', end - p);
+		if (!p)
+			return EINA_FALSE;
+		skip = _eguebfs_lazy_skip_markup(p, end);
+		if (!skip)
+			break;
+		p = skip;
+	}
+	if (!_eguebfs_lazy_tag_parse(p, end, &t))
+		return EINA_FALSE;
+
+	/* let the parser choose the document for the topmost element */
+	length = t.end - p;
+	skeleton = malloc(length + 2);
+	memcpy(skeleton, p, length);
+	if (!t.empty)
+	{
+		skeleton[length - 1] = '/';
+		skeleton[length++] = '>';
+	}
+	skeleton[length] = '\0';
+	/* the stream owns the buffer */
+	stream = enesim_stream_buffer_new(skeleton, length);
+	if (!egueb_dom_parser_parse(stream, &thiz->doc))
+		return EINA_FALSE;
+
+	if (t.empty)
+		return EINA_TRUE;
+	topmost = egueb_dom_document_document_element_get(thiz->doc);
+	le = _eguebfs_lazy_element_add(thiz, topmost, p, t.end, end);
+	egueb_dom_node_unref(topmost);
+
+	return le->content_end != end;
+}
+/*============================================================================*
+ *                                 Global                                     *
+ *============================================================================*/
+Eguebfs_Lazy * eguebfs_lazy_new(const char *file)
+{
+	Eguebfs_Lazy *thiz;
+	Egueb_Dom_Event_Target *et;
+	struct stat st;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || !st.st_size)
+		goto no_map;
+
+	thiz = calloc(1, sizeof(Eguebfs_Lazy));
+	thiz->size = st.st_size;
+	thiz->map = mmap(NULL, thiz->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (thiz->map == MAP_FAILED)
+	{
+		free(thiz);
+		goto no_map;
+	}
+	close(fd);
+
+	eina_lock_new(&thiz->lock);
+	eina_condition_new(&thiz->cond, &thiz->lock);
+	thiz->elements = eina_hash_pointer_new(_eguebfs_lazy_element_free_cb);
+	if (!_eguebfs_lazy_document_create(thiz))
+	{
+		ERR("Fail to parse '%s'", file);
+		eguebfs_lazy_free(thiz);
+		return NULL;
+	}
+
+	et = EGUEB_DOM_EVENT_TARGET(thiz->doc);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_INSERTED,
+			_eguebfs_lazy_node_inserted_cb, EINA_TRUE, thiz);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_REMOVED,
+			_eguebfs_lazy_node_removed_cb, EINA_TRUE, thiz);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_ATTR_MODIFIED,
+			_eguebfs_lazy_modified_cb, EINA_TRUE, thiz);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_CHARACTER_DATA_MODIFIED,
+			_eguebfs_lazy_modified_cb, EINA_TRUE, thiz);
+
+	return thiz;
+no_map:
+	close(fd);
+	return NULL;
+}
+
+void eguebfs_lazy_free(Eguebfs_Lazy *thiz)
+{
+	if (thiz->running)
+	{
+		eina_lock_take(&thiz->lock);
+		thiz->done = EINA_TRUE;
+		eina_condition_signal(&thiz->cond);
+		eina_lock_release(&thiz->lock);
+		eina_thread_join(thiz->thread);
+	}
+	if (thiz->pending)
+		_eguebfs_lazy_load_end(thiz);
+	if (thiz->doc)
+	{
+		Egueb_Dom_Event_Target *et;
+
+		et = EGUEB_DOM_EVENT_TARGET(thiz->doc);
+		egueb_dom_event_target_event_listener_remove(et,
+				EGUEB_DOM_EVENT_MUTATION_NODE_INSERTED,
+				_eguebfs_lazy_node_inserted_cb, EINA_TRUE, thiz);
+		egueb_dom_event_target_event_listener_remove(et,
+				EGUEB_DOM_EVENT_MUTATION_NODE_REMOVED,
+				_eguebfs_lazy_node_removed_cb, EINA_TRUE, thiz);
+		egueb_dom_event_target_event_listener_remove(et,
+				EGUEB_DOM_EVENT_MUTATION_ATTR_MODIFIED,
+				_eguebfs_lazy_modified_cb, EINA_TRUE, thiz);
+		egueb_dom_event_target_event_listener_remove(et,
+				EGUEB_DOM_EVENT_MUTATION_CHARACTER_DATA_MODIFIED,
+				_eguebfs_lazy_modified_cb, EINA_TRUE, thiz);
+	}
+	eina_hash_free(thiz->elements);
+	if (thiz->doc)
+		egueb_dom_node_unref(thiz->doc);
+	munmap(thiz->map, thiz->size);
+	eina_condition_free(&thiz->cond);
+	eina_lock_free(&thiz->lock);
+	free(thiz);
+}
+
+Egueb_Dom_Node * eguebfs_lazy_document_get(Eguebfs_Lazy *thiz)
+{
+	return egueb_dom_node_ref(thiz->doc);
+}
+
+/* Start the thread that evicts elements whenever more than budget bytes of
+ * the file are materialized, if budget is not zero, and that loads the
+ * whole file if load is set. The busy callback tells if the kernel knows a
+ * file of a node, the evicted one is called before the children of an
+ * element are destroyed and the lock one locks the document
+ */
+Eina_Bool eguebfs_lazy_start(Eguebfs_Lazy *thiz, size_t budget, Eina_Bool load,
+		Eguebfs_Lazy_Busy busy, Eguebfs_Lazy_Evicted evicted,
+		Eguebfs_Lazy_Lock doc_lock, void *data)
+{
+	Egueb_Dom_Node *topmost;
+
+	thiz->budget = budget;
+	thiz->busy = busy;
+	thiz->evicted = evicted;
+	thiz->doc_lock = doc_lock;
+	thiz->data = data;
+	/* loading everything would be evicted again */
+	if (load && !budget)
+	{
+		thiz->pending = eina_array_new(1024);
+		topmost = egueb_dom_document_document_element_get(thiz->doc);
+		if (topmost)
+			eina_array_push(thiz->pending, topmost);
+	}
+	thiz->running = eina_thread_create(&thiz->thread,
+			EINA_THREAD_BACKGROUND, -1, _eguebfs_lazy_main, thiz);
+	if (!thiz->running && thiz->pending)
+		_eguebfs_lazy_load_end(thiz);
+	return thiz->running;
+}
+
+/* The bytes of the file parsed so far and the size of the file */
+void eguebfs_lazy_progress_get(Eguebfs_Lazy *thiz, size_t *parsed,
+		size_t *total)
+{
+	eina_lock_take(&thiz->lock);
+	*total = thiz->size;
+	/* the prolog and the markup between elements are never paid */
+	if (thiz->running && !thiz->pending && !thiz->budget)
+		*parsed = thiz->size;
+	else
+		*parsed = thiz->used < thiz->size ? thiz->used : thiz->size;
+	eina_lock_release(&thiz->lock);
+}
+
+/* Make sure the children of the element are created. Must be called with
+ * the document locked
+ */
+void eguebfs_lazy_materialize(Eguebfs_Lazy *thiz, Egueb_Dom_Node *n)
+{
+	Eguebfs_Lazy_Element *le;
+
+	eina_lock_take(&thiz->lock);
+	le = eina_hash_find(thiz->elements, &n);
+	if (le && !le->materialized)
+	{
+		thiz->building = EINA_TRUE;
+		_eguebfs_lazy_element_materialize(thiz, le);
+		thiz->building = EINA_FALSE;
+		if (thiz->running && thiz->budget &&
+				thiz->used > thiz->budget)
+		{
+			thiz->evict = EINA_TRUE;
+			eina_condition_signal(&thiz->cond);
+		}
+	}
+	eina_lock_release(&thiz->lock);
+}
+
+/* Get the bytes of the file of an element that has not been modified, NULL
+ * if there are none. Must be called with the document locked
+ */
+const char * eguebfs_lazy_source_get(Eguebfs_Lazy *thiz, Egueb_Dom_Node *n,
+		size_t *length)
+{
+	Eguebfs_Lazy_Element *le;
+	const char *ret = NULL;
+
+	eina_lock_take(&thiz->lock);
+	le = eina_hash_find(thiz->elements, &n);
+	if (le && !le->modified)
+	{
+		ret = le->start;
+		*length = le->end - le->start;
+	}
+	eina_lock_release(&thiz->lock);
+
+	return ret;
+}
@@ -21,872 +21,2169 @@
 
 #define _GNU_SOURCE
 
-#include <Eguebfs.h>
+#include "eguebfs_private.h"
 
-#ifndef _FILE_OFFSET_BITS
-#define _FILE_OFFSET_BITS 64
-#endif
-
-#define FUSE_USE_VERSION 26
-
-#include <fuse.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
 #include <stdio.h>
 
-#define ERR(...) EINA_LOG_DOM_ERR(eguebfs_log_dom, __VA_ARGS__)
-#define WRN(...) EINA_LOG_DOM_WARN(eguebfs_log_dom, __VA_ARGS__)
-#define INF(...) EINA_LOG_DOM_INFO(eguebfs_log_dom, __VA_ARGS__)
-#define DBG(...) EINA_LOG_DOM_DBG(eguebfs_log_dom, __VA_ARGS__)
-#define CRI(...) EINA_LOG_DOM_CRIT(eguebfs_log_dom, __VA_ARGS__)
+#define EGUEBFS_TIMEOUT 1.0
+#define EGUEBFS_SAVE_DELAY 2.0
+#define EGUEBFS_XML_BUDGET (16 * 1024 * 1024)
+#define EGUEBFS_XML_DECLARATION "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+#define EGUEBFS_ATTR_FILES 4
+/* the inode of the entries of a listing the kernel has not looked up */
+#define EGUEBFS_INO_UNKNOWN 0xffffffff
+
 /*
- * For a XML file like this:
- * <svg>
- *   <g color="red">
- *   </g>
- *   <g>
- *   </g>
- *   <rect/>
- * </svg>
- *
- * The tree should be like:
- * / -> doc
- * /svg@0 -> svg at level 0
- * /svg@0/g@0 -> g at repetition 0
- * /svg@0/g@0/color/ -> color attribute
- * /svg@0/g@0/color/base -> color attribute base value
- * /svg@0/g@0/color/anim -> color attribute anim value
- * /svg@0/g@0/color/style -> color attribute style value
- * /svg@0/g@0/color/final -> color attribute final value
- * /svg@0/g@1 -> g at repetition 1
- * /svg@0/rect@0 -> g at repetition 0
- *
+ * One FUSE session and one pool of workers serve every document. A mount of
+ * a single document has it at the root, a mount of several documents has a
+ * directory per document at the root, added and removed at any time. Every
+ * inode belongs to the document of its node, so a request only locks the
+ * document it is for and a busy document does not stall the rest. The
+ * session lock is only held to find a document and to reference it
  */
-
-typedef enum _Eguebfs_File_Type
-{
-	EGUEBFS_FILE_TYPE_NODE,
-	EGUEBFS_FILE_TYPE_ATTR_BASE,
-	EGUEBFS_FILE_TYPE_ATTR_ANIM,
-	EGUEBFS_FILE_TYPE_ATTR_STYLED,
-	EGUEBFS_FILE_TYPE_ATTR_FINAL,
-} Eguebfs_File_Type;
-
-typedef struct _Eguebfs_File
+struct _Eguebfs_Document
 {
-	Eguebfs_File_Type type;
-	Egueb_Dom_Node *n;
-} Eguebfs_File;
+	EINA_INLIST;
+	Eguebfs *fs;
+	/* the name of the directory, NULL when the document is the root */
+	char *name;
+	/* the document lock */
+	Eina_Lock lock;
+	Egueb_Dom_Node *doc;
+	Eguebfs_Index *index;
+	Eguebfs_Cache *cache;
+	Eguebfs_Events *events;
+	Eguebfs_Xml *xml;
+	Eguebfs_Saver *saver;
+	/* the document is built from a file as needed */
+	Eguebfs_Lazy *lazy;
+	/* incremented on every change of the document */
+	unsigned int generation;
+	/* the session, the requests in flight and the open files referencing
+	 * it, protected by the session lock
+	 */
+	int ref;
+	/* out of the filesystem, set with both locks taken */
+	Eina_Bool removed;
+};
 
 struct _Eguebfs
 {
-	Eina_Thread thread;
-	Egueb_Dom_Node *doc;
+	Eina_Thread *workers;
+	int nworkers;
 	char *mountpoint;
-	struct fuse_chan *chan;
-	struct fuse *fuse;
+	struct fuse_session *session;
+	Eguebfs_Inodes *inodes;
+	/* seconds the kernel can cache entries and attributes */
+	double entry_timeout;
+	double attr_timeout;
+	/* how every document is added */
+	double save_delay;
+	size_t lazy_budget;
+	Eina_Bool lazy_load;
+	size_t xml_budget;
+	/* what is negotiated with the kernel on init */
+	size_t max_read;
+	size_t max_write;
+	Eina_Bool writeback_cache;
+	Eina_Bool async_read;
+	Eguebfs_Notifier *notifier;
+	Eguebfs_Stats_Collector *stats;
+	/* the session lock */
+	Eina_Lock lock;
+	/* the document at the root of a single document mount */
+	Eguebfs_Document *single;
+	/* the documents at the root of a multiple document mount, in the order
+	 * they are listed and by name
+	 */
+	Eina_Inlist *documents;
+	Eina_Hash *names;
+};
+
+/* An operation done in process with eguebfs_op_*(). The operation gets the
+ * call as its request and the replies are kept on it instead of being sent
+ * to the kernel
+ */
+typedef struct _Eguebfs_Call
+{
+	Eguebfs *fs;
+	int err;
+	fuse_ino_t ino;
+	struct stat st;
+	/* the buffer of a read and the bytes replied to a read or a write */
+	char *buf;
+	size_t size;
+	Eguebfs_Op_Filler filler;
+	void *data;
+} Eguebfs_Call;
+
+typedef struct _Eguebfs_Dirbuf
+{
+	Eguebfs *fs;
+	/* the locked document of the directory, if any */
+	Eguebfs_Document *d;
+	fuse_req_t req;
+	Eguebfs_Call *call;
+	char *p;
+	size_t size;
+	size_t max;
+	/* every entry has its inode and attributes */
+	Eina_Bool plus;
+} Eguebfs_Dirbuf;
+
+/* An open regular file. The handle has its own copy of the value, taken by
+ * the first read or write and by every read at offset zero while there are
+ * no pending writes, so a sequential read sees the value as it was when it
+ * started. Writes and truncates through the handle modify the copy, which
+ * is set back on the document once, on flush, fsync or release. Changes
+ * done by others are seen once the file is read again from the start.
+ * The copy of an attribute or character data value is the value string
+ * itself, referenced instead of copied, the reads are replied straight from
+ * it and it is only copied on the first write
+ */
+typedef struct _Eguebfs_Handle
+{
+	/* NULL for the stats file at the root of several documents */
+	Eguebfs_Document *d;
+	Eguebfs_File f;
+	/* reads on the same handle can happen on different workers */
+	Eina_Lock lock;
+	char *snapshot;
+	size_t length;
+	size_t size;
+	/* the value the snapshot is while it has not been written */
+	Egueb_Dom_String *value;
+	Eina_Bool has_snapshot;
+	/* the snapshot has changes not set on the document yet */
+	Eina_Bool dirty;
+	/* the range of a character data value modified on the snapshot, from
+	 * start to end or to the end once its length changes. It only applies
+	 * while the value is the one the snapshot was taken from, of length
+	 * base after the given modifications of the node
+	 */
+	Eina_Bool ranged;
+	size_t base;
+	unsigned int modified;
+	size_t start;
+	size_t end;
+	Eina_Bool resized;
+	/* opened for appending, the writes are added at the end */
+	Eina_Bool append;
+	/* the events file has no value, only the events of this open */
+	Eguebfs_Events_Reader *reader;
+} Eguebfs_Handle;
+
+#define EGUEBFS_HANDLE(fi) ((Eguebfs_Handle *)(uintptr_t)(fi)->fh)
+
+/* An open file of eguebfs_op_open() */
+struct _Eguebfs_Op_File
+{
+	fuse_ino_t ino;
+	struct fuse_file_info fi;
 };
 /*============================================================================*
  *                                  Local                                     *
  *============================================================================*/
 static int _init = 0;
-static int eguebfs_log_dom = -1;
+int eguebfs_log_dom = -1;
 
-static Eina_Bool _eguebfs_name_is_element(const char *p, char **rname, int *count)
-{
-	const char *child_depth;
+/* The call in progress on the thread, if any */
+static Eina_TLS _eguebfs_call_key;
 
-	child_depth = strchr(p, '@');
-	if (child_depth)
-	{
-		char *name;
+static Eguebfs_Call * _eguebfs_call_get(void)
+{
+	return eina_tls_get(_eguebfs_call_key);
+}
 
-		/* get the count */
-		*count = strtoul(child_depth + 1, NULL, 10);
-		/* get the real name */
-		name = malloc(child_depth - p + 1);
-		strncpy(name, p, child_depth - p);
-		name[child_depth - p] = '\0';
-		*rname = name;
+static Eguebfs * _eguebfs_req_fs(fuse_req_t req)
+{
+	Eguebfs_Call *call = _eguebfs_call_get();
 
-		return EINA_TRUE;
-	}
-	else
-	{
-		return EINA_FALSE;
-	}
+	if (call)
+		return call->fs;
+	return fuse_req_userdata(req);
 }
 
-static Eina_Bool _eguebfs_file_node_delete(Eguebfs_File *f)
+/* The operation runs on the calling thread as if a worker received it */
+static void _eguebfs_call_begin(Eguebfs *thiz, Eguebfs_Call *call)
 {
-	Egueb_Dom_Node_Type type;
-
-	type = egueb_dom_node_type_get(f->n);
-	switch (type)
-	{
-		case EGUEB_DOM_NODE_TYPE_ELEMENT:
-		{
-			Egueb_Dom_Node *parent;
-			parent = egueb_dom_node_parent_get(f->n);
-			egueb_dom_node_child_remove(parent,
-					egueb_dom_node_ref(f->n), NULL);
-			egueb_dom_node_unref(parent);
-		}
-		break;
+	memset(call, 0, sizeof(Eguebfs_Call));
+	call->fs = thiz;
+	eina_tls_set(_eguebfs_call_key, call);
+}
 
-		default:
-		return EINA_FALSE;
-	}
-	return EINA_TRUE;
+static int _eguebfs_call_end(Eguebfs_Call *call)
+{
+	eina_tls_set(_eguebfs_call_key, NULL);
+	return call->err;
 }
 
-static Eina_Bool _eguebfs_file_node_find(Eguebfs_File *f, const char *p)
+/* Every reply ends the operation being counted, if any. The reply of a call
+ * is kept on the call
+ */
+static int _eguebfs_reply_err(fuse_req_t req, int err)
 {
-	Egueb_Dom_Node_Type type;
+	Eguebfs_Call *call = _eguebfs_call_get();
 
-	type = egueb_dom_node_type_get(f->n);
-	switch (type)
+	eguebfs_stats_op_end(err, 0);
+	if (call)
 	{
-		/* only topmost element */
-		case EGUEB_DOM_NODE_TYPE_DOCUMENT:
-		{
-			Egueb_Dom_Node *topmost;
-			Egueb_Dom_String *name;
-			topmost = egueb_dom_document_document_element_get(f->n);
-			if (!topmost)
-			{
-				return EINA_FALSE;
-			}
-			name = egueb_dom_node_name_get(topmost);
-			if (!strcmp(egueb_dom_string_chars_get(name), p))
-			{
-				egueb_dom_node_unref(f->n);
-				f->n = topmost;
-			}
-			else
-			{
-				egueb_dom_node_unref(topmost);
-				return EINA_FALSE;
-			}
-		}
-		break;
-
-		/* only attributes or child nodes */
-		case EGUEB_DOM_NODE_TYPE_ELEMENT:
-		{
-			char *real_name;
-			int depth;
-
-			if (_eguebfs_name_is_element(p, &real_name, &depth))
-			{
-				Egueb_Dom_Node *child;
-				Egueb_Dom_Node *found = NULL;
-				Eina_Bool ret = EINA_FALSE;
-				int count = 0;
-
-				child = egueb_dom_node_child_first_get(f->n);
-				while (child)
-				{
-					Egueb_Dom_Node *tmp;
-					Egueb_Dom_String *name;
-
-					name = egueb_dom_node_name_get(child);
-					if (!strcmp(egueb_dom_string_chars_get(name), real_name))
-					{
-						count++;
-						if (count == depth)
-						{
-							found = child;
-							ret = EINA_TRUE;
-							break;
-						}
-					}
-					
-					tmp = egueb_dom_node_sibling_next_get(child);
-					egueb_dom_node_unref(child);
-					child = tmp;
-				}
-				free(real_name);
-				egueb_dom_node_unref(f->n);
-				f->n = found;
-				return ret;
-			}
-			else
-			{
-				Egueb_Dom_Node *attr;
-				Egueb_Dom_String *attr_name;
-
-				attr_name = egueb_dom_string_new_with_chars(p);
-				/* check if it is an attribute */
-				attr = egueb_dom_element_attribute_node_get(f->n, attr_name);
-				egueb_dom_string_unref(attr_name);
-				if (!attr)
-				{
-					return EINA_FALSE;
-				}
-				egueb_dom_node_unref(f->n);
-				f->n = attr;
-			}
-		}
-		break;
-
-		/* only final, base, anim, styled */
-		case EGUEB_DOM_NODE_TYPE_ATTRIBUTE:
-		if (!strcmp(p, "base"))
-			f->type = EGUEBFS_FILE_TYPE_ATTR_BASE;
-		else if (!strcmp(p, "anim") && egueb_dom_attr_is_animatable(f->n))
-			f->type = EGUEBFS_FILE_TYPE_ATTR_ANIM;
-		else if (!strcmp(p, "styled") && egueb_dom_attr_is_stylable(f->n))
-			f->type = EGUEBFS_FILE_TYPE_ATTR_STYLED;
-		else if (!strcmp(p, "final"))
-			f->type = EGUEBFS_FILE_TYPE_ATTR_FINAL;
-		else
-			return EINA_FALSE;
-		break;
-
-		default:
-		return EINA_FALSE;
-		break;
-
+		call->err = err;
+		return 0;
 	}
-	return EINA_TRUE;
+	return fuse_reply_err(req, err);
 }
 
-static void _eguebfs_file_node_list(Eguebfs_File *f, void *buf, fuse_fill_dir_t filler)
+static void _eguebfs_reply_none(fuse_req_t req)
 {
-	Egueb_Dom_Node_Type type;
-	type = egueb_dom_node_type_get(f->n);
-	switch (type)
-	{
-		case EGUEB_DOM_NODE_TYPE_DOCUMENT:
-		{
-			Egueb_Dom_Node *topmost;
-			topmost = egueb_dom_document_document_element_get(f->n);
-			if (topmost)
-			{
-				Egueb_Dom_String *name;
-				name = egueb_dom_node_name_get(topmost);
-				filler(buf, egueb_dom_string_chars_get(name), NULL, 0);
-				egueb_dom_string_unref(name);
-				egueb_dom_node_unref(topmost);
-			}
-		}
-		break;
+	if (_eguebfs_call_get())
+		return;
+	fuse_reply_none(req);
+}
 
-		case EGUEB_DOM_NODE_TYPE_ELEMENT:
-		{
-			Egueb_Dom_Node *child;
-			Egueb_Dom_Node_Map_Named *attrs;
-			Eina_Hash *repetitions;
-			int i;
-
-			/* add every children */
-			child = egueb_dom_node_child_first_get(f->n);
-			repetitions = eina_hash_string_superfast_new(free);
-			while (child)
-			{
-				Egueb_Dom_Node *tmp;
-				Egueb_Dom_String *name;
-				char *final_name;
-				int *count;
-
-				name = egueb_dom_node_name_get(child);
-				count = eina_hash_find(repetitions, egueb_dom_string_chars_get(name));
-				if (!count)
-				{
-					count = malloc(sizeof(int));
-					*count = 1;
-					eina_hash_add(repetitions, egueb_dom_string_chars_get(name), count);
-				}
-				else
-				{
-					*count = *count + 1;
-				}
-				if (asprintf(&final_name, "%s@%d", egueb_dom_string_chars_get(name), *count) < 0)
-					continue;
-				filler(buf, final_name, NULL, 0);
-				free(final_name);
-
-				/* next child */
-				tmp = egueb_dom_node_sibling_next_get(child);
-				egueb_dom_node_unref(child);
-				child = tmp;
-			}
-			eina_hash_free(repetitions);
-			/* add every attribute */
-			attrs = egueb_dom_node_attributes_get(f->n);
-			for (i = 0; i < egueb_dom_node_map_named_length(attrs); i++)
-			{
-				Egueb_Dom_Node *attr;
-				Egueb_Dom_String *name;
+/* The buffer of a call is as big as the size requested */
+static int _eguebfs_reply_buf(fuse_req_t req, const char *buf, size_t size)
+{
+	Eguebfs_Call *call = _eguebfs_call_get();
 
-				attr = egueb_dom_node_map_named_at(attrs, i);
-				name = egueb_dom_node_name_get(attr);
-				filler(buf, egueb_dom_string_chars_get(name), NULL, 0);
-			}
-			egueb_dom_node_map_named_unref(attrs);
-		}
-		break;
+	eguebfs_stats_op_end(0, size);
+	if (call)
+	{
+		if (call->buf && size)
+			memcpy(call->buf, buf, size);
+		call->size = size;
+		return 0;
+	}
+	return fuse_reply_buf(req, buf, size);
+}
 
-		case EGUEB_DOM_NODE_TYPE_ATTRIBUTE:
-		{
-			filler(buf, "base", NULL, 0);
-			filler(buf, "final", NULL, 0);
-			if (egueb_dom_attr_is_stylable(f->n))
-				filler(buf, "styled", NULL, 0);
-			if (egueb_dom_attr_is_animatable(f->n))
-				filler(buf, "anim", NULL, 0);
-		}
-		break;
+static int _eguebfs_reply_attr(fuse_req_t req, const struct stat *st,
+		double timeout)
+{
+	Eguebfs_Call *call = _eguebfs_call_get();
 
-		default:
-		break;
+	eguebfs_stats_op_end(0, 0);
+	if (call)
+	{
+		call->st = *st;
+		return 0;
 	}
+	return fuse_reply_attr(req, st, timeout);
 }
 
-static Eina_Bool _eguebfs_file_find(Egueb_Dom_Node *doc, const char *path,
-		Eguebfs_File *f)
+static int _eguebfs_reply_open(fuse_req_t req, const struct fuse_file_info *fi)
 {
-	Eina_Bool ret = EINA_TRUE;
-	Eina_Array *split;
-	Eina_Iterator *it;
-	const char *p;
-	char *npath;
-
-	npath = strdup(path);
-	f->type = EGUEBFS_FILE_TYPE_NODE;
-	f->n = egueb_dom_node_ref(doc);
-	split = eina_file_split(npath);
-	it = eina_array_iterator_new(split);
-	while (eina_iterator_next(it, (void **)&p))
-	{
-		switch (f->type)
-		{
-			case EGUEBFS_FILE_TYPE_NODE:
-			ret = _eguebfs_file_node_find(f, p);
-			if (!ret)
-				goto done;
-			break;
+	eguebfs_stats_op_end(0, 0);
+	if (_eguebfs_call_get())
+		return 0;
+	return fuse_reply_open(req, fi);
+}
 
-			case EGUEBFS_FILE_TYPE_ATTR_BASE:
-			case EGUEBFS_FILE_TYPE_ATTR_ANIM:
-			case EGUEBFS_FILE_TYPE_ATTR_STYLED:
-			case EGUEBFS_FILE_TYPE_ATTR_FINAL:
-			/* no child files */
-			ret = EINA_FALSE;
-			break;
-		}
-	}
-done:
-	if (!ret)
+static int _eguebfs_reply_write(fuse_req_t req, size_t count)
+{
+	Eguebfs_Call *call = _eguebfs_call_get();
+
+	eguebfs_stats_op_end(0, count);
+	if (call)
 	{
-		egueb_dom_node_unref(f->n);
+		call->size = count;
+		return 0;
 	}
-	eina_iterator_free(it);
-	eina_array_free(split);
-	free(npath);
-	return ret;
+	return fuse_reply_write(req, count);
 }
-/*----------------------------------------------------------------------------*
- *                              Thread interface                              *
- *----------------------------------------------------------------------------*/
-static void * _eguebfs_thread_main(void *data, Eina_Thread t)
-{
-	Eguebfs *thiz = data;
 
-	fuse_loop(thiz->fuse);
-	return NULL;
+static int _eguebfs_reply_buf_limited(fuse_req_t req, const char *buf,
+		size_t bufsize, off_t off, size_t maxsize)
+{
+	if (off < bufsize)
+		return _eguebfs_reply_buf(req, buf + off,
+				bufsize - off < maxsize ? bufsize - off : maxsize);
+	else
+		return _eguebfs_reply_buf(req, NULL, 0);
 }
-/*----------------------------------------------------------------------------*
- *                               FUSE interface                               *
- *----------------------------------------------------------------------------*/
-static int _eguebfs_readlink(const char *path, char *buf, size_t size)
+
+static void _eguebfs_generation_increment(Eguebfs_Document *d)
 {
-	ERR("readlink %s", path);
-	return 0;
+	/* zero is the generation of the base lengths */
+	if (!++d->generation)
+		d->generation++;
 }
 
-static int _eguebfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-		off_t offset, struct fuse_file_info *fi)
+static void _eguebfs_document_free(Eguebfs_Document *d)
 {
-	Eguebfs *thiz;
-	Eguebfs_File f = { 0 };
-	struct fuse_context *ctx;
+	eguebfs_events_free(d->events);
+	eguebfs_xml_free(d->xml);
+	eguebfs_cache_free(d->cache);
+	eguebfs_index_free(d->index);
+	eina_lock_free(&d->lock);
+	egueb_dom_node_unref(d->doc);
+	free(d->name);
+	free(d);
+}
 
-	ctx = fuse_get_context();
-	thiz = ctx->private_data;
+static void _eguebfs_document_unref(Eguebfs *thiz, Eguebfs_Document *d)
+{
+	Eina_Bool last;
 
-	DBG("readdir %s", path);
-	if (!_eguebfs_file_find(thiz->doc, path, &f))
-		return -ENOENT;
+	eina_lock_take(&thiz->lock);
+	last = !--d->ref;
+	eina_lock_release(&thiz->lock);
+	if (last)
+		_eguebfs_document_free(d);
+}
 
-	/* default files */
-	filler(buf, ".", NULL, 0);
-	filler(buf, "..", NULL, 0);
+/* Get an inode and a reference to the document it belongs to. The root of
+ * a multiple document mount belongs to none. The inode is only valid once
+ * the document is locked, see _eguebfs_document_take()
+ */
+static Eguebfs_Document * _eguebfs_document_get(Eguebfs *thiz, fuse_ino_t ino,
+		Eguebfs_Inode **inode)
+{
+	Eguebfs_Document *d = NULL;
 
-	switch (f.type)
+	eina_lock_take(&thiz->lock);
+	*inode = eguebfs_inodes_get(thiz->inodes, ino);
+	if (*inode && (*inode)->owner)
 	{
-		case EGUEBFS_FILE_TYPE_NODE:
-		_eguebfs_file_node_list(&f, buf, filler);
-		break;
-
-		default:
-		break;
+		d = (*inode)->owner;
+		d->ref++;
 	}
-	egueb_dom_node_unref(f.n);
+	eina_lock_release(&thiz->lock);
 
-	return 0;
+	return d;
 }
 
-static int _eguebfs_getattr(const char *path, struct stat *stbuf)
+/* Get a reference to the document of a directory at the root */
+static Eguebfs_Document * _eguebfs_document_find(Eguebfs *thiz,
+		const char *name)
 {
-	Eguebfs *thiz;
-	Eguebfs_File f = { 0 };
-	Egueb_Dom_String *value;
-	Eina_Bool fetched;
-	struct fuse_context *ctx;
-	int ret = 0;
-
-	ctx = fuse_get_context();
-	thiz = ctx->private_data;
+	Eguebfs_Document *d;
 
-	DBG("getattr %s", path);
-	if (!_eguebfs_file_find(thiz->doc, path, &f))
-	{
-		WRN("No file '%s' found", path);
-		return -ENOENT;
-	}
+	eina_lock_take(&thiz->lock);
+	d = eina_hash_find(thiz->names, name);
+	if (d)
+		d->ref++;
+	eina_lock_release(&thiz->lock);
 
-	memset(stbuf, 0, sizeof(struct stat));
-	switch (f.type)
-	{
-		case EGUEBFS_FILE_TYPE_NODE:
-		{
-			Egueb_Dom_Node_Type type;
-			type = egueb_dom_node_type_get(f.n);
-			switch (type)
-			{
-				case EGUEB_DOM_NODE_TYPE_DOCUMENT:
-				case EGUEB_DOM_NODE_TYPE_ELEMENT:
-				case EGUEB_DOM_NODE_TYPE_ATTRIBUTE:
-				stbuf->st_mode = S_IFDIR | 0755;
-				stbuf->st_nlink = 2;
-				break;
+	return d;
+}
 
-				case EGUEB_DOM_NODE_TYPE_TEXT:
-				case EGUEB_DOM_NODE_TYPE_CDATA_SECTION:
-				stbuf->st_mode = S_IFREG | 0644;
-				stbuf->st_nlink = 1;
-				stbuf->st_size = egueb_dom_character_data_length_get(f.n);
-				break;
+/* Lock the document, fails once the document has been removed. Egueb
+ * references its nodes and strings without any atomic operation and even
+ * the getters reference what they return, so any access to the nodes needs
+ * the document for itself, the requests that only read it too
+ */
+static Eina_Bool _eguebfs_document_take(Eguebfs_Document *d)
+{
+	eina_lock_take(&d->lock);
+	if (!d->removed)
+		return EINA_TRUE;
+	eina_lock_release(&d->lock);
+	return EINA_FALSE;
+}
 
-				default:
-				ERR("Unsupported node type '%d'", type);
-				ret = -ENOENT;
-				break;
-			}
-		}
-		break;
+/* List the stats file and the documents of a multiple document mount. The
+ * documents are not locked, so their entries have no file
+ */
+static void _eguebfs_documents_list(Eguebfs *thiz, off_t offset,
+		Eguebfs_File_Filler filler, void *data)
+{
+	const char *names[] = { ".", "..", EGUEBFS_FILE_STATS };
+	Eguebfs_File stats = { EGUEBFS_FILE_TYPE_STATS, NULL };
+	Eguebfs_Document *d;
+	off_t i = 3;
 
-		case EGUEBFS_FILE_TYPE_ATTR_BASE:
-		fetched = egueb_dom_attr_string_get(f.n, EGUEB_DOM_ATTR_TYPE_BASE, &value);
-		stbuf->st_mode = S_IFREG | 0644;
-		stbuf->st_nlink = 1;
-		if (fetched && egueb_dom_string_is_valid(value))
-		{
-			const char *content = egueb_dom_string_chars_get(value);
-			stbuf->st_size = strlen(content);
-			egueb_dom_string_unref(value);
-		}
-		break;
+	for (; offset < 3; offset++)
+	{
+		if (!filler(data, names[offset], offset == 2 ? &stats : NULL,
+				offset + 1))
+			return;
+	}
+	eina_lock_take(&thiz->lock);
+	EINA_INLIST_FOREACH(thiz->documents, d)
+	{
+		if (i++ < offset)
+			continue;
+		if (!filler(data, d->name, NULL, i))
+			break;
+	}
+	eina_lock_release(&thiz->lock);
+}
 
-		case EGUEBFS_FILE_TYPE_ATTR_ANIM:
-		fetched = egueb_dom_attr_string_get(f.n, EGUEB_DOM_ATTR_TYPE_ANIMATED, &value);
-		stbuf->st_mode = S_IFREG | 0644;
-		stbuf->st_nlink = 1;
-		if (fetched && egueb_dom_string_is_valid(value))
-		{
-			const char *content = egueb_dom_string_chars_get(value);
-			stbuf->st_size = strlen(content);
-			egueb_dom_string_unref(value);
-		}
-		break;
+static Eina_Bool _eguebfs_inode_stat(Eguebfs *thiz, Eguebfs_Document *d,
+		Eguebfs_Inode *inode, struct stat *st)
+{
+	memset(st, 0, sizeof(struct stat));
+	if (!eguebfs_file_stat(&inode->f, st))
+		return EINA_FALSE;
+	st->st_ino = inode->ino;
+	/* converting an attribute value to know its length is expensive. The
+	 * base value only changes with a mutation of its attribute, which
+	 * drops the length, the rest change with anything on the document
+	 */
+	if (inode->f.type >= EGUEBFS_FILE_TYPE_ATTR_BASE &&
+			inode->f.type <= EGUEBFS_FILE_TYPE_ATTR_FINAL)
+	{
+		unsigned int generation = 0;
 
-		case EGUEBFS_FILE_TYPE_ATTR_STYLED:
-		fetched = egueb_dom_attr_string_get(f.n, EGUEB_DOM_ATTR_TYPE_STYLED, &value);
-		stbuf->st_mode = S_IFREG | 0644;
-		stbuf->st_nlink = 1;
-		if (fetched && egueb_dom_string_is_valid(value))
+		if (inode->f.type != EGUEBFS_FILE_TYPE_ATTR_BASE)
+			generation = d->generation;
+		if (!eguebfs_inodes_length_get(thiz->inodes, inode,
+				generation, &st->st_size))
 		{
-			const char *content = egueb_dom_string_chars_get(value);
-			stbuf->st_size = strlen(content);
-			egueb_dom_string_unref(value);
+			st->st_size = eguebfs_file_length_get(&inode->f);
+			eguebfs_inodes_length_set(thiz->inodes, inode,
+					generation, st->st_size);
+			eguebfs_stats_length_cache(EINA_FALSE);
 		}
-		break;
-
-		case EGUEBFS_FILE_TYPE_ATTR_FINAL:
-		fetched = egueb_dom_attr_final_string_get(f.n, &value);
-		stbuf->st_mode = S_IFREG | 0444;
-		stbuf->st_nlink = 1;
-		if (fetched && egueb_dom_string_is_valid(value))
+		else
 		{
-			const char *content = egueb_dom_string_chars_get(value);
-			stbuf->st_size = strlen(content);
-			egueb_dom_string_unref(value);
+			eguebfs_stats_length_cache(EINA_TRUE);
 		}
-		break;
+		eguebfs_inodes_computed_add(thiz->inodes, inode);
 	}
-	egueb_dom_node_unref(f.n);
-	return ret;
+	else if (inode->f.type == EGUEBFS_FILE_TYPE_XML)
+	{
+		st->st_size = eguebfs_xml_length_get(d->xml, inode->f.n);
+	}
+	return EINA_TRUE;
 }
 
-static int _eguebfs_open(const char *path, struct fuse_file_info *fi)
+/* Get the attributes of an entry of a listing. The kernel fills the inode
+ * of the dirent with the one of the attributes and readdir() skips the
+ * entries of inode zero, so an entry the kernel has not looked up gets a
+ * placeholder, like the high level API of libfuse does. The entries without
+ * file are the dots and the documents, all of them directories
+ */
+static void _eguebfs_dirbuf_attr_get(Eguebfs_Dirbuf *b, Eguebfs_File *f,
+		struct stat *st)
 {
-	Eguebfs *thiz;
-	Eguebfs_File f = { 0 };
-	struct fuse_context *ctx;
-
-	ctx = fuse_get_context();
-	thiz = ctx->private_data;
-
-	DBG("open %s", path);
-	if (!_eguebfs_file_find(thiz->doc, path, &f))
-		return -ENOENT;
-
-	egueb_dom_node_unref(f.n);
-	return 0;
+	fuse_ino_t ino = 0;
+
+	memset(st, 0, sizeof(struct stat));
+	if (!f)
+		st->st_mode = S_IFDIR | 0755;
+	else if (eguebfs_file_stat(f, st))
+		ino = eguebfs_inodes_find(b->fs->inodes, f->n, f->type);
+	st->st_ino = ino ? ino : EGUEBFS_INO_UNKNOWN;
 }
 
-static int _eguebfs_read(const char *path, char *buf, size_t size, off_t offset,
-		struct fuse_file_info *fi)
+/* Add an entry to a listing. A plain listing only has the type of the
+ * entry, a listing plus has the inode and the attributes of the entry too,
+ * as if it was looked up, so the kernel does not need to look it up and get
+ * its attributes afterwards. The kernel takes a lookup of every entry
+ * received, so it is only done once the entry is known to fit
+ */
+static Eina_Bool _eguebfs_dirbuf_add(void *data, const char *name,
+		Eguebfs_File *f, off_t next)
 {
-	Eguebfs *thiz;
-	Eguebfs_File f = { 0 };
-	Egueb_Dom_String *value = NULL;
-	Eina_Bool fetched = EINA_FALSE;
-	struct fuse_context *ctx;
-
-	ctx = fuse_get_context();
-	thiz = ctx->private_data;
-
-	DBG("read %s", path);
-	if (!_eguebfs_file_find(thiz->doc, path, &f))
-		return -ENOENT;
-
-	switch (f.type)
+	Eguebfs_Dirbuf *b = data;
+	struct fuse_entry_param e;
+	Eguebfs_Inode *inode;
+	Eguebfs_File child;
+	size_t len;
+
+	if (b->call && b->call->filler)
+		return b->call->filler(b->call->data, name, next);
+	memset(&e, 0, sizeof(struct fuse_entry_param));
+	if (!b->plus)
 	{
-		case EGUEBFS_FILE_TYPE_NODE:
-		{
-			Egueb_Dom_Node_Type type;
-			type = egueb_dom_node_type_get(f.n);
-			switch (type)
-			{
-				case EGUEB_DOM_NODE_TYPE_TEXT:
-				case EGUEB_DOM_NODE_TYPE_CDATA_SECTION:
-				value = egueb_dom_character_data_data_get(f.n);
-				fetched = EINA_TRUE;
-				break;
-
-				default:
-				ERR("Unsupported node type '%d'", type);
-				break;
-			}
-		}
-		break;
-
-		case EGUEBFS_FILE_TYPE_ATTR_BASE:
-		fetched = egueb_dom_attr_string_get(f.n, EGUEB_DOM_ATTR_TYPE_BASE, &value);
-		break;
-
-		case EGUEBFS_FILE_TYPE_ATTR_ANIM:
-		fetched = egueb_dom_attr_string_get(f.n, EGUEB_DOM_ATTR_TYPE_ANIMATED, &value);
-		break;
-
-		case EGUEBFS_FILE_TYPE_ATTR_STYLED:
-		fetched = egueb_dom_attr_string_get(f.n, EGUEB_DOM_ATTR_TYPE_STYLED, &value);
-		break;
-
-		case EGUEBFS_FILE_TYPE_ATTR_FINAL:
-		fetched = egueb_dom_attr_final_string_get(f.n, &value);
-		break;
+		_eguebfs_dirbuf_attr_get(b, f, &e.attr);
+		len = fuse_add_direntry(b->req, b->p + b->size,
+				b->max - b->size, name, &e.attr, next);
+		if (len > b->max - b->size)
+			return EINA_FALSE;
+		b->size += len;
+		return EINA_TRUE;
 	}
 
-	if (fetched)
+	len = fuse_add_direntry_plus(b->req, NULL, 0, name, &e, next);
+	if (len > b->max - b->size)
+		return EINA_FALSE;
+	/* an entry without inode is looked up by the kernel if needed, its
+	 * dirent still needs one
+	 */
+	if (f)
 	{
-		const char *content = egueb_dom_string_chars_get(value);
-		size_t len;
-
-		len = strlen(content);
-		if (offset < len)
+		child.type = f->type;
+		child.n = f->n ? egueb_dom_node_ref(f->n) : NULL;
+		inode = eguebfs_inodes_lookup(b->fs->inodes, &child, b->d);
+		if (_eguebfs_inode_stat(b->fs, b->d, inode, &e.attr))
 		{
-			if (offset + size > len)
-				size = len - offset;
-			memcpy(buf, content + offset, size);
-		} 
+			e.ino = inode->ino;
+			e.attr_timeout = b->fs->attr_timeout;
+			e.entry_timeout = b->fs->entry_timeout;
+		}
 		else
 		{
-			size = 0;
+			eguebfs_inodes_forget(b->fs->inodes, inode->ino, 1);
+			_eguebfs_dirbuf_attr_get(b, f, &e.attr);
 		}
-		egueb_dom_string_unref(value);
 	}
 	else
 	{
-		size = 0;
+		_eguebfs_dirbuf_attr_get(b, NULL, &e.attr);
 	}
-	egueb_dom_node_unref(f.n);
-	return size;
+	fuse_add_direntry_plus(b->req, b->p + b->size, b->max - b->size, name,
+			&e, next);
+	b->size += len;
+	return EINA_TRUE;
 }
 
-static int _eguebfs_write(const char *path, const char *buf, size_t size, off_t offset,
-		struct fuse_file_info *fi)
+/* Reply with a new entry for a file of a locked document, the file reference
+ * is stolen
+ */
+static void _eguebfs_reply_entry(Eguebfs *thiz, Eguebfs_Document *d,
+		fuse_req_t req, Eguebfs_File *f)
 {
-	Eguebfs *thiz;
-	Eguebfs_File f = { 0 };
-	Egueb_Dom_String *value = NULL;
-	Eina_Bool written = EINA_FALSE;
-	struct fuse_context *ctx;
+	struct fuse_entry_param e;
+	Eguebfs_Call *call;
+	Eguebfs_Inode *inode;
 
-	ctx = fuse_get_context();
-	thiz = ctx->private_data;
+	memset(&e, 0, sizeof(struct fuse_entry_param));
+	inode = eguebfs_inodes_lookup(thiz->inodes, f, d);
+	if (!_eguebfs_inode_stat(thiz, d, inode, &e.attr))
+	{
+		eguebfs_inodes_forget(thiz->inodes, inode->ino, 1);
+		_eguebfs_reply_err(req, ENOENT);
+		return;
+	}
+	e.ino = inode->ino;
+	e.attr_timeout = thiz->attr_timeout;
+	e.entry_timeout = thiz->entry_timeout;
+	eguebfs_stats_op_end(0, 0);
+	call = _eguebfs_call_get();
+	if (call)
+	{
+		call->ino = e.ino;
+		call->st = e.attr;
+		return;
+	}
+	fuse_reply_entry(req, &e);
+}
 
-	DBG("write %s", path);
-	if (!_eguebfs_file_find(thiz->doc, path, &f))
-		return -ENOENT;
+/* The handle keeps the document reference of the request */
+static Eguebfs_Handle * _eguebfs_handle_new(Eguebfs_Document *d,
+		Eguebfs_File *f)
+{
+	Eguebfs_Handle *h;
 
-	switch (f.type)
-	{
-		case EGUEBFS_FILE_TYPE_NODE:
-		{
-			Egueb_Dom_Node_Type type;
-			type = egueb_dom_node_type_get(f.n);
-			switch (type)
-			{
-				case EGUEB_DOM_NODE_TYPE_TEXT:
-				case EGUEB_DOM_NODE_TYPE_CDATA_SECTION:
-				value = egueb_dom_string_new_with_length(buf, size);
-				egueb_dom_character_data_data_delete(f.n, 0, -1, NULL);
-				egueb_dom_character_data_data_append(f.n, value, NULL);
-				written = EINA_TRUE;
-				break;
+	h = calloc(1, sizeof(Eguebfs_Handle));
+	h->d = d;
+	h->f.type = f->type;
+	h->f.n = f->n ? egueb_dom_node_ref(f->n) : NULL;
+	eina_lock_new(&h->lock);
 
-				default:
-				ERR("Unsupported node type '%d'", type);
-				break;
+	return h;
+}
+
+/* Change the length of the snapshot, the new bytes are zeroed. Fails if
+ * there is no memory for it, the snapshot is kept as it is then
+ */
+static Eina_Bool _eguebfs_handle_length_set(Eguebfs_Handle *h, size_t length)
+{
+	if (length >= h->size)
+	{
+		size_t size = h->size ? h->size : 4096;
+		char *snapshot;
+
+		while (size <= length)
+		{
+			if (size > SIZE_MAX / 2)
+				return EINA_FALSE;
+			size *= 2;
+		}
+		snapshot = realloc(h->snapshot, size);
+		if (!snapshot)
+			return EINA_FALSE;
+		h->snapshot = snapshot;
+		h->size = size;
+	}
+	if (length > h->length)
+		memset(h->snapshot + h->length, 0, length - h->length);
+	h->length = length;
+	h->has_snapshot = EINA_TRUE;
+	return EINA_TRUE;
+}
+
+/* Must be called with the document locked. Fails if there is no memory for
+ * the snapshot
+ */
+static Eina_Bool _eguebfs_handle_snapshot_take(Eguebfs_Handle *h)
+{
+	Eguebfs_Document *d = h->d;
+	Egueb_Dom_String *value;
+
+	h->length = 0;
+	if (h->f.type == EGUEBFS_FILE_TYPE_PROGRESS)
+	{
+		char progress[64];
+		size_t parsed = 0;
+		size_t total = 0;
+		int length;
+
+		/* the percentage, the bytes parsed and the size of the file */
+		if (d->lazy)
+			eguebfs_lazy_progress_get(d->lazy, &parsed, &total);
+		length = snprintf(progress, sizeof(progress), "%d %zu %zu\n",
+				total ? (int)(parsed * 100 / total) : 100,
+				parsed, total);
+		if (!_eguebfs_handle_length_set(h, length))
+			return EINA_FALSE;
+		memcpy(h->snapshot, progress, length);
+		return EINA_TRUE;
+	}
+	if (h->f.type == EGUEBFS_FILE_TYPE_XML)
+	{
+		if (!_eguebfs_handle_length_set(h,
+				eguebfs_xml_length_get(d->xml, h->f.n)))
+			return EINA_FALSE;
+		eguebfs_xml_copy(d->xml, h->f.n, h->snapshot, h->length);
+		return EINA_TRUE;
+	}
+
+	/* strings never change, so the value is kept as it is */
+	value = eguebfs_file_value_get(&h->f);
+	if (h->value)
+		egueb_dom_string_unref(h->value);
+	h->value = value;
+	if (value)
+		h->length = strlen(egueb_dom_string_chars_get(value));
+	h->has_snapshot = EINA_TRUE;
+	h->ranged = eguebfs_inodes_modified_get(d->fs->inodes, &h->f,
+			&h->modified);
+	h->base = h->length;
+	return EINA_TRUE;
+}
+
+/* Check if the value is still the one the snapshot was taken from */
+static Eina_Bool _eguebfs_handle_current(Eguebfs_Handle *h)
+{
+	unsigned int modified;
+
+	if (!eguebfs_inodes_modified_get(h->d->fs->inodes, &h->f, &modified))
+		return EINA_FALSE;
+	return modified == h->modified;
+}
+
+/* Add a modified range of the snapshot. Once bytes are added or removed,
+ * everything from the first of them to the end is modified
+ */
+static void _eguebfs_handle_dirty_add(Eguebfs_Handle *h, size_t start,
+		size_t end)
+{
+	if (!h->dirty)
+	{
+		h->start = start;
+		h->end = end;
+		h->resized = EINA_FALSE;
+		h->dirty = EINA_TRUE;
+	}
+	else
+	{
+		if (start < h->start)
+			h->start = start;
+		if (end > h->end)
+			h->end = end;
+	}
+	if (h->length != h->base)
+	{
+		size_t shortest = h->length < h->base ? h->length : h->base;
+
+		if (shortest < h->start)
+			h->start = shortest;
+		h->resized = EINA_TRUE;
+	}
+}
+
+static const char * _eguebfs_handle_content_get(Eguebfs_Handle *h)
+{
+	if (h->value)
+		return egueb_dom_string_chars_get(h->value);
+	return h->snapshot;
+}
+
+/* Copy the value before it is written, the value is unreferenced with the
+ * document locked. Fails if there is no memory for the copy
+ */
+static Eina_Bool _eguebfs_handle_value_copy(Eguebfs_Handle *h)
+{
+	Egueb_Dom_String *value = h->value;
+	size_t length = h->length;
+
+	if (!value)
+		return EINA_TRUE;
+	h->length = 0;
+	if (!_eguebfs_handle_length_set(h, length))
+	{
+		h->length = length;
+		return EINA_FALSE;
+	}
+	h->value = NULL;
+	memcpy(h->snapshot, egueb_dom_string_chars_get(value), length);
+	eina_lock_take(&h->d->lock);
+	egueb_dom_string_unref(value);
+	eina_lock_release(&h->d->lock);
+	return EINA_TRUE;
+}
+
+/* Take the snapshot with the document locked. Returns zero or the error of
+ * the request, the document might have been removed or there might be no
+ * memory for the snapshot. The counters are not part of any document
+ */
+static int _eguebfs_handle_snapshot_update(Eguebfs *thiz, Eguebfs_Handle *h)
+{
+	Eina_Bool ret;
+
+	if (h->f.type == EGUEBFS_FILE_TYPE_STATS)
+	{
+		Eguebfs_Stats s;
+		Eina_Strbuf *buf;
+
+		eguebfs_stats_collector_get(thiz->stats, &s);
+		buf = eina_strbuf_new();
+		eguebfs_stats_format(&s, buf);
+		ret = _eguebfs_handle_length_set(h, eina_strbuf_length_get(buf));
+		if (ret)
+		{
+			memcpy(h->snapshot, eina_strbuf_string_get(buf),
+					h->length);
+		}
+		eina_strbuf_free(buf);
+		return ret ? 0 : ENOMEM;
+	}
+	if (!_eguebfs_document_take(h->d))
+		return ENOENT;
+	ret = _eguebfs_handle_snapshot_take(h);
+	eina_lock_release(&h->d->lock);
+	return ret ? 0 : ENOMEM;
+}
+
+/* Apply the batch written on the handle, its content is replaced with the
+ * report of the failing lines
+ */
+static Eina_Bool _eguebfs_handle_batch_apply(Eguebfs_Handle *h)
+{
+	Eina_Strbuf *report;
+	Eina_Bool ret;
+	size_t length;
+
+	report = eina_strbuf_new();
+	ret = eguebfs_batch_apply(h->d->cache, h->snapshot, h->length, report);
+	length = eina_strbuf_length_get(report);
+	/* without memory for the report only the failure is known */
+	if (_eguebfs_handle_length_set(h, length))
+		memcpy(h->snapshot, eina_strbuf_string_get(report), length);
+	else
+		h->length = 0;
+	eina_strbuf_free(report);
+
+	return ret;
+}
+
+/* Set only the modified range of a character data value, so the cost is
+ * the one of the modification and not the one of the whole value. The
+ * range is only known while nothing else has modified the node, but
+ * whatever was appended is appended anyway. Must be called with the
+ * document locked
+ */
+static Eina_Bool _eguebfs_handle_range_commit(Eguebfs_Handle *h)
+{
+	size_t count;
+	size_t end;
+
+	if (!h->ranged)
+		return EINA_FALSE;
+	if (h->append && h->start >= h->base)
+		return eguebfs_file_range_set(&h->f, -1, 0,
+				h->snapshot + h->base, h->length - h->base);
+	if (!_eguebfs_handle_current(h))
+		return EINA_FALSE;
+	if (h->resized)
+	{
+		count = h->base - h->start;
+		end = h->length;
+	}
+	else
+	{
+		count = h->end - h->start;
+		end = h->end;
+	}
+	return eguebfs_file_range_set(&h->f, h->start, count,
+			h->snapshot + h->start, end - h->start);
+}
+
+/* Set the pending writes on the document, they are lost if the document
+ * has been removed
+ */
+static Eina_Bool _eguebfs_handle_commit(Eguebfs_Handle *h)
+{
+	Eina_Bool ret = EINA_TRUE;
+
+	eina_lock_take(&h->lock);
+	if (h->dirty)
+	{
+		if (!_eguebfs_document_take(h->d))
+		{
+			ret = EINA_FALSE;
+		}
+		else
+		{
+			if (h->f.type == EGUEBFS_FILE_TYPE_BATCH)
+			{
+				ret = _eguebfs_handle_batch_apply(h);
+			}
+			else
+			{
+				Eina_Bool current;
+
+				current = h->ranged &&
+						_eguebfs_handle_current(h);
+				if (!_eguebfs_handle_range_commit(h))
+				{
+					ret = eguebfs_file_value_set(&h->f,
+							h->snapshot, h->length);
+					current = EINA_TRUE;
+				}
+				/* the snapshot is the value now, unless it was
+				 * appended to a value modified by others
+				 */
+				h->base = h->length;
+				if (current)
+				{
+					h->ranged = eguebfs_inodes_modified_get(
+							h->d->fs->inodes,
+							&h->f, &h->modified);
+				}
 			}
+			eina_lock_release(&h->d->lock);
 		}
-		break;
+		h->dirty = EINA_FALSE;
+	}
+	eina_lock_release(&h->lock);
 
-		case EGUEBFS_FILE_TYPE_ATTR_FINAL:
-		break;
+	return ret;
+}
+
+static void _eguebfs_handle_free(Eguebfs *thiz, Eguebfs_Handle *h)
+{
+	Eguebfs_Document *d = h->d;
+
+	if (h->reader)
+		eguebfs_events_reader_free(d->events, h->reader);
+	free(h->snapshot);
+	eina_lock_free(&h->lock);
+	if (d)
+	{
+		/* the node is unreferenced with the document locked */
+		eina_lock_take(&d->lock);
+		if (h->value)
+			egueb_dom_string_unref(h->value);
+		egueb_dom_node_unref(h->f.n);
+		eina_lock_release(&d->lock);
+		_eguebfs_document_unref(thiz, d);
+	}
+	free(h);
+}
+
+/* The node of an inode is unreferenced with the document locked */
+static void _eguebfs_inode_forget(Eguebfs *thiz, fuse_ino_t ino,
+		uint64_t nlookup)
+{
+	Eguebfs_Document *d;
+	Eguebfs_Inode *inode;
+
+	d = _eguebfs_document_get(thiz, ino, &inode);
+	/* the files at the root of several documents have no node */
+	if (!d)
+	{
+		if (inode)
+			eguebfs_inodes_forget(thiz->inodes, ino, nlookup);
+		return;
+	}
+	if (_eguebfs_document_take(d))
+	{
+		eguebfs_inodes_forget(thiz->inodes, ino, nlookup);
+		eina_lock_release(&d->lock);
+	}
+	_eguebfs_document_unref(thiz, d);
+}
+/*----------------------------------------------------------------------------*
+ *                              Event interface                               *
+ *----------------------------------------------------------------------------*/
+/* The document is only modified with the document lock taken.
+ * Besides increasing the generation, the kernel is told to forget whatever
+ * it has cached of the modified files
+ */
+static void _eguebfs_node_mutation_cb(Egueb_Dom_Event *ev, void *data)
+{
+	Eguebfs_Document *d = data;
+	Egueb_Dom_Node *parent;
+
+	_eguebfs_generation_increment(d);
+	/* the siblings of the children of an element are handled by the
+	 * index, only the topmost element is listed without it
+	 */
+	parent = egueb_dom_event_mutation_related_get(ev);
+	if (parent == d->doc)
+	{
+		fuse_ino_t ino;
+
+		ino = eguebfs_inodes_find(d->fs->inodes, d->doc,
+				EGUEBFS_FILE_TYPE_NODE);
+		if (ino)
+		{
+			Egueb_Dom_Node *target;
+			Egueb_Dom_String *name;
+
+			target = eguebfs_event_target_node_get(ev);
+			name = egueb_dom_node_name_get(target);
+			eguebfs_notifier_entry_add(d->fs->notifier, ino,
+					egueb_dom_string_chars_get(name));
+			egueb_dom_string_unref(name);
+			egueb_dom_node_unref(target);
+		}
+	}
+	if (parent)
+		egueb_dom_node_unref(parent);
+}
+
+static void _eguebfs_attr_mutation_cb(Egueb_Dom_Event *ev, void *data)
+{
+	Eguebfs_Document *d = data;
+	Eguebfs *thiz = d->fs;
+	Egueb_Dom_Node *attr;
+	int i;
+
+	_eguebfs_generation_increment(d);
+	attr = egueb_dom_event_mutation_related_get(ev);
+	if (!attr)
+		return;
+
+	for (i = 0; i < EGUEBFS_ATTR_FILES; i++)
+	{
+		fuse_ino_t ino;
+
+		ino = eguebfs_inodes_find(thiz->inodes, attr,
+				EGUEBFS_FILE_TYPE_ATTR_BASE + i);
+		if (!ino)
+			continue;
+		eguebfs_inodes_length_drop(thiz->inodes, ino);
+		eguebfs_notifier_inode_add(thiz->notifier, ino);
+	}
+	/* the attribute directory appears or disappears */
+	if (egueb_dom_event_mutation_attr_modification_type_get(ev) !=
+			EGUEB_DOM_EVENT_MUTATION_ATTR_TYPE_MODIFICATION)
+	{
+		Egueb_Dom_Node *target;
+		fuse_ino_t ino;
+
+		target = eguebfs_event_target_node_get(ev);
+		ino = eguebfs_inodes_find(thiz->inodes, target,
+				EGUEBFS_FILE_TYPE_NODE);
+		if (ino)
+		{
+			Egueb_Dom_String *name;
+
+			name = egueb_dom_node_name_get(attr);
+			eguebfs_notifier_entry_add(thiz->notifier, ino,
+					egueb_dom_string_chars_get(name));
+			egueb_dom_string_unref(name);
+		}
+		egueb_dom_node_unref(target);
+	}
+	egueb_dom_node_unref(attr);
+}
+
+static void _eguebfs_character_data_mutation_cb(Egueb_Dom_Event *ev,
+		void *data)
+{
+	Eguebfs_Document *d = data;
+	Egueb_Dom_Node *target;
+	fuse_ino_t ino;
+
+	_eguebfs_generation_increment(d);
+	target = eguebfs_event_target_node_get(ev);
+	ino = eguebfs_inodes_find(d->fs->inodes, target,
+			EGUEBFS_FILE_TYPE_NODE);
+	if (ino)
+	{
+		eguebfs_inodes_modified_add(d->fs->inodes, ino);
+		eguebfs_notifier_inode_add(d->fs->notifier, ino);
+	}
+	egueb_dom_node_unref(target);
+}
+
+/* A child is going to be named differently */
+static void _eguebfs_index_changed_cb(void *data, Egueb_Dom_Node *n,
+		const char *name, int nth, Egueb_Dom_Node *child)
+{
+	Eguebfs_Document *d = data;
+	Eguebfs *thiz = d->fs;
+	fuse_ino_t parent;
+	char *final_name;
+
+	/* the kernel only has an entry if it has the inode */
+	if (!eguebfs_inodes_find(thiz->inodes, child, EGUEBFS_FILE_TYPE_NODE))
+		return;
+	parent = eguebfs_inodes_find(thiz->inodes, n, EGUEBFS_FILE_TYPE_NODE);
+	if (!parent)
+		return;
+	if (asprintf(&final_name, "%s@%d", name, nth) < 0)
+		return;
+	eguebfs_notifier_entry_add(thiz->notifier, parent, final_name);
+	free(final_name);
+}
+
+/* The serialization of an element has changed */
+static void _eguebfs_xml_invalidated_cb(void *data, Egueb_Dom_Node *n)
+{
+	Eguebfs_Document *d = data;
+	fuse_ino_t ino;
+
+	ino = eguebfs_inodes_find(d->fs->inodes, n, EGUEBFS_FILE_TYPE_XML);
+	if (ino)
+		eguebfs_notifier_inode_add(d->fs->notifier, ino);
+}
+
+/* Called from the saver thread, a removed document is still saved */
+static char * _eguebfs_save_serialize_cb(void *data, size_t *length)
+{
+	Eguebfs_Document *d = data;
+	Egueb_Dom_Node *topmost;
+	size_t declaration;
+	char *ret;
+
+	eina_lock_take(&d->lock);
+	topmost = egueb_dom_document_document_element_get(d->doc);
+	if (!topmost)
+	{
+		eina_lock_release(&d->lock);
+		return NULL;
+	}
+	declaration = strlen(EGUEBFS_XML_DECLARATION);
+	*length = declaration + eguebfs_xml_length_get(d->xml, topmost);
+	ret = malloc(*length + 1);
+	memcpy(ret, EGUEBFS_XML_DECLARATION, declaration);
+	eguebfs_xml_copy(d->xml, topmost, ret + declaration,
+			*length - declaration);
+	egueb_dom_node_unref(topmost);
+	eina_lock_release(&d->lock);
+	ret[*length] = '\n';
+	*length += 1;
+
+	return ret;
+}
+
+/* The attribute files of an element are known by their attribute node */
+static Eina_Bool _eguebfs_lazy_busy_cb(void *data, Egueb_Dom_Node *n)
+{
+	Eguebfs_Document *d = data;
+	Eguebfs *thiz = d->fs;
+	Egueb_Dom_Node_Map_Named *attrs;
+	Eina_Bool ret = EINA_FALSE;
+	int length;
+	int i;
+
+	if (egueb_dom_node_type_get(n) != EGUEB_DOM_NODE_TYPE_ELEMENT)
+		return EINA_FALSE;
+	if (eguebfs_inodes_find(thiz->inodes, n, EGUEBFS_FILE_TYPE_NODE) ||
+			eguebfs_inodes_find(thiz->inodes, n, EGUEBFS_FILE_TYPE_XML))
+		return EINA_TRUE;
+
+	attrs = egueb_dom_node_attributes_get(n);
+	length = egueb_dom_node_map_named_length(attrs);
+	for (i = 0; i < length && !ret; i++)
+	{
+		Egueb_Dom_Node *attr;
+		int type;
+
+		attr = egueb_dom_node_map_named_at(attrs, i);
+		for (type = EGUEBFS_FILE_TYPE_NODE;
+				type <= EGUEBFS_FILE_TYPE_ATTR_FINAL; type++)
+		{
+			if (eguebfs_inodes_find(thiz->inodes, attr, type))
+			{
+				ret = EINA_TRUE;
+				break;
+			}
+		}
+		egueb_dom_node_unref(attr);
+	}
+	egueb_dom_node_map_named_unref(attrs);
+
+	return ret;
+}
+
+static void _eguebfs_lazy_evicted_cb(void *data, Egueb_Dom_Node *n)
+{
+	Eguebfs_Document *d = data;
+
+	eguebfs_index_drop(d->index, n);
+	eguebfs_cache_children_drop(d->cache, n);
+	eguebfs_xml_children_drop(d->xml, n);
+}
+
+/* Called from the lazy thread, neither loading nor evicting is a change of
+ * the document
+ */
+static void _eguebfs_lazy_lock_cb(void *data, Eina_Bool lock)
+{
+	Eguebfs_Document *d = data;
+
+	if (lock)
+		eina_lock_take(&d->lock);
+	else
+		eina_lock_release(&d->lock);
+}
+
+static void _eguebfs_computed_invalidate_cb(void *data, fuse_ino_t ino)
+{
+	Eguebfs *thiz = data;
+
+	eguebfs_notifier_inode_add(thiz->notifier, ino);
+}
+
+static void _eguebfs_document_listeners_add(Eguebfs_Document *d)
+{
+	Egueb_Dom_Event_Target *et;
+
+	et = EGUEB_DOM_EVENT_TARGET(d->doc);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_INSERTED,
+			_eguebfs_node_mutation_cb, EINA_FALSE, d);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_REMOVED,
+			_eguebfs_node_mutation_cb, EINA_FALSE, d);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_ATTR_MODIFIED,
+			_eguebfs_attr_mutation_cb, EINA_FALSE, d);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_CHARACTER_DATA_MODIFIED,
+			_eguebfs_character_data_mutation_cb, EINA_FALSE, d);
+}
+
+static void _eguebfs_document_listeners_remove(Eguebfs_Document *d)
+{
+	Egueb_Dom_Event_Target *et;
+
+	et = EGUEB_DOM_EVENT_TARGET(d->doc);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_INSERTED,
+			_eguebfs_node_mutation_cb, EINA_FALSE, d);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_REMOVED,
+			_eguebfs_node_mutation_cb, EINA_FALSE, d);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_ATTR_MODIFIED,
+			_eguebfs_attr_mutation_cb, EINA_FALSE, d);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_CHARACTER_DATA_MODIFIED,
+			_eguebfs_character_data_mutation_cb, EINA_FALSE, d);
+}
+
+/* The document reference is stolen, the lazy document is owned */
+static Eguebfs_Document * _eguebfs_document_new(Eguebfs *thiz,
+		const char *name, Egueb_Dom_Node *doc, Eguebfs_Lazy *lazy)
+{
+	Eguebfs_Document *d;
+
+	d = calloc(1, sizeof(Eguebfs_Document));
+	d->fs = thiz;
+	d->name = name ? strdup(name) : NULL;
+	d->doc = doc;
+	d->lazy = lazy;
+	d->ref = 1;
+	d->generation = 1;
+	eina_lock_new(&d->lock);
+	d->index = eguebfs_index_new(doc, lazy, _eguebfs_index_changed_cb, d);
+	d->cache = eguebfs_cache_new(doc, d->index);
+	d->events = eguebfs_events_new(doc, d->index);
+	d->xml = eguebfs_xml_new(doc, lazy, thiz->xml_budget,
+			_eguebfs_xml_invalidated_cb, d);
+
+	return d;
+}
+
+/* Start tracking the changes of the document, the inodes of the session
+ * must exist already
+ */
+static void _eguebfs_document_start(Eguebfs_Document *d,
+		const char *save_path)
+{
+	Eguebfs *thiz = d->fs;
+
+	if (save_path)
+	{
+		d->saver = eguebfs_saver_new(d->doc, save_path,
+				thiz->save_delay, _eguebfs_save_serialize_cb,
+				d);
+		if (!d->saver)
+			WRN("Changes will not be saved to '%s'", save_path);
+	}
+	_eguebfs_document_listeners_add(d);
+	if (d->lazy && (thiz->lazy_budget || thiz->lazy_load))
+	{
+		if (thiz->lazy_budget && thiz->lazy_load)
+			WRN("The document will not be loaded on the background");
+		if (!eguebfs_lazy_start(d->lazy, thiz->lazy_budget,
+				thiz->lazy_load, _eguebfs_lazy_busy_cb,
+				_eguebfs_lazy_evicted_cb, _eguebfs_lazy_lock_cb,
+				d))
+			WRN("The document will only be parsed when walked");
+	}
+}
+
+/* The pending changes are saved, so the document must not be locked */
+static void _eguebfs_document_stop(Eguebfs_Document *d)
+{
+	_eguebfs_document_listeners_remove(d);
+	if (d->saver)
+		eguebfs_saver_free(d->saver);
+	if (d->lazy)
+		eguebfs_lazy_free(d->lazy);
+}
+
+/* Take the document out of the filesystem. The requests in flight and the
+ * open files fail from now on, the document is freed once the last of them
+ * is done with it
+ */
+static void _eguebfs_document_remove(Eguebfs *thiz, Eguebfs_Document *d)
+{
+	eina_lock_take(&d->lock);
+	eina_lock_take(&thiz->lock);
+	d->removed = EINA_TRUE;
+	if (d->name)
+	{
+		eina_hash_del(thiz->names, d->name, d);
+		thiz->documents = eina_inlist_remove(thiz->documents,
+				EINA_INLIST_GET(d));
+	}
+	eguebfs_inodes_owner_drop(thiz->inodes, d);
+	eina_lock_release(&thiz->lock);
+	eina_lock_release(&d->lock);
+
+	_eguebfs_document_stop(d);
+	_eguebfs_document_unref(thiz, d);
+}
+
+/* The directory name of a document can not be confused with anything else */
+static Eina_Bool _eguebfs_document_name_is_valid(const char *name)
+{
+	if (!name || !*name || strchr(name, '/'))
+		return EINA_FALSE;
+	if (!strcmp(name, ".") || !strcmp(name, ".."))
+		return EINA_FALSE;
+	return EINA_TRUE;
+}
+
+static Eguebfs_Document * _eguebfs_document_add(Eguebfs *thiz,
+		const char *name, Egueb_Dom_Node *doc, Eguebfs_Lazy *lazy,
+		const char *save_path)
+{
+	Eguebfs_Document *d;
+
+	if (!thiz->names || !_eguebfs_document_name_is_valid(name))
+	{
+		ERR("Can not add a document named '%s'", name ? name : "");
+		goto no_name;
+	}
+
+	d = _eguebfs_document_new(thiz, name, doc, lazy);
+	_eguebfs_document_start(d, save_path);
+	eina_lock_take(&thiz->lock);
+	if (eina_hash_find(thiz->names, name))
+	{
+		eina_lock_release(&thiz->lock);
+		ERR("A document named '%s' already exists", name);
+		_eguebfs_document_stop(d);
+		_eguebfs_document_free(d);
+		return NULL;
+	}
+	eina_hash_add(thiz->names, d->name, d);
+	thiz->documents = eina_inlist_append(thiz->documents,
+			EINA_INLIST_GET(d));
+	eina_lock_release(&thiz->lock);
+	/* the kernel might remember there was nothing with that name */
+	eguebfs_notifier_entry_add(thiz->notifier, FUSE_ROOT_ID, name);
+
+	return d;
+
+no_name:
+	if (lazy)
+		eguebfs_lazy_free(lazy);
+	egueb_dom_node_unref(doc);
+	return NULL;
+}
+/*----------------------------------------------------------------------------*
+ *                              Thread interface                              *
+ *----------------------------------------------------------------------------*/
+static void * _eguebfs_worker_main(void *data, Eina_Thread t)
+{
+	Eguebfs *thiz = data;
+	struct fuse_buf buf;
+
+	eguebfs_stats_collector_thread_set(thiz->stats);
+	memset(&buf, 0, sizeof(struct fuse_buf));
+	while (!fuse_session_exited(thiz->session))
+	{
+		int res;
+
+		res = fuse_session_receive_buf(thiz->session, &buf);
+		if (res == -EINTR)
+			continue;
+		if (res <= 0)
+		{
+			/* let the rest of the workers know */
+			if (res < 0)
+				fuse_session_exit(thiz->session);
+			break;
+		}
+		fuse_session_process_buf(thiz->session, &buf);
+	}
+	free(buf.mem);
+	eguebfs_stats_collector_thread_set(NULL);
+	return NULL;
+}
+/*----------------------------------------------------------------------------*
+ *                               FUSE interface                               *
+ *----------------------------------------------------------------------------*/
+/* Every request locks the document of its inode for itself, even the ones
+ * that only read it, see _eguebfs_document_take(). Requests on different
+ * documents and the replies still run in parallel on every worker
+ */
+static void _eguebfs_lookup(fuse_req_t req, fuse_ino_t parent,
+		const char *name)
+{
+	Eguebfs *thiz = _eguebfs_req_fs(req);
+	Eguebfs_Document *d;
+	Eguebfs_Inode *inode;
+	Eguebfs_File f;
+
+	DBG("lookup %s on %" PRIu64, name, parent);
+	eguebfs_stats_op_begin(EGUEBFS_STATS_OP_LOOKUP);
+	d = _eguebfs_document_get(thiz, parent, &inode);
+	/* a directory at the root of a multiple document mount */
+	if (!d && inode)
+	{
+		if (!strcmp(name, EGUEBFS_FILE_STATS))
+		{
+			f.type = EGUEBFS_FILE_TYPE_STATS;
+			f.n = NULL;
+			_eguebfs_reply_entry(thiz, NULL, req, &f);
+			return;
+		}
+		d = _eguebfs_document_find(thiz, name);
+		if (!d)
+		{
+			_eguebfs_reply_err(req, ENOENT);
+			return;
+		}
+		if (!_eguebfs_document_take(d))
+		{
+			_eguebfs_reply_err(req, ENOENT);
+			goto unref;
+		}
+		f.type = EGUEBFS_FILE_TYPE_NODE;
+		f.n = egueb_dom_node_ref(d->doc);
+		_eguebfs_reply_entry(thiz, d, req, &f);
+		goto done;
+	}
+	if (!d || !_eguebfs_document_take(d))
+	{
+		_eguebfs_reply_err(req, ENOENT);
+		goto unref;
+	}
+	if (inode->f.type != EGUEBFS_FILE_TYPE_NODE)
+	{
+		_eguebfs_reply_err(req, ENOENT);
+		goto done;
+	}
+
+	f.type = inode->f.type;
+	f.n = egueb_dom_node_ref(inode->f.n);
+	if (!eguebfs_file_step(&f, d->index, name))
+	{
+		egueb_dom_node_unref(f.n);
+		_eguebfs_reply_err(req, ENOENT);
+		goto done;
+	}
+	_eguebfs_reply_entry(thiz, d, req, &f);
+done:
+	eina_lock_release(&d->lock);
+unref:
+	if (d)
+		_eguebfs_document_unref(thiz, d);
+}
+
+static void _eguebfs_forget(fuse_req_t req, fuse_ino_t ino,
+		uint64_t nlookup)
+{
+	Eguebfs *thiz = _eguebfs_req_fs(req);
+
+	DBG("forget %" PRIu64, ino);
+	_eguebfs_inode_forget(thiz, ino, nlookup);
+	_eguebfs_reply_none(req);
+}
+
+static void _eguebfs_forget_multi(fuse_req_t req, size_t count,
+		struct fuse_forget_data *forgets)
+{
+	Eguebfs *thiz = _eguebfs_req_fs(req);
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		_eguebfs_inode_forget(thiz, forgets[i].ino,
+				forgets[i].nlookup);
+	_eguebfs_reply_none(req);
+}
+
+static void _eguebfs_opendir(fuse_req_t req, fuse_ino_t ino,
+		struct fuse_file_info *fi)
+{
+	Eguebfs *thiz = _eguebfs_req_fs(req);
+	Eguebfs_Document *d;
+	Eguebfs_Inode *inode;
+	Eguebfs_File_Type type;
+
+	DBG("opendir %" PRIu64, ino);
+	d = _eguebfs_document_get(thiz, ino, &inode);
+	if (!inode)
+	{
+		_eguebfs_reply_err(req, ENOENT);
+		return;
+	}
+	type = inode->f.type;
+	if (d)
+		_eguebfs_document_unref(thiz, d);
+	if (type != EGUEBFS_FILE_TYPE_NODE &&
+			type != EGUEBFS_FILE_TYPE_DOCUMENTS)
+	{
+		_eguebfs_reply_err(req, ENOTDIR);
+		return;
+	}
+
+	/* the listing position of this handle */
+	fi->fh = (uintptr_t)calloc(1, sizeof(Eguebfs_File_Cursor));
+	_eguebfs_reply_open(req, fi);
+}
+
+static void _eguebfs_releasedir(fuse_req_t req, fuse_ino_t ino,
+		struct fuse_file_info *fi)
+{
+	Eguebfs_File_Cursor *c = (Eguebfs_File_Cursor *)(uintptr_t)fi->fh;
+
+	eguebfs_file_cursor_reset(c);
+	free(c);
+	_eguebfs_reply_err(req, 0);
+}
+
+/* The kernel serializes the readdir calls of a handle, so the cursor is
+ * never used concurrently. A listing plus is the same listing with every
+ * entry looked up on the way
+ */
+static void _eguebfs_dir_list(fuse_req_t req, fuse_ino_t ino, size_t size,
+		off_t offset, struct fuse_file_info *fi, Eina_Bool plus)
+{
+	Eguebfs *thiz = _eguebfs_req_fs(req);
+	Eguebfs_File_Cursor *c = (Eguebfs_File_Cursor *)(uintptr_t)fi->fh;
+	Eguebfs_Document *d;
+	Eguebfs_Inode *inode;
+	Eguebfs_Dirbuf b;
+	Eguebfs_Scratch_Mark m;
+
+	DBG("readdir %" PRIu64 " at %" PRId64, ino, (int64_t)offset);
+	eguebfs_stats_op_begin(EGUEBFS_STATS_OP_READDIR);
+	d = _eguebfs_document_get(thiz, ino, &inode);
+	if (!inode || (d && !_eguebfs_document_take(d)))
+	{
+		_eguebfs_reply_err(req, ENOENT);
+		goto unref;
+	}
+
+	eguebfs_scratch_mark(&m);
+	b.fs = thiz;
+	b.d = d;
+	b.req = req;
+	b.call = _eguebfs_call_get();
+	b.p = eguebfs_scratch_alloc(size);
+	b.size = 0;
+	b.max = size;
+	b.plus = plus;
+	if (d)
+	{
+		eguebfs_file_list(&inode->f, d->index, c, offset,
+				_eguebfs_dirbuf_add, &b);
+		eina_lock_release(&d->lock);
+	}
+	else
+	{
+		_eguebfs_documents_list(thiz, offset, _eguebfs_dirbuf_add, &b);
+	}
+	_eguebfs_reply_buf(req, b.p, b.size);
+	eguebfs_scratch_release(&m);
+unref:
+	if (d)
+		_eguebfs_document_unref(thiz, d);
+}
+
+static void _eguebfs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+		off_t offset, struct fuse_file_info *fi)
+{
+	_eguebfs_dir_list(req, ino, size, offset, fi, EINA_FALSE);
+}
+
+static void _eguebfs_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size,
+		off_t offset, struct fuse_file_info *fi)
+{
+	_eguebfs_dir_list(req, ino, size, offset, fi, EINA_TRUE);
+}
+
+static void _eguebfs_getattr(fuse_req_t req, fuse_ino_t ino,
+		struct fuse_file_info *fi)
+{
+	Eguebfs *thiz = _eguebfs_req_fs(req);
+	Eguebfs_Document *d;
+	Eguebfs_Inode *inode;
+	struct stat st;
+	Eina_Bool found = EINA_FALSE;
+
+	DBG("getattr %" PRIu64, ino);
+	eguebfs_stats_op_begin(EGUEBFS_STATS_OP_GETATTR);
+	d = _eguebfs_document_get(thiz, ino, &inode);
+	if (!d && inode)
+	{
+		found = _eguebfs_inode_stat(thiz, NULL, inode, &st);
+	}
+	else if (d && _eguebfs_document_take(d))
+	{
+		found = _eguebfs_inode_stat(thiz, d, inode, &st);
+		eina_lock_release(&d->lock);
+	}
+	if (d)
+		_eguebfs_document_unref(thiz, d);
+
+	if (!found)
+	{
+		WRN("No file '%" PRIu64 "' found", ino);
+		_eguebfs_reply_err(req, ENOENT);
+		return;
+	}
+	_eguebfs_reply_attr(req, &st, thiz->attr_timeout);
+}
+
+static void _eguebfs_setattr(fuse_req_t req, fuse_ino_t ino,
+		struct stat *attr, int to_set, struct fuse_file_info *fi)
+{
+	Eguebfs *thiz = _eguebfs_req_fs(req);
+	Eguebfs_Document *d;
+	Eguebfs_Inode *inode;
+	struct stat st;
+
+	DBG("setattr %" PRIu64, ino);
+	if (to_set & FUSE_SET_ATTR_SIZE)
+		eguebfs_stats_op_begin(EGUEBFS_STATS_OP_TRUNCATE);
+	/* an ftruncate() comes with the handle, it truncates its copy. As
+	 * with a truncate() of the value, it never grows, zeros are not text
+	 */
+	if (fi && (to_set & FUSE_SET_ATTR_SIZE))
+	{
+		Eguebfs_Handle *h = EGUEBFS_HANDLE(fi);
+		int err = 0;
+
+		eina_lock_take(&h->lock);
+		if (!h->has_snapshot)
+			err = _eguebfs_handle_snapshot_update(thiz, h);
+		if (!err && (size_t)attr->st_size < h->length)
+		{
+			if (!_eguebfs_handle_value_copy(h))
+			{
+				err = ENOMEM;
+			}
+			else
+			{
+				_eguebfs_handle_length_set(h, attr->st_size);
+				_eguebfs_handle_dirty_add(h, attr->st_size,
+						attr->st_size);
+			}
+		}
+		eina_lock_release(&h->lock);
+		if (err)
+		{
+			_eguebfs_reply_err(req, err);
+			return;
+		}
+	}
+
+	d = _eguebfs_document_get(thiz, ino, &inode);
+	if (!d)
+	{
+		_eguebfs_reply_err(req, inode ? EPERM : ENOENT);
+		return;
+	}
+	if (!_eguebfs_document_take(d))
+	{
+		_eguebfs_reply_err(req, ENOENT);
+		goto unref;
+	}
+
+	if (!fi && (to_set & FUSE_SET_ATTR_SIZE))
+	{
+		if (!eguebfs_file_truncate(&inode->f, attr->st_size))
+		{
+			_eguebfs_reply_err(req, EINVAL);
+			goto done;
+		}
+	}
+
+	if (!_eguebfs_inode_stat(thiz, d, inode, &st))
+	{
+		_eguebfs_reply_err(req, ENOENT);
+		goto done;
+	}
+	if (fi && (to_set & FUSE_SET_ATTR_SIZE))
+		st.st_size = attr->st_size;
+	_eguebfs_reply_attr(req, &st, thiz->attr_timeout);
+done:
+	eina_lock_release(&d->lock);
+unref:
+	_eguebfs_document_unref(thiz, d);
+}
+
+static void _eguebfs_open(fuse_req_t req, fuse_ino_t ino,
+		struct fuse_file_info *fi)
+{
+	Eguebfs *thiz = _eguebfs_req_fs(req);
+	Eguebfs_Document *d;
+	Eguebfs_Handle *h;
+	Eguebfs_Inode *inode;
+	struct stat st;
+
+	DBG("open %" PRIu64, ino);
+	eguebfs_stats_op_begin(EGUEBFS_STATS_OP_OPEN);
+	d = _eguebfs_document_get(thiz, ino, &inode);
+	if (!d)
+	{
+		if (!inode || inode->f.type != EGUEBFS_FILE_TYPE_STATS)
+		{
+			_eguebfs_reply_err(req, inode ? EISDIR : ENOENT);
+			return;
+		}
+		if ((fi->flags & O_ACCMODE) != O_RDONLY)
+		{
+			_eguebfs_reply_err(req, EACCES);
+			return;
+		}
+		fi->fh = (uintptr_t)_eguebfs_handle_new(NULL, &inode->f);
+		fi->direct_io = 1;
+		_eguebfs_reply_open(req, fi);
+		return;
+	}
+	if (!_eguebfs_document_take(d))
+	{
+		_eguebfs_reply_err(req, ENOENT);
+		goto unref;
+	}
+	if (!_eguebfs_inode_stat(thiz, d, inode, &st))
+	{
+		_eguebfs_reply_err(req, ENOENT);
+		goto done;
+	}
+	if (S_ISDIR(st.st_mode))
+	{
+		_eguebfs_reply_err(req, EISDIR);
+		goto done;
+	}
+	/* the kernel does not check the permissions by itself */
+	if (!(st.st_mode & S_IWUSR) && (fi->flags & O_ACCMODE) != O_RDONLY)
+	{
+		_eguebfs_reply_err(req, EACCES);
+		goto done;
+	}
+
+	eguebfs_inodes_computed_add(thiz->inodes, inode);
+	/* resolve the file once, the rest of the operations use the handle */
+	h = _eguebfs_handle_new(d, &inode->f);
+	/* a stream, every read gets the next events */
+	if (h->f.type == EGUEBFS_FILE_TYPE_EVENTS)
+	{
+		h->reader = eguebfs_events_reader_new(d->events);
+		fi->direct_io = 1;
+		fi->nonseekable = 1;
+	}
+	/* they change without the kernel being told */
+	if (h->f.type == EGUEBFS_FILE_TYPE_PROGRESS ||
+			h->f.type == EGUEBFS_FILE_TYPE_STATS)
+		fi->direct_io = 1;
+	/* the kernel might send the cached writes through another handle */
+	if (h->f.type == EGUEBFS_FILE_TYPE_BATCH && thiz->writeback_cache)
+		fi->direct_io = 1;
+	h->append = !!(fi->flags & O_APPEND);
+	/* the truncation is set on the document when the file is closed */
+	if (fi->flags & O_TRUNC)
+	{
+		if (!_eguebfs_handle_length_set(h, 0))
+		{
+			eina_lock_release(&d->lock);
+			_eguebfs_reply_err(req, ENOMEM);
+			/* along with the reference of the request */
+			_eguebfs_handle_free(thiz, h);
+			return;
+		}
+		h->dirty = EINA_TRUE;
+	}
+	fi->fh = (uintptr_t)h;
+	_eguebfs_reply_open(req, fi);
+	eina_lock_release(&d->lock);
+	return;
+done:
+	eina_lock_release(&d->lock);
+unref:
+	_eguebfs_document_unref(thiz, d);
+}
+
+static void _eguebfs_read(fuse_req_t req, fuse_ino_t ino, size_t size,
+		off_t offset, struct fuse_file_info *fi)
+{
+	Eguebfs *thiz = _eguebfs_req_fs(req);
+	Eguebfs_Handle *h = EGUEBFS_HANDLE(fi);
+
+	DBG("read %" PRIu64, ino);
+	if (h->reader)
+	{
+		eguebfs_events_read(h->d->events, h->reader, req, size,
+				!!(fi->flags & O_NONBLOCK));
+		return;
+	}
+
+	eguebfs_stats_op_begin(EGUEBFS_STATS_OP_READ);
+	eina_lock_take(&h->lock);
+	/* the content of a control file is only on the handle */
+	if (!h->has_snapshot || (!offset && !h->dirty &&
+			h->f.type != EGUEBFS_FILE_TYPE_BATCH))
+	{
+		int err;
+
+		err = _eguebfs_handle_snapshot_update(thiz, h);
+		if (err)
+		{
+			eina_lock_release(&h->lock);
+			_eguebfs_reply_err(req, err);
+			return;
+		}
+	}
+	_eguebfs_reply_buf_limited(req, _eguebfs_handle_content_get(h),
+			h->length, offset, size);
+	eina_lock_release(&h->lock);
+}
+
+static void _eguebfs_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
+		size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	Eguebfs *thiz = _eguebfs_req_fs(req);
+	Eguebfs_Handle *h = EGUEBFS_HANDLE(fi);
+	int err = 0;
+
+	DBG("write %" PRIu64 " at %" PRId64, ino, (int64_t)offset);
+	eguebfs_stats_op_begin(EGUEBFS_STATS_OP_WRITE);
+	if (h->f.type == EGUEBFS_FILE_TYPE_ATTR_FINAL ||
+			h->f.type == EGUEBFS_FILE_TYPE_EVENTS ||
+			h->f.type == EGUEBFS_FILE_TYPE_PROGRESS ||
+			h->f.type == EGUEBFS_FILE_TYPE_STATS ||
+			h->f.type == EGUEBFS_FILE_TYPE_XML)
+	{
+		_eguebfs_reply_err(req, EACCES);
+		return;
+	}
+
+	eina_lock_take(&h->lock);
+	/* the batch file is a stream of operations, a write after the batch
+	 * has been applied starts a new one
+	 */
+	if (h->f.type == EGUEBFS_FILE_TYPE_BATCH)
+	{
+		if (!h->dirty && !_eguebfs_handle_length_set(h, 0))
+			err = ENOMEM;
+		offset = h->length;
+	}
+	else if (!h->has_snapshot)
+	{
+		err = _eguebfs_handle_snapshot_update(thiz, h);
+	}
+	if (!err && !_eguebfs_handle_value_copy(h))
+		err = ENOMEM;
+	if (err)
+		goto done;
+	/* the kernel might not know the length of the value on the handle */
+	if (h->append)
+		offset = h->length;
+	/* a gap would put zeros on the value, zeros are not text */
+	if ((size_t)offset > h->length)
+	{
+		err = EINVAL;
+		goto done;
+	}
+	if (offset + size > h->length &&
+			!_eguebfs_handle_length_set(h, offset + size))
+	{
+		err = ENOMEM;
+		goto done;
+	}
+	memcpy(h->snapshot + offset, buf, size);
+	_eguebfs_handle_dirty_add(h, offset, offset + size);
+done:
+	eina_lock_release(&h->lock);
+	if (err)
+		_eguebfs_reply_err(req, err);
+	else
+		_eguebfs_reply_write(req, size);
+}
+
+static void _eguebfs_flush(fuse_req_t req, fuse_ino_t ino,
+		struct fuse_file_info *fi)
+{
+	DBG("flush %" PRIu64, ino);
+	eguebfs_stats_op_begin(EGUEBFS_STATS_OP_FLUSH);
+	if (!_eguebfs_handle_commit(EGUEBFS_HANDLE(fi)))
+		_eguebfs_reply_err(req, EINVAL);
+	else
+		_eguebfs_reply_err(req, 0);
+}
+
+static void _eguebfs_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+		struct fuse_file_info *fi)
+{
+	DBG("fsync %" PRIu64, ino);
+	eguebfs_stats_op_begin(EGUEBFS_STATS_OP_FLUSH);
+	if (!_eguebfs_handle_commit(EGUEBFS_HANDLE(fi)))
+		_eguebfs_reply_err(req, EINVAL);
+	else
+		_eguebfs_reply_err(req, 0);
+}
 
-		case EGUEBFS_FILE_TYPE_ATTR_BASE:
-		value = egueb_dom_string_new_with_length(buf, size);
-		written = egueb_dom_attr_string_set(f.n, EGUEB_DOM_ATTR_TYPE_BASE, value);
-		egueb_dom_string_unref(value);
-		break;
+static void _eguebfs_release(fuse_req_t req, fuse_ino_t ino,
+		struct fuse_file_info *fi)
+{
+	Eguebfs *thiz = _eguebfs_req_fs(req);
+	Eguebfs_Handle *h = EGUEBFS_HANDLE(fi);
+
+	DBG("release %" PRIu64, ino);
+	/* the error of a write done here can not be reported */
+	if (!_eguebfs_handle_commit(h))
+		WRN("Fail to set the value of '%" PRIu64 "'", ino);
+	_eguebfs_handle_free(thiz, h);
+	_eguebfs_reply_err(req, 0);
+}
 
-		case EGUEBFS_FILE_TYPE_ATTR_ANIM:
-		value = egueb_dom_string_new_with_length(buf, size);
-		written = egueb_dom_attr_string_set(f.n, EGUEB_DOM_ATTR_TYPE_ANIMATED, value);
-		egueb_dom_string_unref(value);
-		break;
+/* Only the events file waits for something, the rest are always ready */
+static void _eguebfs_poll(fuse_req_t req, fuse_ino_t ino,
+		struct fuse_file_info *fi, struct fuse_pollhandle *ph)
+{
+	Eguebfs_Handle *h = EGUEBFS_HANDLE(fi);
 
-		case EGUEBFS_FILE_TYPE_ATTR_STYLED:
-		value = egueb_dom_string_new_with_length(buf, size);
-		written = egueb_dom_attr_string_set(f.n, EGUEB_DOM_ATTR_TYPE_STYLED, value);
-		egueb_dom_string_unref(value);
-		break;
+	DBG("poll %" PRIu64, ino);
+	if (h->reader)
+	{
+		eguebfs_events_poll(h->d->events, h->reader, req, ph);
+		return;
 	}
-
-	egueb_dom_node_unref(f.n);
-	if (!written)
-		return -EINVAL;
-	else
-		return size;
+	if (ph)
+		fuse_pollhandle_destroy(ph);
+	fuse_reply_poll(req, POLLIN | POLLOUT | POLLRDNORM | POLLWRNORM);
 }
 
-static int _eguebfs_truncate(const char *path, off_t new_length)
+/* The documents of a multiple document mount are only added and removed
+ * through the API
+ */
+static void _eguebfs_mkdir(fuse_req_t req, fuse_ino_t parent,
+		const char *name, mode_t m)
 {
-	Eguebfs *thiz;
-	Eguebfs_File f = { 0 };
-	struct fuse_context *ctx;
-	int ret = -EINVAL;
+	Eguebfs *thiz = _eguebfs_req_fs(req);
+	Eguebfs_Document *d;
+	Eguebfs_Inode *inode;
+	Eguebfs_File f;
+
+	DBG("mkdir %s on %" PRIu64, name, parent);
+	eguebfs_stats_op_begin(EGUEBFS_STATS_OP_MKDIR);
+	d = _eguebfs_document_get(thiz, parent, &inode);
+	if (!d)
+	{
+		_eguebfs_reply_err(req, inode ? EPERM : ENOENT);
+		return;
+	}
+	if (!_eguebfs_document_take(d))
+	{
+		_eguebfs_reply_err(req, ENOENT);
+		goto unref;
+	}
 
-	ctx = fuse_get_context();
-	thiz = ctx->private_data;
+	f.type = EGUEBFS_FILE_TYPE_NODE;
+	f.n = eguebfs_file_child_create(&inode->f, d->index, name);
+	if (!f.n)
+	{
+		_eguebfs_reply_err(req, EINVAL);
+		goto done;
+	}
+	_eguebfs_reply_entry(thiz, d, req, &f);
+done:
+	eina_lock_release(&d->lock);
+unref:
+	_eguebfs_document_unref(thiz, d);
+}
 
-	DBG("truncate %s", path);
+static void _eguebfs_rmdir(fuse_req_t req, fuse_ino_t parent,
+		const char *name)
+{
+	Eguebfs *thiz = _eguebfs_req_fs(req);
+	Eguebfs_Document *d;
+	Eguebfs_Inode *inode;
+	Eguebfs_File f;
+	int ret = EINVAL;
+
+	DBG("rmdir %s on %" PRIu64, name, parent);
+	eguebfs_stats_op_begin(EGUEBFS_STATS_OP_RMDIR);
+	d = _eguebfs_document_get(thiz, parent, &inode);
+	if (!d)
+	{
+		_eguebfs_reply_err(req, inode ? EPERM : ENOENT);
+		return;
+	}
+	if (!_eguebfs_document_take(d))
+	{
+		ret = ENOENT;
+		goto unref;
+	}
+	if (inode->f.type != EGUEBFS_FILE_TYPE_NODE)
+	{
+		ret = ENOENT;
+		goto done;
+	}
 
-	if (!_eguebfs_file_find(thiz->doc, path, &f))
-		return -ENOENT;
+	f.type = inode->f.type;
+	f.n = egueb_dom_node_ref(inode->f.n);
+	if (!eguebfs_file_step(&f, d->index, name))
+	{
+		ret = ENOENT;
+		egueb_dom_node_unref(f.n);
+		goto done;
+	}
 
 	switch (f.type)
 	{
 		case EGUEBFS_FILE_TYPE_NODE:
-		{
-			Egueb_Dom_Node_Type type;
-
-			type = egueb_dom_node_type_get(f.n);
-			switch (type)
-			{
-				case EGUEB_DOM_NODE_TYPE_TEXT:
-				case EGUEB_DOM_NODE_TYPE_CDATA_SECTION:
-				{
-					int length;
-
-					length = egueb_dom_character_data_length_get(f.n);
-					ret = 0;
-					if (new_length < length)
-					{
-						egueb_dom_character_data_data_delete(f.n, 0, length - new_length, NULL);
-					}
-				}
-				break;
-
-				default:
-				ERR("Unsupported node type '%d'", type);
-				break;
-			}
-
-		}
-		break;
-
-		case EGUEBFS_FILE_TYPE_ATTR_BASE:
-		case EGUEBFS_FILE_TYPE_ATTR_ANIM:
-		case EGUEBFS_FILE_TYPE_ATTR_STYLED:
-		ret = 0;
+		if (eguebfs_file_delete(&f))
+			ret = 0;
 		break;
 
 		default:
 		break;
 	}
-
 	egueb_dom_node_unref(f.n);
-	return ret;
+done:
+	eina_lock_release(&d->lock);
+unref:
+	_eguebfs_document_unref(thiz, d);
+	_eguebfs_reply_err(req, ret);
 }
 
-static int _eguebfs_mkdir(const char *path, mode_t m)
+static void _eguebfs_init(void *data, struct fuse_conn_info *conn)
 {
-	Eguebfs *thiz;
-	Eguebfs_File f = { 0 };
-	struct fuse_context *ctx;
-	char *bpath;
-	char *chpath;
-	char *real_name;
-	int depth;
-	int ret = -EINVAL;
-
-	ctx = fuse_get_context();
-	thiz = ctx->private_data;
-
-	DBG("mkdir %s", path);
-	chpath = strrchr(path, '/');
-	if (!chpath)
-		return -EINVAL;
-	bpath = strndup(path, chpath - path);
-	/* get the path before the last path entry */
-	if (!_eguebfs_file_find(thiz->doc, bpath, &f))
-		goto done;
+	Eguebfs *thiz = data;
 
-	if (f.type != EGUEBFS_FILE_TYPE_NODE)
-		goto no_file;
+	DBG("init %p", thiz);
+	/* truncating on open is done on the handle */
+	if (conn->capable & FUSE_CAP_ATOMIC_O_TRUNC)
+		conn->want |= FUSE_CAP_ATOMIC_O_TRUNC;
+	/* the kernel decides when a listing plus is worth it, i.e when the
+	 * entries of a listing are being looked up afterwards
+	 */
+	if (conn->capable & FUSE_CAP_READDIRPLUS)
+		conn->want |= FUSE_CAP_READDIRPLUS;
+	if (conn->capable & FUSE_CAP_READDIRPLUS_AUTO)
+		conn->want |= FUSE_CAP_READDIRPLUS_AUTO;
+	/* the largest write fuse can receive is already negotiated, it can
+	 * only be made smaller. The same for the reads the kernel does ahead
+	 */
+	if (thiz->max_write && thiz->max_write < conn->max_write)
+		conn->max_write = thiz->max_write;
+	if (thiz->max_read && thiz->max_read < conn->max_readahead)
+		conn->max_readahead = thiz->max_read;
+	if (thiz->async_read && (conn->capable & FUSE_CAP_ASYNC_READ))
+		conn->want |= FUSE_CAP_ASYNC_READ;
+	else
+		conn->want &= ~FUSE_CAP_ASYNC_READ;
+	/* the handles need to know if the kernel is keeping the writes */
+	if (thiz->writeback_cache && (conn->capable & FUSE_CAP_WRITEBACK_CACHE))
+		conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+	else
+		thiz->writeback_cache = EINA_FALSE;
+}
 
-	if (egueb_dom_node_type_get(f.n) != EGUEB_DOM_NODE_TYPE_ELEMENT)
-		goto no_file;
+static struct fuse_lowlevel_ops eguebfs_ops = {
+	.init         = _eguebfs_init,
+	.lookup       = _eguebfs_lookup,
+	.forget       = _eguebfs_forget,
+	.forget_multi = _eguebfs_forget_multi,
+	.getattr      = _eguebfs_getattr,
+	.setattr      = _eguebfs_setattr,
+	.opendir      = _eguebfs_opendir,
+	.readdir      = _eguebfs_readdir,
+	.readdirplus  = _eguebfs_readdirplus,
+	.releasedir   = _eguebfs_releasedir,
+	.open         = _eguebfs_open,
+	.read         = _eguebfs_read,
+	.write        = _eguebfs_write,
+	.flush        = _eguebfs_flush,
+	.fsync        = _eguebfs_fsync,
+	.release      = _eguebfs_release,
+	.poll         = _eguebfs_poll,
+	.rmdir        = _eguebfs_rmdir,
+	.mkdir        = _eguebfs_mkdir,
+};
 
-	if (_eguebfs_name_is_element(chpath + 1, &real_name, &depth))
-	{
-		Egueb_Dom_Node *child;
-		int count = 0;
+/* Mount a single document at the root, or an empty root for several
+ * documents if there is no document. Without a mountpoint there is no
+ * session nor workers, the operations are only done with eguebfs_op_*().
+ * The document reference is stolen
+ */
+static Eguebfs * _eguebfs_mount(Egueb_Dom_Node *doc, Eguebfs_Lazy *lazy,
+		const char *to, const Eguebfs_Options *opts)
+{
+	Eguebfs *thiz;
+	struct fuse_args args = FUSE_ARGS_INIT(0, NULL);
+	int workers;
+	int i;
 
-		/* make sure that the child is valid */
-		child = egueb_dom_node_child_first_get(f.n);
-		while (child)
-		{
-			Egueb_Dom_Node *tmp;
-			Egueb_Dom_String *name;
+	if (!opts)
+		goto no_args;
 
-			name = egueb_dom_node_name_get(child);
-			if (!strcmp(egueb_dom_string_chars_get(name), real_name))
-				count++;
-			tmp = egueb_dom_node_sibling_next_get(child);
-			egueb_dom_node_unref(child);
-			child = tmp;
-		}
-		if (depth == count + 1)
+	thiz = calloc(1, sizeof(Eguebfs));
+	thiz->max_read = opts->max_read;
+	thiz->max_write = opts->max_write;
+	thiz->writeback_cache = opts->writeback_cache;
+	thiz->async_read = opts->async_read;
+	if (to)
+	{
+		fuse_opt_add_arg(&args, "eguebfs");
+#if 0
+		fuse_opt_add_arg(&args, "-odebug");
+#endif
+		/* the largest read is a mount option */
+		if (opts->max_read)
 		{
-			Egueb_Dom_String *name;
+			char max_read[32];
 
-			name = egueb_dom_string_new_with_chars(real_name);
-			child = egueb_dom_document_element_create(thiz->doc, name, NULL);
-			if (child)
-			{
-				if (egueb_dom_node_child_append(f.n, child, NULL))
-					ret = 0;
-			}
-			egueb_dom_string_unref(name);
+			snprintf(max_read, sizeof(max_read), "-omax_read=%zu",
+					opts->max_read);
+			fuse_opt_add_arg(&args, max_read);
 		}
-		free(real_name);
+		thiz->mountpoint = strdup(to);
+		thiz->session = fuse_session_new(&args, &eguebfs_ops,
+				sizeof(eguebfs_ops), thiz);
+		fuse_opt_free_args(&args);
+		if (!thiz->session)
+			goto no_session;
+
+		if (fuse_session_mount(thiz->session, to) != 0)
+			goto no_mount;
 	}
 
-no_file:
-	egueb_dom_node_unref(f.n);
-done:
-	free(bpath);
-	return ret;
-}
-
-static int _eguebfs_rmdir(const char *path)
-{
-	Eguebfs *thiz;
-	Eguebfs_File f = { 0 };
-	struct fuse_context *ctx;
-	int ret = -EINVAL;
-
-	ctx = fuse_get_context();
-	thiz = ctx->private_data;
+	thiz->notifier = eguebfs_notifier_new(thiz->session);
+	if (!thiz->notifier)
+		goto no_notifier;
+
+	eina_lock_new(&thiz->lock);
+	thiz->stats = eguebfs_stats_collector_new();
+	thiz->entry_timeout = opts->entry_timeout;
+	thiz->attr_timeout = opts->attr_timeout;
+	thiz->save_delay = opts->save_delay;
+	thiz->lazy_budget = opts->lazy_budget;
+	thiz->lazy_load = opts->lazy_load;
+	thiz->xml_budget = opts->xml_budget;
+	if (doc)
+	{
+		thiz->single = _eguebfs_document_new(thiz, NULL, doc, lazy);
+		thiz->inodes = eguebfs_inodes_new(doc, thiz->single);
+		_eguebfs_document_start(thiz->single, opts->save_path);
+	}
+	else
+	{
+		thiz->names = eina_hash_string_superfast_new(NULL);
+		thiz->inodes = eguebfs_inodes_new(NULL, NULL);
+	}
 
-	DBG("rmdir %s", path);
-	if (!_eguebfs_file_find(thiz->doc, path, &f))
-		return -ENOENT;
+	if (!to)
+		return thiz;
 
-	switch (f.type)
+	/* create the workers and start processing there */
+	workers = opts->workers > 0 ? opts->workers : 1;
+	thiz->workers = calloc(workers, sizeof(Eina_Thread));
+	for (i = 0; i < workers; i++)
 	{
-		case EGUEBFS_FILE_TYPE_NODE:
-		if (_eguebfs_file_node_delete(&f))
-			ret = 0;
-		break;
-
-		default:
-		break;
+		if (!eina_thread_create(&thiz->workers[i], EINA_THREAD_NORMAL,
+				-1, _eguebfs_worker_main, thiz))
+			goto no_thread;
+		thiz->nworkers++;
 	}
-	egueb_dom_node_unref(f.n);
-	return ret;
+	return thiz;
+
+no_thread:
+	eguebfs_umount(thiz);
+	return NULL;
+no_notifier:
+	if (thiz->session)
+		fuse_session_unmount(thiz->session);
+no_mount:
+	if (thiz->session)
+		fuse_session_destroy(thiz->session);
+no_session:
+	free(thiz->mountpoint);
+	free(thiz);
+no_args:
+	if (lazy)
+		eguebfs_lazy_free(lazy);
+	if (doc)
+		egueb_dom_node_unref(doc);
+	return NULL;
 }
 
-static void * _eguebfs_init(struct fuse_conn_info *conn)
+/* Open, list every entry from offset and release the directory. The entries
+ * go to the filler of the call, or to its buffer as the kernel gets them
+ */
+static int _eguebfs_op_dir_list(Eguebfs *thiz, uint64_t ino, off_t offset,
+		Eina_Bool plus, Eguebfs_Op_Filler filler, void *data,
+		char *buf, size_t size, size_t *length)
 {
-	Eguebfs *thiz;
-	struct fuse_context *ctx;
-
-	ctx = fuse_get_context();
-	thiz = ctx->private_data;
-
-	DBG("init %p", thiz);
-	return thiz;
+	struct fuse_file_info fi;
+	Eguebfs_Call call;
+	int err;
+
+	memset(&fi, 0, sizeof(struct fuse_file_info));
+	_eguebfs_call_begin(thiz, &call);
+	_eguebfs_opendir((fuse_req_t)&call, ino, &fi);
+	if (_eguebfs_call_end(&call))
+		return call.err;
+
+	_eguebfs_call_begin(thiz, &call);
+	call.filler = filler;
+	call.data = data;
+	call.buf = buf;
+	_eguebfs_dir_list((fuse_req_t)&call, ino, size, offset, &fi, plus);
+	err = _eguebfs_call_end(&call);
+	if (!err && length)
+		*length = call.size;
+
+	_eguebfs_call_begin(thiz, &call);
+	_eguebfs_releasedir((fuse_req_t)&call, ino, &fi);
+	_eguebfs_call_end(&call);
+
+	return err;
 }
-
-static struct fuse_operations eguebfs_ops = {
-	.getattr  = _eguebfs_getattr,
-	.readlink = _eguebfs_readlink,
-	.readdir  = _eguebfs_readdir,
-	.open     = _eguebfs_open,
-	.read     = _eguebfs_read,
-	.write    = _eguebfs_write,
-	.truncate = _eguebfs_truncate,
-	.init     = _eguebfs_init,
-	.rmdir    = _eguebfs_rmdir,
-	.mkdir    = _eguebfs_mkdir,
-};
 /*============================================================================*
  *                                 Global                                     *
  *============================================================================*/
@@ -899,6 +2196,9 @@ EAPI void eguebfs_init(void)
 	{
 		eina_init();
 		eguebfs_log_dom = eina_log_domain_register("eguebfs", NULL);
+		eina_tls_new(&_eguebfs_call_key);
+		eguebfs_scratch_init();
+		eguebfs_stats_init();
 	}
 }
 
@@ -906,66 +2206,408 @@ EAPI void eguebfs_shutdown(void)
 {
 	if (_init == 1)
 	{
+		eguebfs_stats_shutdown();
+		eguebfs_scratch_shutdown();
+		eina_tls_free(_eguebfs_call_key);
 		eina_log_domain_unregister(eguebfs_log_dom);
 		eina_shutdown();
 	}
 	_init--;
 }
 
+EAPI void eguebfs_options_default_get(Eguebfs_Options *opts)
+{
+	memset(opts, 0, sizeof(Eguebfs_Options));
+	opts->workers = 1;
+	opts->entry_timeout = EGUEBFS_TIMEOUT;
+	opts->attr_timeout = EGUEBFS_TIMEOUT;
+	opts->save_delay = EGUEBFS_SAVE_DELAY;
+	opts->xml_budget = EGUEBFS_XML_BUDGET;
+	opts->async_read = EINA_TRUE;
+}
+
 EAPI Eguebfs * eguebfs_mount(Egueb_Dom_Node *doc, const char *to)
 {
-	Eguebfs *thiz;
-	struct fuse_chan *chan;
-#if 0
-	struct fuse_args args = FUSE_ARGS_INIT(0, NULL);
-#endif
+	Eguebfs_Options opts;
+
+	eguebfs_options_default_get(&opts);
+	return eguebfs_mount_with_options(doc, to, &opts);
+}
 
+EAPI Eguebfs * eguebfs_mount_with_options(Egueb_Dom_Node *doc,
+		const char *to, const Eguebfs_Options *opts)
+{
 	if (!doc)
 		return NULL;
-	if (!to)
-		goto no_chan;
+	return _eguebfs_mount(doc, NULL, to, opts);
+}
 
-	chan = fuse_mount(to, NULL);
-	if (!chan)
-		goto no_chan;
+/* The file is mapped and only parsed as the filesystem is walked, the
+ * document is only reachable through the filesystem
+ */
+EAPI Eguebfs * eguebfs_mount_file(const char *file, const char *to,
+		const Eguebfs_Options *opts)
+{
+	Eguebfs_Lazy *lazy;
 
-#if 0
-	fuse_opt_add_arg(&args, "");
-	fuse_opt_add_arg(&args, "-odebug");
-#endif
+	if (!file)
+		return NULL;
+	lazy = eguebfs_lazy_new(file);
+	if (!lazy)
+		return NULL;
+	return _eguebfs_mount(eguebfs_lazy_document_get(lazy), lazy, to, opts);
+}
 
-	thiz = calloc(1, sizeof(Eguebfs));
-	thiz->doc = doc;
-	thiz->mountpoint = strdup(to);
-	thiz->chan = chan;
-#if 0
-	thiz->fuse = fuse_new(thiz->chan, &args, &eguebfs_ops, sizeof(eguebfs_ops), thiz);
-	fuse_opt_free_args(&args);
-#endif
-	thiz->fuse = fuse_new(thiz->chan, NULL, &eguebfs_ops, sizeof(eguebfs_ops), thiz);
+/* The save_path of the options is not used, every document tells where it
+ * is saved when added
+ */
+EAPI Eguebfs * eguebfs_mount_documents(const char *to,
+		const Eguebfs_Options *opts)
+{
+	return _eguebfs_mount(NULL, NULL, to, opts);
+}
 
-	/* create the thread and start processing there */
-	if (!eina_thread_create(&thiz->thread, EINA_THREAD_NORMAL, -1,
-			_eguebfs_thread_main, thiz))
-		goto no_thread;
-	return thiz;
+EAPI void eguebfs_umount(Eguebfs *thiz)
+{
+	int i;
 
-no_thread:
-	fuse_unmount(thiz->mountpoint, thiz->chan);
-	fuse_destroy(thiz->fuse);
+	if (thiz->session)
+	{
+		fuse_session_exit(thiz->session);
+		fuse_session_unmount(thiz->session);
+	}
+	for (i = 0; i < thiz->nworkers; i++)
+		eina_thread_join(thiz->workers[i]);
+	free(thiz->workers);
+	if (thiz->single)
+		_eguebfs_document_remove(thiz, thiz->single);
+	while (thiz->documents)
+		_eguebfs_document_remove(thiz, EINA_INLIST_CONTAINER_GET(
+				thiz->documents, Eguebfs_Document));
+	eguebfs_notifier_free(thiz->notifier);
+	if (thiz->session)
+		fuse_session_destroy(thiz->session);
+	eguebfs_inodes_free(thiz->inodes);
+	if (thiz->names)
+		eina_hash_free(thiz->names);
+	eguebfs_stats_collector_free(thiz->stats);
+	eina_lock_free(&thiz->lock);
 	free(thiz->mountpoint);
 	free(thiz);
-no_chan:
-	egueb_dom_node_unref(doc);
-	return NULL;
 }
 
-EAPI void eguebfs_umount(Eguebfs *thiz)
+/* Only for a single document mount, the documents of a multiple document
+ * mount are locked one by one with eguebfs_document_lock()
+ */
+EAPI void eguebfs_lock(Eguebfs *thiz)
 {
-	fuse_unmount(thiz->mountpoint, thiz->chan);
-	fuse_destroy(thiz->fuse);
-	eina_thread_join(thiz->thread);
-	egueb_dom_node_unref(thiz->doc);
-	free(thiz->mountpoint);
-	free(thiz);
+	if (!thiz->single)
+	{
+		ERR("Locking a mount of several documents");
+		return;
+	}
+	eguebfs_document_lock(thiz->single);
+}
+
+EAPI void eguebfs_unlock(Eguebfs *thiz)
+{
+	if (!thiz->single)
+		return;
+	eguebfs_document_unlock(thiz->single);
+}
+
+EAPI void eguebfs_changed(Eguebfs *thiz)
+{
+	if (!thiz->single)
+	{
+		ERR("Changing a mount of several documents");
+		return;
+	}
+	eguebfs_document_changed(thiz->single);
+}
+
+/* Add a document under the directory name at the root of a mount done with
+ * eguebfs_mount_documents(). The document reference is stolen. The returned
+ * document is owned by the mount, it is valid until it is removed or the
+ * mount is unmounted
+ */
+EAPI Eguebfs_Document * eguebfs_document_add(Eguebfs *thiz, const char *name,
+		Egueb_Dom_Node *doc, const char *save_path)
+{
+	if (!doc)
+		return NULL;
+	return _eguebfs_document_add(thiz, name, doc, NULL, save_path);
+}
+
+/* Like eguebfs_mount_file(), the file is only parsed as it is walked */
+EAPI Eguebfs_Document * eguebfs_document_add_file(Eguebfs *thiz,
+		const char *name, const char *file, const char *save_path)
+{
+	Eguebfs_Lazy *lazy;
+
+	if (!file)
+		return NULL;
+	lazy = eguebfs_lazy_new(file);
+	if (!lazy)
+		return NULL;
+	return _eguebfs_document_add(thiz, name,
+			eguebfs_lazy_document_get(lazy), lazy, save_path);
+}
+
+/* The pending changes are saved, so the document must not be locked. The
+ * document of a single document mount is only removed on unmount
+ */
+EAPI void eguebfs_document_remove(Eguebfs_Document *d)
+{
+	Eguebfs *thiz = d->fs;
+	char *name;
+
+	if (!d->name)
+	{
+		ERR("Removing the document of a single document mount");
+		return;
+	}
+	name = strdup(d->name);
+	_eguebfs_document_remove(thiz, d);
+	eguebfs_notifier_entry_add(thiz->notifier, FUSE_ROOT_ID, name);
+	free(name);
+}
+
+EAPI void eguebfs_stats_get(Eguebfs *thiz, Eguebfs_Stats *stats)
+{
+	eguebfs_stats_collector_get(thiz->stats, stats);
+}
+
+EAPI void eguebfs_document_lock(Eguebfs_Document *d)
+{
+	eina_lock_take(&d->lock);
+}
+
+EAPI void eguebfs_document_unlock(Eguebfs_Document *d)
+{
+	eina_lock_release(&d->lock);
+}
+
+/* Animations and the processing of the document change the animated, styled
+ * and final values without any mutation event. Only the lengths of those
+ * and the ones the kernel has seen are dropped
+ */
+EAPI void eguebfs_document_changed(Eguebfs_Document *d)
+{
+	_eguebfs_generation_increment(d);
+	eguebfs_inodes_computed_flush(d->fs->inodes, d,
+			_eguebfs_computed_invalidate_cb, d->fs);
+}
+
+/* The operations below run the same code the workers run for the kernel
+ * requests, on the calling thread. They return zero or the error the kernel
+ * would get. Every inode returned by a lookup, a resolve or a mkdir has to
+ * be forgotten
+ */
+EAPI int eguebfs_op_lookup(Eguebfs *thiz, uint64_t parent, const char *name,
+		uint64_t *ino, struct stat *st)
+{
+	Eguebfs_Call call;
+
+	_eguebfs_call_begin(thiz, &call);
+	_eguebfs_lookup((fuse_req_t)&call, parent, name);
+	if (_eguebfs_call_end(&call))
+		return call.err;
+	if (ino)
+		*ino = call.ino;
+	if (st)
+		*st = call.st;
+	return 0;
+}
+
+/* Lookup every component of a path from the root like the kernel does when
+ * it has nothing cached, only the last component is not forgotten
+ */
+EAPI int eguebfs_op_resolve(Eguebfs *thiz, const char *path, uint64_t *ino,
+		struct stat *st)
+{
+	uint64_t current = EGUEBFS_OP_ROOT;
+	char name[NAME_MAX + 1];
+
+	while (*path)
+	{
+		uint64_t next;
+		size_t len;
+		int err;
+
+		while (*path == '/')
+			path++;
+		len = strcspn(path, "/");
+		if (!len)
+			break;
+		if (len >= sizeof(name))
+		{
+			eguebfs_op_forget(thiz, current, 1);
+			return ENAMETOOLONG;
+		}
+		memcpy(name, path, len);
+		name[len] = '\0';
+		path += len;
+
+		err = eguebfs_op_lookup(thiz, current, name, &next, st);
+		eguebfs_op_forget(thiz, current, 1);
+		if (err)
+			return err;
+		current = next;
+	}
+	if (current == EGUEBFS_OP_ROOT && st)
+		eguebfs_op_getattr(thiz, current, st);
+	*ino = current;
+	return 0;
+}
+
+/* The root is never forgotten */
+EAPI void eguebfs_op_forget(Eguebfs *thiz, uint64_t ino, uint64_t nlookup)
+{
+	Eguebfs_Call call;
+
+	_eguebfs_call_begin(thiz, &call);
+	_eguebfs_forget((fuse_req_t)&call, ino, nlookup);
+	_eguebfs_call_end(&call);
+}
+
+EAPI int eguebfs_op_getattr(Eguebfs *thiz, uint64_t ino, struct stat *st)
+{
+	Eguebfs_Call call;
+
+	_eguebfs_call_begin(thiz, &call);
+	_eguebfs_getattr((fuse_req_t)&call, ino, NULL);
+	if (_eguebfs_call_end(&call))
+		return call.err;
+	if (st)
+		*st = call.st;
+	return 0;
+}
+
+EAPI int eguebfs_op_truncate(Eguebfs *thiz, uint64_t ino, off_t length)
+{
+	Eguebfs_Call call;
+	struct stat attr;
+
+	memset(&attr, 0, sizeof(struct stat));
+	attr.st_size = length;
+	_eguebfs_call_begin(thiz, &call);
+	_eguebfs_setattr((fuse_req_t)&call, ino, &attr, FUSE_SET_ATTR_SIZE,
+			NULL);
+	return _eguebfs_call_end(&call);
+}
+
+/* The offset is zero or the one given to the filler with an entry, the
+ * listing resumes after it. The filler stops the listing by returning
+ * EINA_FALSE
+ */
+EAPI int eguebfs_op_readdir(Eguebfs *thiz, uint64_t ino, off_t offset,
+		Eguebfs_Op_Filler filler, void *data)
+{
+	return _eguebfs_op_dir_list(thiz, ino, offset, EINA_FALSE, filler,
+			data, NULL, 4096, NULL);
+}
+
+/* The kernel takes a lookup of every entry of a listing plus with a node
+ * id, so does the caller
+ */
+EAPI int eguebfs_op_readdir_buf(Eguebfs *thiz, uint64_t ino, off_t offset,
+		Eina_Bool plus, char *buf, size_t size, size_t *length)
+{
+	return _eguebfs_op_dir_list(thiz, ino, offset, plus, NULL, NULL, buf,
+			size, length);
+}
+
+EAPI int eguebfs_op_open(Eguebfs *thiz, uint64_t ino, int flags,
+		Eguebfs_Op_File **file)
+{
+	Eguebfs_Op_File *f;
+	Eguebfs_Call call;
+
+	f = calloc(1, sizeof(Eguebfs_Op_File));
+	f->ino = ino;
+	f->fi.flags = flags;
+	_eguebfs_call_begin(thiz, &call);
+	_eguebfs_open((fuse_req_t)&call, ino, &f->fi);
+	if (_eguebfs_call_end(&call))
+	{
+		free(f);
+		return call.err;
+	}
+	*file = f;
+	return 0;
+}
+
+/* The events file is only read through the kernel, a read might wait for
+ * the next event
+ */
+EAPI int eguebfs_op_read(Eguebfs *thiz, Eguebfs_Op_File *f, char *buf,
+		size_t size, off_t offset, size_t *length)
+{
+	Eguebfs_Call call;
+
+	if (EGUEBFS_HANDLE(&f->fi)->reader)
+		return EINVAL;
+	_eguebfs_call_begin(thiz, &call);
+	call.buf = buf;
+	_eguebfs_read((fuse_req_t)&call, f->ino, size, offset, &f->fi);
+	if (_eguebfs_call_end(&call))
+		return call.err;
+	*length = call.size;
+	return 0;
+}
+
+EAPI int eguebfs_op_write(Eguebfs *thiz, Eguebfs_Op_File *f, const char *buf,
+		size_t size, off_t offset, size_t *written)
+{
+	Eguebfs_Call call;
+
+	_eguebfs_call_begin(thiz, &call);
+	_eguebfs_write((fuse_req_t)&call, f->ino, buf, size, offset, &f->fi);
+	if (_eguebfs_call_end(&call))
+		return call.err;
+	*written = call.size;
+	return 0;
+}
+
+/* Flush and release the file, like a close() does. The error is the one of
+ * the flush
+ */
+EAPI int eguebfs_op_release(Eguebfs *thiz, Eguebfs_Op_File *f)
+{
+	Eguebfs_Call call;
+	int err;
+
+	_eguebfs_call_begin(thiz, &call);
+	_eguebfs_flush((fuse_req_t)&call, f->ino, &f->fi);
+	err = _eguebfs_call_end(&call);
+	_eguebfs_call_begin(thiz, &call);
+	_eguebfs_release((fuse_req_t)&call, f->ino, &f->fi);
+	_eguebfs_call_end(&call);
+	free(f);
+
+	return err;
+}
+
+EAPI int eguebfs_op_mkdir(Eguebfs *thiz, uint64_t parent, const char *name,
+		uint64_t *ino)
+{
+	Eguebfs_Call call;
+
+	_eguebfs_call_begin(thiz, &call);
+	_eguebfs_mkdir((fuse_req_t)&call, parent, name, 0755);
+	if (_eguebfs_call_end(&call))
+		return call.err;
+	if (ino)
+		*ino = call.ino;
+	return 0;
+}
+
+EAPI int eguebfs_op_rmdir(Eguebfs *thiz, uint64_t parent, const char *name)
+{
+	Eguebfs_Call call;
+
+	_eguebfs_call_begin(thiz, &call);
+	_eguebfs_rmdir((fuse_req_t)&call, parent, name);
+	return _eguebfs_call_end(&call);
 }
@@ -0,0 +1,186 @@
+/* EGUEBFS - FUSE based Egueb filesystem
+ * Copyright (C) 2015 - 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+
+#include "eguebfs_private.h"
+
+/*
+ * The kernel caches entries and attributes, whenever the document changes
+ * the kernel needs to be told what to forget. The document changes while a
+ * request is being processed, and the kernel might wait for that request to
+ * finish before processing an invalidation, so the invalidations are queued
+ * and sent from a thread of its own.
+ */
+/*============================================================================*
+ *                                  Local                                     *
+ *============================================================================*/
+typedef struct _Eguebfs_Notification
+{
+	EINA_INLIST;
+	fuse_ino_t ino;
+	/* the entry name on the ino directory, NULL to invalidate the inode */
+	char *name;
+} Eguebfs_Notification;
+
+struct _Eguebfs_Notifier
+{
+	struct fuse_session *session;
+	Eina_Thread thread;
+	Eina_Lock lock;
+	Eina_Condition cond;
+	Eina_Inlist *queue;
+	/* ino -> notification, the inodes already queued */
+	Eina_Hash *inodes;
+	Eina_Bool done;
+};
+
+static void _eguebfs_notification_free(Eguebfs_Notification *n)
+{
+	free(n->name);
+	free(n);
+}
+
+static void _eguebfs_notifier_push(Eguebfs_Notifier *thiz,
+		Eguebfs_Notification *n)
+{
+	thiz->queue = eina_inlist_append(thiz->queue, EINA_INLIST_GET(n));
+	eina_condition_signal(&thiz->cond);
+}
+
+static void * _eguebfs_notifier_main(void *data, Eina_Thread t)
+{
+	Eguebfs_Notifier *thiz = data;
+
+	eina_lock_take(&thiz->lock);
+	while (!thiz->done)
+	{
+		Eguebfs_Notification *n;
+
+		if (!thiz->queue)
+		{
+			eina_condition_wait(&thiz->cond);
+			continue;
+		}
+
+		n = EINA_INLIST_CONTAINER_GET(thiz->queue, Eguebfs_Notification);
+		thiz->queue = eina_inlist_remove(thiz->queue, thiz->queue);
+		if (!n->name)
+			eina_hash_del(thiz->inodes, &n->ino, n);
+		eina_lock_release(&thiz->lock);
+
+		/* an unknown inode or entry is not an error, the kernel
+		 * might have forgotten it already
+		 */
+		if (n->name)
+			fuse_lowlevel_notify_inval_entry(thiz->session, n->ino,
+					n->name, strlen(n->name));
+		else
+			fuse_lowlevel_notify_inval_inode(thiz->session, n->ino,
+					0, 0);
+		_eguebfs_notification_free(n);
+
+		eina_lock_take(&thiz->lock);
+	}
+	eina_lock_release(&thiz->lock);
+
+	return NULL;
+}
+/*============================================================================*
+ *                                 Global                                     *
+ *============================================================================*/
+Eguebfs_Notifier * eguebfs_notifier_new(struct fuse_session *session)
+{
+	Eguebfs_Notifier *thiz;
+
+	thiz = calloc(1, sizeof(Eguebfs_Notifier));
+	thiz->session = session;
+	eina_lock_new(&thiz->lock);
+	eina_condition_new(&thiz->cond, &thiz->lock);
+	thiz->inodes = eina_hash_int64_new(NULL);
+	if (!eina_thread_create(&thiz->thread, EINA_THREAD_BACKGROUND, -1,
+			_eguebfs_notifier_main, thiz))
+	{
+		eina_hash_free(thiz->inodes);
+		eina_condition_free(&thiz->cond);
+		eina_lock_free(&thiz->lock);
+		free(thiz);
+		return NULL;
+	}
+
+	return thiz;
+}
+
+/* Pending notifications are discarded */
+void eguebfs_notifier_free(Eguebfs_Notifier *thiz)
+{
+	Eguebfs_Notification *n;
+	Eina_Inlist *l;
+
+	eina_lock_take(&thiz->lock);
+	thiz->done = EINA_TRUE;
+	eina_condition_signal(&thiz->cond);
+	eina_lock_release(&thiz->lock);
+	eina_thread_join(thiz->thread);
+
+	EINA_INLIST_FOREACH_SAFE(thiz->queue, l, n)
+		_eguebfs_notification_free(n);
+	eina_hash_free(thiz->inodes);
+	eina_condition_free(&thiz->cond);
+	eina_lock_free(&thiz->lock);
+	free(thiz);
+}
+
+/* Invalidate the attributes and the content of an inode */
+void eguebfs_notifier_inode_add(Eguebfs_Notifier *thiz, fuse_ino_t ino)
+{
+	Eguebfs_Notification *n;
+
+	/* there is no kernel to tell without a session */
+	if (!thiz->session)
+		return;
+	eina_lock_take(&thiz->lock);
+	/* a value changing several times before the kernel is told */
+	if (!eina_hash_find(thiz->inodes, &ino))
+	{
+		n = calloc(1, sizeof(Eguebfs_Notification));
+		n->ino = ino;
+		eina_hash_add(thiz->inodes, &n->ino, n);
+		_eguebfs_notifier_push(thiz, n);
+	}
+	eina_lock_release(&thiz->lock);
+}
+
+/* Invalidate the entry name of the directory parent */
+void eguebfs_notifier_entry_add(Eguebfs_Notifier *thiz, fuse_ino_t parent,
+		const char *name)
+{
+	Eguebfs_Notification *n;
+
+	if (!thiz->session)
+		return;
+	n = calloc(1, sizeof(Eguebfs_Notification));
+	n->ino = parent;
+	n->name = strdup(name);
+	eina_lock_take(&thiz->lock);
+	_eguebfs_notifier_push(thiz, n);
+	eina_lock_release(&thiz->lock);
+}
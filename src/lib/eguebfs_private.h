@@ -0,0 +1,291 @@
+/* EGUEBFS - FUSE based Egueb filesystem
+ * Copyright (C) 2015 - 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _EGUEBFS_PRIVATE_H_
+#define _EGUEBFS_PRIVATE_H_
+
+#include <Eguebfs.h>
+
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#define FUSE_USE_VERSION 30
+
+#include <fuse_lowlevel.h>
+
+#define ERR(...) EINA_LOG_DOM_ERR(eguebfs_log_dom, __VA_ARGS__)
+#define WRN(...) EINA_LOG_DOM_WARN(eguebfs_log_dom, __VA_ARGS__)
+#define INF(...) EINA_LOG_DOM_INFO(eguebfs_log_dom, __VA_ARGS__)
+#define DBG(...) EINA_LOG_DOM_DBG(eguebfs_log_dom, __VA_ARGS__)
+#define CRI(...) EINA_LOG_DOM_CRIT(eguebfs_log_dom, __VA_ARGS__)
+
+extern int eguebfs_log_dom;
+
+typedef enum _Eguebfs_File_Type
+{
+	EGUEBFS_FILE_TYPE_NODE,
+	EGUEBFS_FILE_TYPE_ATTR_BASE,
+	EGUEBFS_FILE_TYPE_ATTR_ANIM,
+	EGUEBFS_FILE_TYPE_ATTR_STYLED,
+	EGUEBFS_FILE_TYPE_ATTR_FINAL,
+	/* control files at the root, n is the document */
+	EGUEBFS_FILE_TYPE_BATCH,
+	EGUEBFS_FILE_TYPE_EVENTS,
+	EGUEBFS_FILE_TYPE_PROGRESS,
+	/* the serialization of the element n */
+	EGUEBFS_FILE_TYPE_XML,
+	/* the root of a mount of several documents, n is NULL */
+	EGUEBFS_FILE_TYPE_DOCUMENTS,
+	/* the counters of the mount, n is the document or NULL at the root
+	 * of a mount of several documents
+	 */
+	EGUEBFS_FILE_TYPE_STATS,
+} Eguebfs_File_Type;
+
+#define EGUEBFS_FILE_BATCH ".batch"
+#define EGUEBFS_FILE_EVENTS ".events"
+#define EGUEBFS_FILE_PROGRESS ".progress"
+#define EGUEBFS_FILE_STATS ".stats"
+#define EGUEBFS_FILE_XML ".xml"
+
+typedef struct _Eguebfs_File
+{
+	Eguebfs_File_Type type;
+	Egueb_Dom_Node *n;
+} Eguebfs_File;
+
+/* Returns EINA_FALSE when the entry does not fit, next is the offset of the
+ * entry that follows. The file of the entry is only valid during the call,
+ * it is NULL when the entry has no file of its own, like . and ..
+ */
+typedef Eina_Bool (*Eguebfs_File_Filler)(void *data, const char *name,
+		Eguebfs_File *f, off_t next);
+
+/* The position of a listing, so it can be resumed */
+typedef struct _Eguebfs_File_Cursor
+{
+	/* the offset of the next entry */
+	off_t offset;
+	/* the name and repetition of the next child */
+	char *name;
+	int nth;
+	Eina_Bool children_done;
+	/* the next entry after the children */
+	int extra;
+} Eguebfs_File_Cursor;
+
+/* lazy documents */
+typedef struct _Eguebfs_Lazy Eguebfs_Lazy;
+/* Tells if the kernel knows any file of the node */
+typedef Eina_Bool (*Eguebfs_Lazy_Busy)(void *data, Egueb_Dom_Node *n);
+/* The children of n are going to be destroyed */
+typedef void (*Eguebfs_Lazy_Evicted)(void *data, Egueb_Dom_Node *n);
+/* Locks or unlocks the document */
+typedef void (*Eguebfs_Lazy_Lock)(void *data, Eina_Bool lock);
+
+Eguebfs_Lazy * eguebfs_lazy_new(const char *file);
+void eguebfs_lazy_free(Eguebfs_Lazy *thiz);
+Egueb_Dom_Node * eguebfs_lazy_document_get(Eguebfs_Lazy *thiz);
+Eina_Bool eguebfs_lazy_start(Eguebfs_Lazy *thiz, size_t budget, Eina_Bool load,
+		Eguebfs_Lazy_Busy busy, Eguebfs_Lazy_Evicted evicted,
+		Eguebfs_Lazy_Lock doc_lock, void *data);
+void eguebfs_lazy_progress_get(Eguebfs_Lazy *thiz, size_t *parsed,
+		size_t *total);
+void eguebfs_lazy_materialize(Eguebfs_Lazy *thiz, Egueb_Dom_Node *n);
+const char * eguebfs_lazy_source_get(Eguebfs_Lazy *thiz, Egueb_Dom_Node *n,
+		size_t *length);
+
+/* child index */
+typedef struct _Eguebfs_Index Eguebfs_Index;
+typedef Eina_Bool (*Eguebfs_Index_Foreach)(void *data, const char *name,
+		Eina_Array *children);
+/* The child that was the nth one named as name of n is going to change */
+typedef void (*Eguebfs_Index_Changed)(void *data, Egueb_Dom_Node *n,
+		const char *name, int nth, Egueb_Dom_Node *child);
+
+Eguebfs_Index * eguebfs_index_new(Egueb_Dom_Node *doc, Eguebfs_Lazy *lazy,
+		Eguebfs_Index_Changed changed, void *data);
+void eguebfs_index_free(Eguebfs_Index *thiz);
+void eguebfs_index_drop(Eguebfs_Index *thiz, Egueb_Dom_Node *n);
+Egueb_Dom_Node * eguebfs_index_child_get(Eguebfs_Index *thiz,
+		Egueb_Dom_Node *n, const char *name, int nth);
+int eguebfs_index_child_count(Eguebfs_Index *thiz, Egueb_Dom_Node *n,
+		const char *name);
+Eina_Bool eguebfs_index_foreach(Eguebfs_Index *thiz, Egueb_Dom_Node *n,
+		const char *from, Eguebfs_Index_Foreach cb, void *data);
+int eguebfs_index_child_position(Eguebfs_Index *thiz, Egueb_Dom_Node *n,
+		Egueb_Dom_Node *child);
+
+/* file */
+Eina_Bool eguebfs_file_name_is_element(const char *p, size_t *len, int *nth);
+Eina_Bool eguebfs_file_step(Eguebfs_File *f, Eguebfs_Index *index,
+		const char *p);
+void eguebfs_file_list(Eguebfs_File *f, Eguebfs_Index *index,
+		Eguebfs_File_Cursor *c, off_t offset, Eguebfs_File_Filler filler,
+		void *data);
+void eguebfs_file_cursor_reset(Eguebfs_File_Cursor *c);
+Eina_Bool eguebfs_file_delete(Eguebfs_File *f);
+Eina_Bool eguebfs_file_stat(Eguebfs_File *f, struct stat *st);
+off_t eguebfs_file_length_get(Eguebfs_File *f);
+Egueb_Dom_String * eguebfs_file_value_get(Eguebfs_File *f);
+Eina_Bool eguebfs_file_value_set(Eguebfs_File *f, const char *buf, size_t size);
+Eina_Bool eguebfs_file_value_unset(Eguebfs_File *f);
+Eina_Bool eguebfs_file_range_set(Eguebfs_File *f, off_t offset, size_t count,
+		const char *buf, size_t size);
+Eina_Bool eguebfs_file_truncate(Eguebfs_File *f, off_t new_length);
+Egueb_Dom_Node * eguebfs_file_child_create(Eguebfs_File *f,
+		Eguebfs_Index *index, const char *p);
+Egueb_Dom_Node * eguebfs_event_target_node_get(Egueb_Dom_Event *e);
+
+/* path cache */
+typedef struct _Eguebfs_Cache Eguebfs_Cache;
+
+Eguebfs_Cache * eguebfs_cache_new(Egueb_Dom_Node *doc, Eguebfs_Index *index);
+void eguebfs_cache_free(Eguebfs_Cache *thiz);
+void eguebfs_cache_children_drop(Eguebfs_Cache *thiz, Egueb_Dom_Node *n);
+Eina_Bool eguebfs_cache_find(Eguebfs_Cache *thiz, const char *path,
+		Eguebfs_File *f);
+
+/* batch */
+Eina_Bool eguebfs_batch_apply(Eguebfs_Cache *cache, char *buf, size_t length,
+		Eina_Strbuf *report);
+
+/* mutation events */
+typedef struct _Eguebfs_Events Eguebfs_Events;
+typedef struct _Eguebfs_Events_Reader Eguebfs_Events_Reader;
+
+Eguebfs_Events * eguebfs_events_new(Egueb_Dom_Node *doc, Eguebfs_Index *index);
+void eguebfs_events_free(Eguebfs_Events *thiz);
+Eguebfs_Events_Reader * eguebfs_events_reader_new(Eguebfs_Events *thiz);
+void eguebfs_events_reader_free(Eguebfs_Events *thiz, Eguebfs_Events_Reader *r);
+void eguebfs_events_read(Eguebfs_Events *thiz, Eguebfs_Events_Reader *r,
+		fuse_req_t req, size_t size, Eina_Bool nonblock);
+void eguebfs_events_poll(Eguebfs_Events *thiz, Eguebfs_Events_Reader *r,
+		fuse_req_t req, struct fuse_pollhandle *ph);
+
+/* subtree serialization */
+typedef struct _Eguebfs_Xml Eguebfs_Xml;
+typedef void (*Eguebfs_Xml_Invalidated)(void *data, Egueb_Dom_Node *n);
+
+Eguebfs_Xml * eguebfs_xml_new(Egueb_Dom_Node *doc, Eguebfs_Lazy *lazy,
+		size_t budget, Eguebfs_Xml_Invalidated invalidated, void *data);
+void eguebfs_xml_free(Eguebfs_Xml *thiz);
+void eguebfs_xml_children_drop(Eguebfs_Xml *thiz, Egueb_Dom_Node *n);
+size_t eguebfs_xml_length_get(Eguebfs_Xml *thiz, Egueb_Dom_Node *n);
+size_t eguebfs_xml_copy(Eguebfs_Xml *thiz, Egueb_Dom_Node *n, char *to,
+		size_t length);
+
+/* write back */
+typedef struct _Eguebfs_Saver Eguebfs_Saver;
+/* Returns the content of the file, NULL on failure */
+typedef char * (*Eguebfs_Saver_Serialize)(void *data, size_t *length);
+
+Eguebfs_Saver * eguebfs_saver_new(Egueb_Dom_Node *doc, const char *path,
+		double delay, Eguebfs_Saver_Serialize serialize, void *data);
+void eguebfs_saver_free(Eguebfs_Saver *thiz);
+
+/* inodes */
+typedef struct _Eguebfs_Inode
+{
+	EINA_INLIST;
+	fuse_ino_t ino;
+	Eguebfs_File f;
+	/* the document of the node */
+	Eguebfs_Document *owner;
+	uint64_t nlookup;
+	/* the length of the value at the given mutation generation */
+	off_t length;
+	unsigned int generation;
+	Eina_Bool has_length;
+	/* the modifications of the character data of the node */
+	unsigned int modified;
+	/* on the list of computed values known by the kernel */
+	Eina_Bool computed;
+} Eguebfs_Inode;
+
+typedef void (*Eguebfs_Inodes_Cb)(void *data, fuse_ino_t ino);
+
+typedef struct _Eguebfs_Inodes Eguebfs_Inodes;
+
+Eguebfs_Inodes * eguebfs_inodes_new(Egueb_Dom_Node *doc,
+		Eguebfs_Document *owner);
+void eguebfs_inodes_free(Eguebfs_Inodes *thiz);
+Eguebfs_Inode * eguebfs_inodes_get(Eguebfs_Inodes *thiz, fuse_ino_t ino);
+Eguebfs_Inode * eguebfs_inodes_lookup(Eguebfs_Inodes *thiz, Eguebfs_File *f,
+		Eguebfs_Document *owner);
+fuse_ino_t eguebfs_inodes_find(Eguebfs_Inodes *thiz, Egueb_Dom_Node *n,
+		Eguebfs_File_Type type);
+void eguebfs_inodes_forget(Eguebfs_Inodes *thiz, fuse_ino_t ino,
+		uint64_t nlookup);
+void eguebfs_inodes_owner_drop(Eguebfs_Inodes *thiz, Eguebfs_Document *owner);
+Eina_Bool eguebfs_inodes_length_get(Eguebfs_Inodes *thiz, Eguebfs_Inode *inode,
+		unsigned int generation, off_t *length);
+void eguebfs_inodes_length_set(Eguebfs_Inodes *thiz, Eguebfs_Inode *inode,
+		unsigned int generation, off_t length);
+void eguebfs_inodes_length_drop(Eguebfs_Inodes *thiz, fuse_ino_t ino);
+void eguebfs_inodes_modified_add(Eguebfs_Inodes *thiz, fuse_ino_t ino);
+Eina_Bool eguebfs_inodes_modified_get(Eguebfs_Inodes *thiz, Eguebfs_File *f,
+		unsigned int *modified);
+void eguebfs_inodes_computed_add(Eguebfs_Inodes *thiz, Eguebfs_Inode *inode);
+void eguebfs_inodes_computed_flush(Eguebfs_Inodes *thiz,
+		Eguebfs_Document *owner, Eguebfs_Inodes_Cb cb, void *data);
+
+/* counters */
+typedef struct _Eguebfs_Stats_Collector Eguebfs_Stats_Collector;
+
+void eguebfs_stats_init(void);
+void eguebfs_stats_shutdown(void);
+Eguebfs_Stats_Collector * eguebfs_stats_collector_new(void);
+void eguebfs_stats_collector_free(Eguebfs_Stats_Collector *thiz);
+void eguebfs_stats_collector_thread_set(Eguebfs_Stats_Collector *thiz);
+void eguebfs_stats_collector_get(Eguebfs_Stats_Collector *thiz,
+		Eguebfs_Stats *s);
+void eguebfs_stats_format(const Eguebfs_Stats *s, Eina_Strbuf *buf);
+void eguebfs_stats_op_begin(Eguebfs_Stats_Op op);
+void eguebfs_stats_op_end(int error, size_t bytes);
+void eguebfs_stats_step(void);
+void eguebfs_stats_path_cache(Eina_Bool hit);
+void eguebfs_stats_length_cache(Eina_Bool hit);
+
+/* per thread scratch memory */
+typedef struct _Eguebfs_Scratch_Chunk Eguebfs_Scratch_Chunk;
+
+typedef struct _Eguebfs_Scratch_Mark
+{
+	Eguebfs_Scratch_Chunk *chunk;
+	size_t used;
+} Eguebfs_Scratch_Mark;
+
+void eguebfs_scratch_init(void);
+void eguebfs_scratch_shutdown(void);
+void eguebfs_scratch_mark(Eguebfs_Scratch_Mark *m);
+void eguebfs_scratch_release(Eguebfs_Scratch_Mark *m);
+void * eguebfs_scratch_alloc(size_t size);
+char * eguebfs_scratch_strndup(const char *s, size_t len);
+Egueb_Dom_String * eguebfs_scratch_name_get(const char *name);
+
+/* kernel notifications */
+typedef struct _Eguebfs_Notifier Eguebfs_Notifier;
+
+Eguebfs_Notifier * eguebfs_notifier_new(struct fuse_session *session);
+void eguebfs_notifier_free(Eguebfs_Notifier *thiz);
+void eguebfs_notifier_inode_add(Eguebfs_Notifier *thiz, fuse_ino_t ino);
+void eguebfs_notifier_entry_add(Eguebfs_Notifier *thiz, fuse_ino_t parent,
+		const char *name);
+
+#endif
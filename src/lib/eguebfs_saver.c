@@ -0,0 +1,317 @@
+/* EGUEBFS - FUSE based Egueb filesystem
+ * Copyright (C) 2015 - 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+
+#include "eguebfs_private.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * The saver writes the document back to a file once it has not changed for
+ * a while, so a burst of changes is saved once. The document is serialized
+ * on a thread of its own and only the serialization needs the document,
+ * the file is written without it. The file is written to a temporary file
+ * first and then renamed, so it is never left half written. A save that
+ * fails is tried again once the document has been quiet for a while
+ */
+/*============================================================================*
+ *                                  Local                                     *
+ *============================================================================*/
+struct _Eguebfs_Saver
+{
+	Egueb_Dom_Node *doc;
+	char *path;
+	/* seconds without changes before saving */
+	double delay;
+	Eguebfs_Saver_Serialize serialize;
+	void *data;
+	Eina_Thread thread;
+	Eina_Lock lock;
+	Eina_Condition cond;
+	/* the time of the last change not saved yet */
+	double changed;
+	Eina_Bool dirty;
+	Eina_Bool done;
+};
+
+static double _eguebfs_saver_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/* The rename is only on the disk once the directory is */
+static Eina_Bool _eguebfs_saver_directory_sync(Eguebfs_Saver *thiz)
+{
+	Eina_Bool ret = EINA_TRUE;
+	char *path;
+	char *dir;
+	int fd;
+
+	path = strdup(thiz->path);
+	dir = dirname(path);
+	fd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+	{
+		ERR("Fail to open '%s' (%s)", dir, strerror(errno));
+		free(path);
+		return EINA_FALSE;
+	}
+	/* not every filesystem can sync a directory */
+	if (fsync(fd) < 0 && errno != EINVAL)
+	{
+		ERR("Fail to sync '%s' (%s)", dir, strerror(errno));
+		ret = EINA_FALSE;
+	}
+	close(fd);
+	free(path);
+
+	return ret;
+}
+
+static Eina_Bool _eguebfs_saver_write(Eguebfs_Saver *thiz, const char *buf,
+		size_t length)
+{
+	struct stat st;
+	char *tmp;
+	int fd;
+
+	if (asprintf(&tmp, "%s.XXXXXX", thiz->path) < 0)
+		return EINA_FALSE;
+	fd = mkstemp(tmp);
+	if (fd < 0)
+	{
+		ERR("Fail to create '%s' (%s)", tmp, strerror(errno));
+		goto no_tmp;
+	}
+	/* keep the permissions of the file being replaced */
+	if (!stat(thiz->path, &st))
+		fchmod(fd, st.st_mode & 07777);
+
+	while (length)
+	{
+		ssize_t written;
+
+		written = write(fd, buf, length);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			ERR("Fail to write '%s' (%s)", tmp, strerror(errno));
+			goto no_write;
+		}
+		buf += written;
+		length -= written;
+	}
+	if (fsync(fd) < 0)
+	{
+		ERR("Fail to sync '%s' (%s)", tmp, strerror(errno));
+		goto no_write;
+	}
+	close(fd);
+	if (rename(tmp, thiz->path) < 0)
+	{
+		ERR("Fail to rename '%s' (%s)", tmp, strerror(errno));
+		unlink(tmp);
+		free(tmp);
+		return EINA_FALSE;
+	}
+	free(tmp);
+	return _eguebfs_saver_directory_sync(thiz);
+
+no_write:
+	close(fd);
+	unlink(tmp);
+no_tmp:
+	free(tmp);
+	return EINA_FALSE;
+}
+
+/* A document without any element has nothing to save */
+static Eina_Bool _eguebfs_saver_save(Eguebfs_Saver *thiz)
+{
+	Eina_Bool ret;
+	char *buf;
+	size_t length;
+
+	buf = thiz->serialize(thiz->data, &length);
+	if (!buf)
+		return EINA_TRUE;
+	ret = _eguebfs_saver_write(thiz, buf, length);
+	if (ret)
+		INF("Document saved to '%s'", thiz->path);
+	free(buf);
+
+	return ret;
+}
+
+static void * _eguebfs_saver_main(void *data, Eina_Thread t)
+{
+	Eguebfs_Saver *thiz = data;
+
+	eina_lock_take(&thiz->lock);
+	while (!thiz->done)
+	{
+		Eina_Bool saved;
+		double left;
+
+		if (!thiz->dirty)
+		{
+			eina_condition_wait(&thiz->cond);
+			continue;
+		}
+		/* wait until the document is quiet */
+		left = thiz->changed + thiz->delay - _eguebfs_saver_now();
+		if (left > 0)
+		{
+			eina_condition_timedwait(&thiz->cond, left);
+			continue;
+		}
+		thiz->dirty = EINA_FALSE;
+		eina_lock_release(&thiz->lock);
+		saved = _eguebfs_saver_save(thiz);
+		eina_lock_take(&thiz->lock);
+		if (!saved && !thiz->dirty)
+		{
+			thiz->dirty = EINA_TRUE;
+			thiz->changed = _eguebfs_saver_now();
+		}
+	}
+	eina_lock_release(&thiz->lock);
+
+	return NULL;
+}
+
+/* Any mutation happens with the document locked */
+static void _eguebfs_saver_mutation_cb(Egueb_Dom_Event *ev, void *data)
+{
+	Eguebfs_Saver *thiz = data;
+
+	eina_lock_take(&thiz->lock);
+	thiz->changed = _eguebfs_saver_now();
+	if (!thiz->dirty)
+	{
+		thiz->dirty = EINA_TRUE;
+		eina_condition_signal(&thiz->cond);
+	}
+	eina_lock_release(&thiz->lock);
+}
+
+static void _eguebfs_saver_listeners_add(Eguebfs_Saver *thiz)
+{
+	Egueb_Dom_Event_Target *et;
+
+	et = EGUEB_DOM_EVENT_TARGET(thiz->doc);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_INSERTED,
+			_eguebfs_saver_mutation_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_REMOVED,
+			_eguebfs_saver_mutation_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_ATTR_MODIFIED,
+			_eguebfs_saver_mutation_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_CHARACTER_DATA_MODIFIED,
+			_eguebfs_saver_mutation_cb, EINA_FALSE, thiz);
+}
+
+static void _eguebfs_saver_listeners_remove(Eguebfs_Saver *thiz)
+{
+	Egueb_Dom_Event_Target *et;
+
+	et = EGUEB_DOM_EVENT_TARGET(thiz->doc);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_INSERTED,
+			_eguebfs_saver_mutation_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_REMOVED,
+			_eguebfs_saver_mutation_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_ATTR_MODIFIED,
+			_eguebfs_saver_mutation_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_CHARACTER_DATA_MODIFIED,
+			_eguebfs_saver_mutation_cb, EINA_FALSE, thiz);
+}
+/*============================================================================*
+ *                                 Global                                     *
+ *============================================================================*/
+/* The serialize callback is called from the saver thread without the
+ * document locked, it must lock it by itself
+ */
+Eguebfs_Saver * eguebfs_saver_new(Egueb_Dom_Node *doc, const char *path,
+		double delay, Eguebfs_Saver_Serialize serialize, void *data)
+{
+	Eguebfs_Saver *thiz;
+
+	thiz = calloc(1, sizeof(Eguebfs_Saver));
+	thiz->doc = egueb_dom_node_ref(doc);
+	thiz->path = strdup(path);
+	thiz->delay = delay;
+	thiz->serialize = serialize;
+	thiz->data = data;
+	eina_lock_new(&thiz->lock);
+	eina_condition_new(&thiz->cond, &thiz->lock);
+	if (!eina_thread_create(&thiz->thread, EINA_THREAD_BACKGROUND, -1,
+			_eguebfs_saver_main, thiz))
+	{
+		eina_condition_free(&thiz->cond);
+		eina_lock_free(&thiz->lock);
+		free(thiz->path);
+		egueb_dom_node_unref(thiz->doc);
+		free(thiz);
+		return NULL;
+	}
+	_eguebfs_saver_listeners_add(thiz);
+
+	return thiz;
+}
+
+/* The changes not saved yet are saved right away, so the document must not
+ * be locked
+ */
+void eguebfs_saver_free(Eguebfs_Saver *thiz)
+{
+	_eguebfs_saver_listeners_remove(thiz);
+	eina_lock_take(&thiz->lock);
+	thiz->done = EINA_TRUE;
+	eina_condition_signal(&thiz->cond);
+	eina_lock_release(&thiz->lock);
+	eina_thread_join(thiz->thread);
+
+	if (thiz->dirty)
+		_eguebfs_saver_save(thiz);
+	eina_condition_free(&thiz->cond);
+	eina_lock_free(&thiz->lock);
+	free(thiz->path);
+	egueb_dom_node_unref(thiz->doc);
+	free(thiz);
+}
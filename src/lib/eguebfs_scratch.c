@@ -0,0 +1,237 @@
+/* EGUEBFS - FUSE based Egueb filesystem
+ * Copyright (C) 2015 - 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+
+#include "eguebfs_private.h"
+
+/*
+ * Every thread doing requests has scratch memory of its own for the
+ * temporaries of a request, like a name that needs to be terminated or the
+ * buffer of a listing. Memory is taken from the top of the scratch and
+ * given back all at once up to a mark taken before, so once the scratch has
+ * grown to what the requests need nothing is allocated anymore. The names
+ * probed as attributes are also kept per thread as strings of the document,
+ * the same name is not created again on every probe. The scratch of a
+ * thread is freed when the thread exits
+ */
+/*============================================================================*
+ *                                  Local                                     *
+ *============================================================================*/
+#define EGUEBFS_SCRATCH_CHUNK 4096
+#define EGUEBFS_SCRATCH_ALIGN 16
+/* names kept per thread, they are forgotten once there are more */
+#define EGUEBFS_SCRATCH_NAMES_MAX 256
+
+struct _Eguebfs_Scratch_Chunk
+{
+	Eguebfs_Scratch_Chunk *prev;
+	size_t size;
+	size_t used;
+	char mem[];
+};
+
+typedef struct _Eguebfs_Scratch
+{
+	/* the chunk memory is taken from */
+	Eguebfs_Scratch_Chunk *top;
+	/* the biggest chunk given back, used again before allocating */
+	Eguebfs_Scratch_Chunk *spare;
+	/* name -> Egueb_Dom_String */
+	Eina_Hash *names;
+} Eguebfs_Scratch;
+
+static Eina_TLS _eguebfs_scratch_key;
+static Eina_Bool _eguebfs_scratch_key_created = EINA_FALSE;
+
+static void _eguebfs_scratch_name_free(void *data)
+{
+	egueb_dom_string_unref(data);
+}
+
+static void _eguebfs_scratch_free(void *data)
+{
+	Eguebfs_Scratch *thiz = data;
+
+	while (thiz->top)
+	{
+		Eguebfs_Scratch_Chunk *prev = thiz->top->prev;
+
+		free(thiz->top);
+		thiz->top = prev;
+	}
+	free(thiz->spare);
+	eina_hash_free(thiz->names);
+	free(thiz);
+}
+
+static Eguebfs_Scratch * _eguebfs_scratch_get(void)
+{
+	Eguebfs_Scratch *thiz;
+
+	thiz = eina_tls_get(_eguebfs_scratch_key);
+	if (thiz)
+		return thiz;
+
+	thiz = calloc(1, sizeof(Eguebfs_Scratch));
+	thiz->names = eina_hash_string_superfast_new(
+			_eguebfs_scratch_name_free);
+	eina_tls_set(_eguebfs_scratch_key, thiz);
+	return thiz;
+}
+
+/* Put a chunk with room for size bytes on top */
+static void _eguebfs_scratch_grow(Eguebfs_Scratch *thiz, size_t size)
+{
+	Eguebfs_Scratch_Chunk *c = NULL;
+
+	if (thiz->spare && thiz->spare->size >= size)
+	{
+		c = thiz->spare;
+		thiz->spare = NULL;
+	}
+	else
+	{
+		size_t csize = thiz->top ? thiz->top->size * 2 :
+				EGUEBFS_SCRATCH_CHUNK;
+
+		while (csize < size)
+			csize *= 2;
+		c = malloc(sizeof(Eguebfs_Scratch_Chunk) + csize);
+		c->size = csize;
+	}
+	c->used = 0;
+	c->prev = thiz->top;
+	thiz->top = c;
+}
+/*============================================================================*
+ *                                 Global                                     *
+ *============================================================================*/
+void eguebfs_scratch_init(void)
+{
+	if (!eina_tls_cb_new(&_eguebfs_scratch_key, _eguebfs_scratch_free))
+	{
+		ERR("Fail to create the scratch key");
+		return;
+	}
+	_eguebfs_scratch_key_created = EINA_TRUE;
+}
+
+/* The threads still running must not use the scratch anymore, only the one
+ * of the calling thread is freed here
+ */
+void eguebfs_scratch_shutdown(void)
+{
+	Eguebfs_Scratch *thiz;
+
+	if (!_eguebfs_scratch_key_created)
+		return;
+	thiz = eina_tls_get(_eguebfs_scratch_key);
+	if (thiz)
+	{
+		eina_tls_set(_eguebfs_scratch_key, NULL);
+		_eguebfs_scratch_free(thiz);
+	}
+	eina_tls_free(_eguebfs_scratch_key);
+	_eguebfs_scratch_key_created = EINA_FALSE;
+}
+
+void eguebfs_scratch_mark(Eguebfs_Scratch_Mark *m)
+{
+	Eguebfs_Scratch *thiz = _eguebfs_scratch_get();
+
+	m->chunk = thiz->top;
+	m->used = thiz->top ? thiz->top->used : 0;
+}
+
+/* Give back everything taken since the mark */
+void eguebfs_scratch_release(Eguebfs_Scratch_Mark *m)
+{
+	Eguebfs_Scratch *thiz = _eguebfs_scratch_get();
+
+	while (thiz->top != m->chunk)
+	{
+		Eguebfs_Scratch_Chunk *c = thiz->top;
+
+		thiz->top = c->prev;
+		if (!thiz->spare || thiz->spare->size < c->size)
+		{
+			free(thiz->spare);
+			thiz->spare = c;
+		}
+		else
+		{
+			free(c);
+		}
+	}
+	if (thiz->top)
+		thiz->top->used = m->used;
+}
+
+/* The memory is valid until the mark taken before is released */
+void * eguebfs_scratch_alloc(size_t size)
+{
+	Eguebfs_Scratch *thiz = _eguebfs_scratch_get();
+	void *ret;
+
+	size = (size + EGUEBFS_SCRATCH_ALIGN - 1) &
+			~(size_t)(EGUEBFS_SCRATCH_ALIGN - 1);
+	if (!thiz->top || thiz->top->size - thiz->top->used < size)
+		_eguebfs_scratch_grow(thiz, size);
+	ret = thiz->top->mem + thiz->top->used;
+	thiz->top->used += size;
+
+	return ret;
+}
+
+char * eguebfs_scratch_strndup(const char *s, size_t len)
+{
+	char *ret;
+
+	ret = eguebfs_scratch_alloc(len + 1);
+	memcpy(ret, s, len);
+	ret[len] = '\0';
+
+	return ret;
+}
+
+/* The string is owned by the thread, it must not be unreferenced nor kept
+ * after the request
+ */
+Egueb_Dom_String * eguebfs_scratch_name_get(const char *name)
+{
+	Eguebfs_Scratch *thiz = _eguebfs_scratch_get();
+	Egueb_Dom_String *s;
+
+	s = eina_hash_find(thiz->names, name);
+	if (s)
+		return s;
+	if (eina_hash_population(thiz->names) >= EGUEBFS_SCRATCH_NAMES_MAX)
+	{
+		eina_hash_free(thiz->names);
+		thiz->names = eina_hash_string_superfast_new(
+				_eguebfs_scratch_name_free);
+	}
+	s = egueb_dom_string_new_with_chars(name);
+	eina_hash_add(thiz->names, name, s);
+
+	return s;
+}
@@ -0,0 +1,308 @@
+/* EGUEBFS - FUSE based Egueb filesystem
+ * Copyright (C) 2015 - 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+
+#include "eguebfs_private.h"
+
+#include <inttypes.h>
+#include <time.h>
+
+/*
+ * Every worker counts what it does on counters of its own, found through a
+ * thread local key, so counting never waits for anything. Only the worker
+ * writes its counters, reading them sums the counters of every worker
+ * without stopping them, so a sum might miss the operations in progress.
+ * Threads that are not workers, like the saver or the application, do not
+ * count anything
+ */
+/*============================================================================*
+ *                                  Local                                     *
+ *============================================================================*/
+typedef struct _Eguebfs_Stats_Block
+{
+	EINA_INLIST;
+	Eguebfs_Stats s;
+	/* the operation in progress and when it started */
+	Eguebfs_Stats_Op op;
+	uint64_t start;
+	Eina_Bool started;
+} Eguebfs_Stats_Block;
+
+struct _Eguebfs_Stats_Collector
+{
+	Eina_Lock lock;
+	Eina_Inlist *blocks;
+};
+
+static const char *_eguebfs_stats_op_names[EGUEBFS_STATS_OPS] = {
+	"lookup",
+	"getattr",
+	"truncate",
+	"readdir",
+	"open",
+	"read",
+	"write",
+	"flush",
+	"mkdir",
+	"rmdir",
+};
+
+static Eina_TLS _eguebfs_stats_key;
+static Eina_Bool _eguebfs_stats_key_created = EINA_FALSE;
+
+static uint64_t _eguebfs_stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* The bucket i counts the latencies below 2^i microseconds */
+static int _eguebfs_stats_bucket(uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	int i = 0;
+
+	while (us && i < EGUEBFS_STATS_BUCKETS - 1)
+	{
+		us >>= 1;
+		i++;
+	}
+	return i;
+}
+
+static void _eguebfs_stats_add(Eguebfs_Stats *to, const Eguebfs_Stats *from)
+{
+	int i;
+	int j;
+
+	for (i = 0; i < EGUEBFS_STATS_OPS; i++)
+	{
+		to->ops[i].count += from->ops[i].count;
+		to->ops[i].errors += from->ops[i].errors;
+		to->ops[i].bytes += from->ops[i].bytes;
+		to->ops[i].time += from->ops[i].time;
+		for (j = 0; j < EGUEBFS_STATS_BUCKETS; j++)
+			to->ops[i].histogram[j] += from->ops[i].histogram[j];
+	}
+	to->steps += from->steps;
+	to->path_hits += from->path_hits;
+	to->path_misses += from->path_misses;
+	to->length_hits += from->length_hits;
+	to->length_misses += from->length_misses;
+}
+/*============================================================================*
+ *                                 Global                                     *
+ *============================================================================*/
+void eguebfs_stats_init(void)
+{
+	if (!eina_tls_new(&_eguebfs_stats_key))
+	{
+		ERR("Fail to create the stats key, nothing will be counted");
+		return;
+	}
+	_eguebfs_stats_key_created = EINA_TRUE;
+}
+
+void eguebfs_stats_shutdown(void)
+{
+	if (!_eguebfs_stats_key_created)
+		return;
+	eina_tls_free(_eguebfs_stats_key);
+	_eguebfs_stats_key_created = EINA_FALSE;
+}
+
+Eguebfs_Stats_Collector * eguebfs_stats_collector_new(void)
+{
+	Eguebfs_Stats_Collector *thiz;
+
+	thiz = calloc(1, sizeof(Eguebfs_Stats_Collector));
+	eina_lock_new(&thiz->lock);
+
+	return thiz;
+}
+
+/* Every thread counting on it must be done */
+void eguebfs_stats_collector_free(Eguebfs_Stats_Collector *thiz)
+{
+	while (thiz->blocks)
+	{
+		Eguebfs_Stats_Block *b;
+
+		b = EINA_INLIST_CONTAINER_GET(thiz->blocks, Eguebfs_Stats_Block);
+		thiz->blocks = eina_inlist_remove(thiz->blocks, thiz->blocks);
+		free(b);
+	}
+	eina_lock_free(&thiz->lock);
+	free(thiz);
+}
+
+/* Make the calling thread count on the collector until it is unset */
+void eguebfs_stats_collector_thread_set(Eguebfs_Stats_Collector *thiz)
+{
+	Eguebfs_Stats_Block *b = NULL;
+
+	if (!_eguebfs_stats_key_created)
+		return;
+	if (thiz)
+	{
+		b = calloc(1, sizeof(Eguebfs_Stats_Block));
+		eina_lock_take(&thiz->lock);
+		thiz->blocks = eina_inlist_append(thiz->blocks,
+				EINA_INLIST_GET(b));
+		eina_lock_release(&thiz->lock);
+	}
+	eina_tls_set(_eguebfs_stats_key, b);
+}
+
+void eguebfs_stats_collector_get(Eguebfs_Stats_Collector *thiz,
+		Eguebfs_Stats *s)
+{
+	Eguebfs_Stats_Block *b;
+
+	memset(s, 0, sizeof(Eguebfs_Stats));
+	eina_lock_take(&thiz->lock);
+	EINA_INLIST_FOREACH(thiz->blocks, b)
+		_eguebfs_stats_add(s, &b->s);
+	eina_lock_release(&thiz->lock);
+}
+
+/* One line per operation with the count, the errors, the bytes, the
+ * microseconds spent and the histogram of latencies. Then the path steps
+ * and the hits and misses of every cache
+ */
+void eguebfs_stats_format(const Eguebfs_Stats *s, Eina_Strbuf *buf)
+{
+	int i;
+	int j;
+
+	eina_strbuf_append(buf, "# op count errors bytes us");
+	for (i = 0; i < EGUEBFS_STATS_BUCKETS - 1; i++)
+		eina_strbuf_append_printf(buf, " <%luus", 1UL << i);
+	eina_strbuf_append(buf, " more\n");
+	for (i = 0; i < EGUEBFS_STATS_OPS; i++)
+	{
+		const Eguebfs_Stats_Op_Counters *c = &s->ops[i];
+
+		eina_strbuf_append_printf(buf, "%s %" PRIu64 " %" PRIu64
+				" %" PRIu64 " %" PRIu64,
+				_eguebfs_stats_op_names[i], c->count,
+				c->errors, c->bytes, c->time / 1000);
+		for (j = 0; j < EGUEBFS_STATS_BUCKETS; j++)
+			eina_strbuf_append_printf(buf, " %" PRIu64,
+					c->histogram[j]);
+		eina_strbuf_append_char(buf, '\n');
+	}
+	eina_strbuf_append_printf(buf, "steps %" PRIu64 "\n", s->steps);
+	eina_strbuf_append_printf(buf, "path_cache %" PRIu64 " %" PRIu64 "\n",
+			s->path_hits, s->path_misses);
+	eina_strbuf_append_printf(buf, "length_cache %" PRIu64 " %" PRIu64 "\n",
+			s->length_hits, s->length_misses);
+}
+
+/* An operation lasts until its reply, only one is in progress per thread */
+void eguebfs_stats_op_begin(Eguebfs_Stats_Op op)
+{
+	Eguebfs_Stats_Block *b;
+
+	if (!_eguebfs_stats_key_created)
+		return;
+	b = eina_tls_get(_eguebfs_stats_key);
+	if (!b)
+		return;
+	b->op = op;
+	b->start = _eguebfs_stats_now();
+	b->started = EINA_TRUE;
+}
+
+void eguebfs_stats_op_end(int error, size_t bytes)
+{
+	Eguebfs_Stats_Op_Counters *c;
+	Eguebfs_Stats_Block *b;
+	uint64_t elapsed;
+
+	if (!_eguebfs_stats_key_created)
+		return;
+	b = eina_tls_get(_eguebfs_stats_key);
+	if (!b || !b->started)
+		return;
+	b->started = EINA_FALSE;
+	elapsed = _eguebfs_stats_now() - b->start;
+	c = &b->s.ops[b->op];
+	c->count++;
+	if (error)
+		c->errors++;
+	c->bytes += bytes;
+	c->time += elapsed;
+	c->histogram[_eguebfs_stats_bucket(elapsed)]++;
+}
+
+void eguebfs_stats_step(void)
+{
+	Eguebfs_Stats_Block *b;
+
+	if (!_eguebfs_stats_key_created)
+		return;
+	b = eina_tls_get(_eguebfs_stats_key);
+	if (b)
+		b->s.steps++;
+}
+
+void eguebfs_stats_path_cache(Eina_Bool hit)
+{
+	Eguebfs_Stats_Block *b;
+
+	if (!_eguebfs_stats_key_created)
+		return;
+	b = eina_tls_get(_eguebfs_stats_key);
+	if (!b)
+		return;
+	if (hit)
+		b->s.path_hits++;
+	else
+		b->s.path_misses++;
+}
+
+void eguebfs_stats_length_cache(Eina_Bool hit)
+{
+	Eguebfs_Stats_Block *b;
+
+	if (!_eguebfs_stats_key_created)
+		return;
+	b = eina_tls_get(_eguebfs_stats_key);
+	if (!b)
+		return;
+	if (hit)
+		b->s.length_hits++;
+	else
+		b->s.length_misses++;
+}
+/*============================================================================*
+ *                                   API                                      *
+ *============================================================================*/
+EAPI const char * eguebfs_stats_op_name_get(Eguebfs_Stats_Op op)
+{
+	if (op < 0 || op >= EGUEBFS_STATS_OPS)
+		return NULL;
+	return _eguebfs_stats_op_names[op];
+}
@@ -0,0 +1,625 @@
+/* EGUEBFS - FUSE based Egueb filesystem
+ * Copyright (C) 2015 - 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+
+#include "eguebfs_private.h"
+
+/*
+ * Every element has a .xml file with the serialization of its subtree. The
+ * serialization of an element is kept once done, and the one of its parent
+ * is built from it. An element only keeps its own tags, attributes and text
+ * and where the serialization of every child element goes, so the document
+ * is kept once no matter how deep it is. A mutation only drops the
+ * serialization of the elements from the modified one up to the topmost,
+ * so serializing the document again only serializes the elements on that
+ * path. Whenever an element has no serialization none of its ancestors has
+ * either, which is what stops the dropping early. On a lazy document an
+ * element not modified is serialized as it is on the file, without
+ * creating its children. Once the serializations kept go over a budget the
+ * least recently used of the ones no parent is built from are dropped
+ */
+/*============================================================================*
+ *                                  Local                                     *
+ *============================================================================*/
+typedef struct _Eguebfs_Xml_Element Eguebfs_Xml_Element;
+
+/* The serialization of a child goes at the given byte of the parent text */
+typedef struct _Eguebfs_Xml_Child
+{
+	size_t at;
+	Eguebfs_Xml_Element *xe;
+} Eguebfs_Xml_Child;
+
+struct _Eguebfs_Xml_Element
+{
+	EINA_INLIST;
+	Egueb_Dom_Node *n;
+	/* the tags, attributes and text of the element itself */
+	char *text;
+	size_t text_length;
+	/* Eguebfs_Xml_Child, in the order they go */
+	Eina_Inarray *children;
+	/* the length of the whole serialization */
+	size_t length;
+	/* one for the hash and one for every parent built from it */
+	int ref;
+	/* the text is on the file of a lazy document */
+	Eina_Bool borrowed;
+};
+
+struct _Eguebfs_Xml
+{
+	Eina_Lock lock;
+	Egueb_Dom_Node *doc;
+	Eguebfs_Lazy *lazy;
+	/* node -> Eguebfs_Xml_Element */
+	Eina_Hash *elements;
+	/* the elements on the hash, the least recently used first */
+	Eina_Inlist *lru;
+	/* bytes of text of the elements alive and the most to keep */
+	size_t used;
+	size_t budget;
+	Eguebfs_Xml_Invalidated invalidated;
+	void *data;
+};
+
+static void _eguebfs_xml_element_unref(Eguebfs_Xml *thiz,
+		Eguebfs_Xml_Element *xe)
+{
+	Eguebfs_Xml_Child *c;
+
+	if (--xe->ref)
+		return;
+	if (xe->children)
+	{
+		EINA_INARRAY_FOREACH(xe->children, c)
+			_eguebfs_xml_element_unref(thiz, c->xe);
+		eina_inarray_free(xe->children);
+	}
+	if (!xe->borrowed)
+	{
+		thiz->used -= xe->text_length;
+		free(xe->text);
+	}
+	egueb_dom_node_unref(xe->n);
+	free(xe);
+}
+
+static void _eguebfs_xml_element_add(Eguebfs_Xml *thiz,
+		Eguebfs_Xml_Element *xe)
+{
+	xe->ref = 1;
+	eina_hash_add(thiz->elements, &xe->n, xe);
+	thiz->lru = eina_inlist_append(thiz->lru, EINA_INLIST_GET(xe));
+}
+
+/* Drop the serialization of an element, the parents built from it keep
+ * it alive. Returns whether the element had one
+ */
+static Eina_Bool _eguebfs_xml_element_del(Eguebfs_Xml *thiz,
+		Egueb_Dom_Node *n)
+{
+	Eguebfs_Xml_Element *xe;
+
+	xe = eina_hash_find(thiz->elements, &n);
+	if (!xe)
+		return EINA_FALSE;
+	eina_hash_del_by_key(thiz->elements, &n);
+	thiz->lru = eina_inlist_remove(thiz->lru, EINA_INLIST_GET(xe));
+	_eguebfs_xml_element_unref(thiz, xe);
+
+	return EINA_TRUE;
+}
+
+/* Copy the serialization of an element, at most length bytes. Returns the
+ * number of bytes copied
+ */
+static size_t _eguebfs_xml_element_copy(Eguebfs_Xml_Element *xe, char *to,
+		size_t length)
+{
+	Eguebfs_Xml_Child *c;
+	size_t from = 0;
+	size_t done = 0;
+	size_t count;
+
+	if (xe->children)
+	{
+		EINA_INARRAY_FOREACH(xe->children, c)
+		{
+			count = c->at - from;
+			if (count > length - done)
+				count = length - done;
+			memcpy(to + done, xe->text + from, count);
+			done += count;
+			from = c->at;
+			if (done == length)
+				return done;
+			done += _eguebfs_xml_element_copy(c->xe, to + done,
+					length - done);
+			if (done == length)
+				return done;
+		}
+	}
+	count = xe->text_length - from;
+	if (count > length - done)
+		count = length - done;
+	memcpy(to + done, xe->text + from, count);
+
+	return done + count;
+}
+
+/* Drop the least recently used serializations no parent is built from
+ * until the ones alive fit on the budget. The kernel might know the size of
+ * the ones dropped, and a mutation below them would not tell it otherwise
+ */
+static void _eguebfs_xml_evict(Eguebfs_Xml *thiz)
+{
+	Eina_Bool evicted = EINA_TRUE;
+
+	if (!thiz->budget)
+		return;
+	while (evicted && thiz->used > thiz->budget)
+	{
+		Eguebfs_Xml_Element *xe;
+		Eina_Inlist *l;
+
+		evicted = EINA_FALSE;
+		EINA_INLIST_FOREACH_SAFE(thiz->lru, l, xe)
+		{
+			Egueb_Dom_Node *n;
+
+			if (xe->ref > 1)
+				continue;
+			n = egueb_dom_node_ref(xe->n);
+			_eguebfs_xml_element_del(thiz, n);
+			if (thiz->invalidated)
+				thiz->invalidated(thiz->data, n);
+			egueb_dom_node_unref(n);
+			evicted = EINA_TRUE;
+			if (thiz->used <= thiz->budget)
+				break;
+		}
+	}
+}
+
+static void _eguebfs_xml_escape(Eina_Strbuf *b, const char *s,
+		Eina_Bool attr)
+{
+	const char *start = s;
+
+	for (; *s; s++)
+	{
+		const char *entity;
+
+		switch (*s)
+		{
+			case '&':
+			entity = "&amp;";
+			break;
+
+			case '<':
+			entity = "&lt;";
+			break;
+
+			case '>':
+			entity = "&gt;";
+			break;
+
+			case '"':
+			if (!attr)
+				continue;
+			entity = "&quot;";
+			break;
+
+			default:
+			continue;
+		}
+		eina_strbuf_append_length(b, start, s - start);
+		eina_strbuf_append(b, entity);
+		start = s + 1;
+	}
+	eina_strbuf_append_length(b, start, s - start);
+}
+
+static void _eguebfs_xml_attributes_append(Eina_Strbuf *b, Egueb_Dom_Node *n)
+{
+	Egueb_Dom_Node_Map_Named *attrs;
+	int length;
+	int i;
+
+	attrs = egueb_dom_node_attributes_get(n);
+	length = egueb_dom_node_map_named_length(attrs);
+	for (i = 0; i < length; i++)
+	{
+		Egueb_Dom_Node *attr;
+		Egueb_Dom_String *name;
+		Egueb_Dom_String *value = NULL;
+
+		attr = egueb_dom_node_map_named_at(attrs, i);
+		/* only what the document has, not the defaults */
+		if (!egueb_dom_attr_is_set(attr))
+			goto next;
+		if (!egueb_dom_attr_string_get(attr, EGUEB_DOM_ATTR_TYPE_BASE,
+				&value) || !egueb_dom_string_is_valid(value))
+			goto next;
+
+		name = egueb_dom_node_name_get(attr);
+		eina_strbuf_append_printf(b, " %s=\"",
+				egueb_dom_string_chars_get(name));
+		_eguebfs_xml_escape(b, egueb_dom_string_chars_get(value),
+				EINA_TRUE);
+		eina_strbuf_append_char(b, '"');
+		egueb_dom_string_unref(name);
+next:
+		if (value)
+			egueb_dom_string_unref(value);
+		egueb_dom_node_unref(attr);
+	}
+	egueb_dom_node_map_named_unref(attrs);
+}
+
+static Eguebfs_Xml_Element * _eguebfs_xml_element_get(Eguebfs_Xml *thiz,
+		Egueb_Dom_Node *n)
+{
+	Eguebfs_Xml_Element *xe;
+	Egueb_Dom_String *name;
+	Egueb_Dom_Node *child;
+	Eina_Strbuf *b;
+	const char *chars;
+
+	xe = eina_hash_find(thiz->elements, &n);
+	if (xe)
+	{
+		thiz->lru = eina_inlist_demote(thiz->lru,
+				EINA_INLIST_GET(xe));
+		return xe;
+	}
+
+	if (thiz->lazy)
+	{
+		const char *source;
+		size_t length;
+
+		source = eguebfs_lazy_source_get(thiz->lazy, n, &length);
+		if (source)
+		{
+			xe = calloc(1, sizeof(Eguebfs_Xml_Element));
+			xe->n = egueb_dom_node_ref(n);
+			xe->text = (char *)source;
+			xe->text_length = length;
+			xe->length = length;
+			xe->borrowed = EINA_TRUE;
+			_eguebfs_xml_element_add(thiz, xe);
+			return xe;
+		}
+		eguebfs_lazy_materialize(thiz->lazy, n);
+	}
+
+	xe = calloc(1, sizeof(Eguebfs_Xml_Element));
+	xe->n = egueb_dom_node_ref(n);
+
+	b = eina_strbuf_new();
+	name = egueb_dom_node_name_get(n);
+	chars = egueb_dom_string_chars_get(name);
+	eina_strbuf_append_printf(b, "<%s", chars);
+	_eguebfs_xml_attributes_append(b, n);
+
+	child = egueb_dom_node_child_first_get(n);
+	if (!child)
+		eina_strbuf_append(b, "/>");
+	else
+		eina_strbuf_append_char(b, '>');
+	while (child)
+	{
+		Egueb_Dom_Node *tmp;
+		Egueb_Dom_String *data;
+
+		switch (egueb_dom_node_type_get(child))
+		{
+			case EGUEB_DOM_NODE_TYPE_ELEMENT:
+			{
+				Eguebfs_Xml_Element *cxe;
+				Eguebfs_Xml_Child c;
+
+				cxe = _eguebfs_xml_element_get(thiz, child);
+				cxe->ref++;
+				if (!xe->children)
+					xe->children = eina_inarray_new(
+							sizeof(Eguebfs_Xml_Child),
+							0);
+				c.at = eina_strbuf_length_get(b);
+				c.xe = cxe;
+				eina_inarray_push(xe->children, &c);
+				xe->length += cxe->length;
+			}
+			break;
+
+			case EGUEB_DOM_NODE_TYPE_TEXT:
+			data = egueb_dom_character_data_data_get(child);
+			_eguebfs_xml_escape(b, egueb_dom_string_chars_get(data),
+					EINA_FALSE);
+			egueb_dom_string_unref(data);
+			break;
+
+			case EGUEB_DOM_NODE_TYPE_CDATA_SECTION:
+			data = egueb_dom_character_data_data_get(child);
+			eina_strbuf_append_printf(b, "<![CDATA[%s]]>",
+					egueb_dom_string_chars_get(data));
+			egueb_dom_string_unref(data);
+			break;
+
+			default:
+			break;
+		}
+		tmp = egueb_dom_node_sibling_next_get(child);
+		egueb_dom_node_unref(child);
+		child = tmp;
+		if (!child)
+			eina_strbuf_append_printf(b, "</%s>", chars);
+	}
+	egueb_dom_string_unref(name);
+
+	xe->text_length = eina_strbuf_length_get(b);
+	xe->text = eina_strbuf_string_steal(b);
+	xe->length += xe->text_length;
+	eina_strbuf_free(b);
+	thiz->used += xe->text_length;
+	_eguebfs_xml_element_add(thiz, xe);
+
+	return xe;
+}
+
+/* Drop the serialization of n and its ancestors */
+static void _eguebfs_xml_invalidate(Eguebfs_Xml *thiz, Egueb_Dom_Node *n)
+{
+	Egueb_Dom_Node *parent;
+
+	n = egueb_dom_node_ref(n);
+	while (n)
+	{
+		if (egueb_dom_node_type_get(n) != EGUEB_DOM_NODE_TYPE_ELEMENT)
+		{
+			/* a character data node belongs to its element */
+			if (n == thiz->doc)
+				break;
+		}
+		else
+		{
+			if (_eguebfs_xml_element_del(thiz, n))
+			{
+				if (thiz->invalidated)
+					thiz->invalidated(thiz->data, n);
+			}
+			/* an element serialized from the file has no
+			 * serialization of its descendants
+			 */
+			else if (!thiz->lazy)
+			{
+				break;
+			}
+		}
+		parent = egueb_dom_node_parent_get(n);
+		egueb_dom_node_unref(n);
+		n = parent;
+	}
+	if (n)
+		egueb_dom_node_unref(n);
+}
+
+/* Drop the serialization of a subtree no longer on the document */
+static void _eguebfs_xml_drop(Eguebfs_Xml *thiz, Egueb_Dom_Node *n)
+{
+	Egueb_Dom_Node *child;
+
+	if (egueb_dom_node_type_get(n) != EGUEB_DOM_NODE_TYPE_ELEMENT)
+		return;
+	_eguebfs_xml_element_del(thiz, n);
+	child = egueb_dom_node_child_first_get(n);
+	while (child)
+	{
+		Egueb_Dom_Node *tmp;
+
+		_eguebfs_xml_drop(thiz, child);
+		tmp = egueb_dom_node_sibling_next_get(child);
+		egueb_dom_node_unref(child);
+		child = tmp;
+	}
+}
+
+static void _eguebfs_xml_node_inserted_cb(Egueb_Dom_Event *ev, void *data)
+{
+	Eguebfs_Xml *thiz = data;
+	Egueb_Dom_Node *target;
+	Egueb_Dom_Node *parent;
+
+	parent = egueb_dom_event_mutation_related_get(ev);
+	if (!parent)
+		return;
+	target = eguebfs_event_target_node_get(ev);
+	eina_lock_take(&thiz->lock);
+	_eguebfs_xml_invalidate(thiz, parent);
+	/* it might have been serialized out of the document, where its
+	 * mutations are not seen
+	 */
+	_eguebfs_xml_drop(thiz, target);
+	eina_lock_release(&thiz->lock);
+	egueb_dom_node_unref(target);
+	egueb_dom_node_unref(parent);
+}
+
+static void _eguebfs_xml_node_removed_cb(Egueb_Dom_Event *ev, void *data)
+{
+	Eguebfs_Xml *thiz = data;
+	Egueb_Dom_Node *target;
+	Egueb_Dom_Node *parent;
+
+	parent = egueb_dom_event_mutation_related_get(ev);
+	if (!parent)
+		return;
+	target = eguebfs_event_target_node_get(ev);
+	eina_lock_take(&thiz->lock);
+	_eguebfs_xml_invalidate(thiz, parent);
+	_eguebfs_xml_drop(thiz, target);
+	eina_lock_release(&thiz->lock);
+	egueb_dom_node_unref(target);
+	egueb_dom_node_unref(parent);
+}
+
+/* The target of an attribute or character data modification is the
+ * element or the character data node
+ */
+static void _eguebfs_xml_modified_cb(Egueb_Dom_Event *ev, void *data)
+{
+	Eguebfs_Xml *thiz = data;
+	Egueb_Dom_Node *target;
+
+	target = eguebfs_event_target_node_get(ev);
+	eina_lock_take(&thiz->lock);
+	_eguebfs_xml_invalidate(thiz, target);
+	eina_lock_release(&thiz->lock);
+	egueb_dom_node_unref(target);
+}
+/*============================================================================*
+ *                                 Global                                     *
+ *============================================================================*/
+/* The invalidated callback is called with the document locked, for every
+ * element whose serialization has been dropped. At most budget bytes of
+ * serializations are kept once done, zero keeps all of them
+ */
+Eguebfs_Xml * eguebfs_xml_new(Egueb_Dom_Node *doc, Eguebfs_Lazy *lazy,
+		size_t budget, Eguebfs_Xml_Invalidated invalidated, void *data)
+{
+	Eguebfs_Xml *thiz;
+	Egueb_Dom_Event_Target *et;
+
+	thiz = calloc(1, sizeof(Eguebfs_Xml));
+	eina_lock_new(&thiz->lock);
+	thiz->doc = egueb_dom_node_ref(doc);
+	thiz->lazy = lazy;
+	thiz->elements = eina_hash_pointer_new(NULL);
+	thiz->budget = budget;
+	thiz->invalidated = invalidated;
+	thiz->data = data;
+
+	et = EGUEB_DOM_EVENT_TARGET(doc);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_INSERTED,
+			_eguebfs_xml_node_inserted_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_REMOVED,
+			_eguebfs_xml_node_removed_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_ATTR_MODIFIED,
+			_eguebfs_xml_modified_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_add(et,
+			EGUEB_DOM_EVENT_MUTATION_CHARACTER_DATA_MODIFIED,
+			_eguebfs_xml_modified_cb, EINA_FALSE, thiz);
+
+	return thiz;
+}
+
+void eguebfs_xml_free(Eguebfs_Xml *thiz)
+{
+	Egueb_Dom_Event_Target *et;
+
+	et = EGUEB_DOM_EVENT_TARGET(thiz->doc);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_INSERTED,
+			_eguebfs_xml_node_inserted_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_NODE_REMOVED,
+			_eguebfs_xml_node_removed_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_ATTR_MODIFIED,
+			_eguebfs_xml_modified_cb, EINA_FALSE, thiz);
+	egueb_dom_event_target_event_listener_remove(et,
+			EGUEB_DOM_EVENT_MUTATION_CHARACTER_DATA_MODIFIED,
+			_eguebfs_xml_modified_cb, EINA_FALSE, thiz);
+
+	while (thiz->lru)
+	{
+		Eguebfs_Xml_Element *xe;
+
+		xe = EINA_INLIST_CONTAINER_GET(thiz->lru, Eguebfs_Xml_Element);
+		_eguebfs_xml_element_del(thiz, xe->n);
+	}
+	eina_hash_free(thiz->elements);
+	egueb_dom_node_unref(thiz->doc);
+	eina_lock_free(&thiz->lock);
+	free(thiz);
+}
+
+/* Drop the serialization of the children of an element, they are going away
+ * without any mutation event
+ */
+void eguebfs_xml_children_drop(Eguebfs_Xml *thiz, Egueb_Dom_Node *n)
+{
+	Egueb_Dom_Node *child;
+
+	eina_lock_take(&thiz->lock);
+	child = egueb_dom_node_child_first_get(n);
+	while (child)
+	{
+		Egueb_Dom_Node *tmp;
+
+		_eguebfs_xml_drop(thiz, child);
+		tmp = egueb_dom_node_sibling_next_get(child);
+		egueb_dom_node_unref(child);
+		child = tmp;
+	}
+	eina_lock_release(&thiz->lock);
+}
+
+/* The length of the serialization of an element. Must be called with the
+ * document locked, the children of a lazy element are created to serialize
+ * it
+ */
+size_t eguebfs_xml_length_get(Eguebfs_Xml *thiz, Egueb_Dom_Node *n)
+{
+	Eguebfs_Xml_Element *xe;
+	size_t ret;
+
+	eina_lock_take(&thiz->lock);
+	xe = _eguebfs_xml_element_get(thiz, n);
+	ret = xe->length;
+	_eguebfs_xml_evict(thiz);
+	eina_lock_release(&thiz->lock);
+
+	return ret;
+}
+
+/* Copy the serialization of an element, at most length bytes. Must be
+ * called with the document locked. Returns the number of bytes copied
+ */
+size_t eguebfs_xml_copy(Eguebfs_Xml *thiz, Egueb_Dom_Node *n, char *to,
+		size_t length)
+{
+	Eguebfs_Xml_Element *xe;
+
+	eina_lock_take(&thiz->lock);
+	xe = _eguebfs_xml_element_get(thiz, n);
+	length = _eguebfs_xml_element_copy(xe, to, length);
+	_eguebfs_xml_evict(thiz);
+	eina_lock_release(&thiz->lock);
+
+	return length;
+}
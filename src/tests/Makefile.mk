@@ -0,0 +1,20 @@
+if EGUEBFS_BUILD_TESTS
+
+check_PROGRAMS += \
+src/tests/eguebfs_test
+
+TESTS += \
+src/tests/eguebfs_test
+
+endif
+
+src_tests_eguebfs_test_LDADD = \
+$(top_builddir)/src/lib/libeguebfs.la \
+@EGUEBFS_LIBS@
+
+src_tests_eguebfs_test_CPPFLAGS = \
+-I$(top_srcdir)/src/lib \
+@EGUEBFS_CFLAGS@
+
+src_tests_eguebfs_test_SOURCES = \
+src/tests/eguebfs_test.c
@@ -0,0 +1,665 @@
+/* EGUEBFS - FUSE based Egueb filesystem
+ * Copyright (C) 2015 - 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <linux/fuse.h>
+
+#include <Eguebfs.h>
+
+/*
+ * Runs the filesystem in process with eguebfs_op_*() on a small document,
+ * once parsed with egueb_dom_parser_parse() and mounted, and once mounted
+ * with eguebfs_mount_file() to be parsed as it is walked. Every test prints
+ * a line with its name and whether it passed, the program fails if any of
+ * them does
+ */
+
+#define TEST_CHECK(cond) \
+	do { \
+		if (!(cond)) \
+		{ \
+			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			goto done; \
+		} \
+	} while (0)
+
+typedef struct _Test_Entries
+{
+	Eina_Strbuf *names;
+	/* the names of the entries after every offset, one per entry */
+	Eina_Array *offsets;
+} Test_Entries;
+
+static const char _test_document[] =
+	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	"<!-- used by the tests of eguebfs -->\n"
+	"<svg xmlns=\"http://www.w3.org/2000/svg\" "
+	"xmlns:xlink=\"http://www.w3.org/1999/xlink\" "
+	"width=\"100\" height=\"100\">\n"
+	"  <g id=\"g0\" fill=\"red\">\n"
+	"    <rect id=\"r0\" x=\"1\" y=\"2\" width=\"3\" height=\"4\"/>\n"
+	"    <text id=\"t0\" x=\"0\" y=\"10\">hello world</text>\n"
+	"  </g>\n"
+	"  <g id=\"g1\"><g id=\"g2\"><circle cx=\"5\" cy=\"5\" r=\"2\"/></g></g>\n"
+	"  <text id=\"t1\" x=\"0\" y=\"20\">a &lt; b &amp; &#65;&#x42;</text>\n"
+	"  <use xlink:href=\"#r0\" x=\"10\"/>\n"
+	"</svg>\n";
+
+static char *_test_file;
+
+static Eina_Bool _test_names_add(void *data, const char *name,
+		off_t next EINA_UNUSED)
+{
+	Eina_Strbuf *names = data;
+
+	eina_strbuf_append_printf(names, "%s\n", name);
+	return EINA_TRUE;
+}
+
+static Eina_Bool _test_entries_add(void *data, const char *name, off_t next)
+{
+	Test_Entries *entries = data;
+
+	eina_strbuf_append_printf(entries->names, "%s\n", name);
+	eina_array_push(entries->offsets, (void *)(intptr_t)next);
+	return EINA_TRUE;
+}
+
+static Eina_Bool _test_list(Eguebfs *efs, uint64_t ino, Eina_Array *names)
+{
+	Eina_Strbuf *b;
+	char *s;
+	char *p;
+
+	b = eina_strbuf_new();
+	if (eguebfs_op_readdir(efs, ino, 0, _test_names_add, b))
+	{
+		eina_strbuf_free(b);
+		return EINA_FALSE;
+	}
+	s = eina_strbuf_string_steal(b);
+	eina_strbuf_free(b);
+	for (p = strtok(s, "\n"); p; p = strtok(NULL, "\n"))
+	{
+		if (!strcmp(p, ".") || !strcmp(p, ".."))
+			continue;
+		eina_array_push(names, strdup(p));
+	}
+	free(s);
+	return EINA_TRUE;
+}
+
+static void _test_names_free(Eina_Array *names)
+{
+	unsigned int i;
+
+	for (i = 0; i < eina_array_count(names); i++)
+		free(eina_array_data_get(names, i));
+	eina_array_free(names);
+}
+
+/* Read the whole content of a file, the error of the first operation that
+ * fails is returned
+ */
+static int _test_read(Eguebfs *efs, uint64_t ino, Eina_Strbuf *b)
+{
+	Eguebfs_Op_File *f;
+	char buf[4096];
+	off_t offset = 0;
+	int err;
+
+	err = eguebfs_op_open(efs, ino, O_RDONLY, &f);
+	if (err)
+		return err;
+	for (;;)
+	{
+		size_t length;
+
+		err = eguebfs_op_read(efs, f, buf, sizeof(buf), offset, &length);
+		if (err || !length)
+			break;
+		eina_strbuf_append_length(b, buf, length);
+		offset += length;
+	}
+	eguebfs_op_release(efs, f);
+	return err;
+}
+
+static int _test_value_get(Eguebfs *efs, const char *path, char **value)
+{
+	Eina_Strbuf *b;
+	uint64_t ino;
+	int err;
+
+	*value = NULL;
+	err = eguebfs_op_resolve(efs, path, &ino, NULL);
+	if (err)
+		return err;
+	b = eina_strbuf_new();
+	err = _test_read(efs, ino, b);
+	eguebfs_op_forget(efs, ino, 1);
+	*value = eina_strbuf_string_steal(b);
+	eina_strbuf_free(b);
+	return err;
+}
+
+static int _test_value_write(Eguebfs *efs, const char *path, int flags,
+		const char *value, off_t offset)
+{
+	Eguebfs_Op_File *f;
+	uint64_t ino;
+	size_t written;
+	int err;
+
+	err = eguebfs_op_resolve(efs, path, &ino, NULL);
+	if (err)
+		return err;
+	err = eguebfs_op_open(efs, ino, O_WRONLY | flags, &f);
+	if (!err)
+	{
+		err = eguebfs_op_write(efs, f, value, strlen(value), offset,
+				&written);
+		if (!err && written != strlen(value))
+			err = EIO;
+		/* the error of the write goes first */
+		if (eguebfs_op_release(efs, f) && !err)
+			err = EINVAL;
+	}
+	eguebfs_op_forget(efs, ino, 1);
+	return err;
+}
+
+static Eina_Bool _test_value_is(Eguebfs *efs, const char *path,
+		const char *expected)
+{
+	Eina_Bool ret;
+	char *value;
+
+	ret = !_test_value_get(efs, path, &value) && !strcmp(value, expected);
+	if (!ret)
+		fprintf(stderr, "'%s' is '%s' instead of '%s'\n", path,
+				value ? value : "", expected);
+	free(value);
+	return ret;
+}
+
+/* Find the path of the character data file of an element */
+static char * _test_text_path(Eguebfs *efs, const char *element)
+{
+	Eina_Array *names;
+	uint64_t ino;
+	char *ret = NULL;
+	unsigned int i;
+
+	if (eguebfs_op_resolve(efs, element, &ino, NULL))
+		return NULL;
+	names = eina_array_new(8);
+	if (_test_list(efs, ino, names))
+	{
+		for (i = 0; i < eina_array_count(names) && !ret; i++)
+		{
+			const char *name = eina_array_data_get(names, i);
+			uint64_t child;
+			struct stat st;
+
+			if (name[0] == '.')
+				continue;
+			if (eguebfs_op_lookup(efs, ino, name, &child, &st))
+				continue;
+			if (S_ISREG(st.st_mode) &&
+					asprintf(&ret, "%s/%s", element, name) < 0)
+				ret = NULL;
+			eguebfs_op_forget(efs, child, 1);
+		}
+	}
+	_test_names_free(names);
+	eguebfs_op_forget(efs, ino, 1);
+	return ret;
+}
+
+/* Dump every directory and the content of every file under a directory,
+ * the control files, the ones starting with a dot, are skipped
+ */
+static Eina_Bool _test_dump(Eguebfs *efs, uint64_t ino, const char *path,
+		Eina_Strbuf *dump)
+{
+	Eina_Array *names;
+	Eina_Bool ret = EINA_TRUE;
+	unsigned int i;
+
+	names = eina_array_new(16);
+	if (!_test_list(efs, ino, names))
+	{
+		_test_names_free(names);
+		return EINA_FALSE;
+	}
+	for (i = 0; i < eina_array_count(names) && ret; i++)
+	{
+		const char *name = eina_array_data_get(names, i);
+		uint64_t child;
+		struct stat st;
+
+		if (name[0] == '.')
+			continue;
+		if (eguebfs_op_lookup(efs, ino, name, &child, &st))
+		{
+			ret = EINA_FALSE;
+			break;
+		}
+		if (S_ISDIR(st.st_mode))
+		{
+			char *sub;
+
+			eina_strbuf_append_printf(dump, "%s/%s/\n", path, name);
+			if (asprintf(&sub, "%s/%s", path, name) < 0)
+			{
+				ret = EINA_FALSE;
+			}
+			else
+			{
+				ret = _test_dump(efs, child, sub, dump);
+				free(sub);
+			}
+		}
+		else
+		{
+			eina_strbuf_append_printf(dump, "%s/%s = ", path, name);
+			ret = !_test_read(efs, child, dump);
+			eina_strbuf_append_char(dump, '\n');
+		}
+		eguebfs_op_forget(efs, child, 1);
+	}
+	_test_names_free(names);
+	return ret;
+}
+
+static Eguebfs * _test_mount(Eina_Bool lazy)
+{
+	Eguebfs_Options opts;
+	Enesim_Stream *stream;
+	Egueb_Dom_Node *doc = NULL;
+	Eina_Bool parsed;
+
+	eguebfs_options_default_get(&opts);
+	if (lazy)
+		return eguebfs_mount_file(_test_file, NULL, &opts);
+
+	stream = enesim_stream_file_new(_test_file, "r");
+	if (!stream)
+		return NULL;
+	parsed = egueb_dom_parser_parse(stream, &doc);
+	enesim_stream_unref(stream);
+	if (!parsed)
+		return NULL;
+	return eguebfs_mount_with_options(doc, NULL, &opts);
+}
+
+/* Resuming a listing from the offset of any of its entries lists the
+ * entries after it
+ */
+static Eina_Bool _test_readdir_resume(Eguebfs *efs)
+{
+	Test_Entries entries;
+	Eina_Strbuf *tail = NULL;
+	Eina_Bool ret = EINA_FALSE;
+	const char *listed;
+	uint64_t ino = 0;
+	unsigned int i;
+
+	entries.names = eina_strbuf_new();
+	entries.offsets = eina_array_new(16);
+	TEST_CHECK(!eguebfs_op_resolve(efs, "/svg", &ino, NULL));
+	TEST_CHECK(!eguebfs_op_readdir(efs, ino, 0, _test_entries_add,
+			&entries));
+	/* . and .., the attributes, the elements, the text and the .xml */
+	TEST_CHECK(eina_array_count(entries.offsets) > 8);
+
+	listed = eina_strbuf_string_get(entries.names);
+	tail = eina_strbuf_new();
+	for (i = 0; i < eina_array_count(entries.offsets); i++)
+	{
+		off_t next;
+		const char *expected;
+		unsigned int j;
+
+		/* the names after the entry i */
+		expected = listed;
+		for (j = 0; j <= i; j++)
+			expected = strchr(expected, '\n') + 1;
+		next = (intptr_t)eina_array_data_get(entries.offsets, i);
+		TEST_CHECK(next > 0);
+		eina_strbuf_reset(tail);
+		TEST_CHECK(!eguebfs_op_readdir(efs, ino, next, _test_names_add,
+				tail));
+		if (strcmp(eina_strbuf_string_get(tail), expected))
+		{
+			fprintf(stderr, "resuming after entry %u lists:\n%s"
+					"instead of:\n%s", i,
+					eina_strbuf_string_get(tail), expected);
+			goto done;
+		}
+	}
+	ret = EINA_TRUE;
+done:
+	if (ino)
+		eguebfs_op_forget(efs, ino, 1);
+	if (tail)
+		eina_strbuf_free(tail);
+	eina_strbuf_free(entries.names);
+	eina_array_free(entries.offsets);
+	return ret;
+}
+
+/* List a directory as the kernel gets it, every dirent must have an inode
+ * or the readdir() of the applications skips it. Returns the number of
+ * entries, -1 on failure
+ */
+static int _test_dirents_count(Eguebfs *efs, const char *path,
+		Eina_Bool plus)
+{
+	uint64_t buf[4096];
+	uint64_t ino;
+	size_t length;
+	size_t p = 0;
+	int count = 0;
+	int err;
+
+	if (eguebfs_op_resolve(efs, path, &ino, NULL))
+		return -1;
+	err = eguebfs_op_readdir_buf(efs, ino, 0, plus, (char *)buf,
+			sizeof(buf), &length);
+	eguebfs_op_forget(efs, ino, 1);
+	if (err)
+		return -1;
+	while (p < length)
+	{
+		const struct fuse_dirent *d;
+
+		if (plus)
+		{
+			const struct fuse_direntplus *dp;
+
+			dp = (const struct fuse_direntplus *)((char *)buf + p);
+			/* the lookups taken by the listing */
+			if (dp->entry_out.nodeid)
+				eguebfs_op_forget(efs, dp->entry_out.nodeid, 1);
+			d = &dp->dirent;
+			p += FUSE_DIRENTPLUS_SIZE(dp);
+		}
+		else
+		{
+			d = (const struct fuse_dirent *)((char *)buf + p);
+			p += FUSE_DIRENT_SIZE(d);
+		}
+		if (!d->ino)
+		{
+			fprintf(stderr, "'%.*s' of '%s' has no inode\n",
+					(int)d->namelen, d->name, path);
+			count = -1;
+		}
+		else if (count >= 0)
+		{
+			count++;
+		}
+	}
+	return count;
+}
+
+/* The number of entries of a directory with the dots */
+static int _test_entries_count(Eguebfs *efs, const char *path)
+{
+	Eina_Array *names;
+	uint64_t ino;
+	int count = -1;
+
+	if (eguebfs_op_resolve(efs, path, &ino, NULL))
+		return -1;
+	names = eina_array_new(16);
+	if (_test_list(efs, ino, names))
+		count = eina_array_count(names) + 2;
+	_test_names_free(names);
+	eguebfs_op_forget(efs, ino, 1);
+	return count;
+}
+
+/* Every entry of a plain listing or a listing plus has an inode, the dots
+ * and the documents of a mount of several documents too
+ */
+static Eina_Bool _test_readdir_inodes(Eguebfs *efs)
+{
+	const char *paths[] = { "/", "/svg", "/svg/g@1/rect@1" };
+	Eguebfs_Options opts;
+	Eguebfs *docs = NULL;
+	Eina_Bool ret = EINA_FALSE;
+	unsigned int i;
+	int count;
+
+	for (i = 0; i < 3; i++)
+	{
+		count = _test_entries_count(efs, paths[i]);
+		TEST_CHECK(count > 2);
+		TEST_CHECK(_test_dirents_count(efs, paths[i], EINA_FALSE) ==
+				count);
+		TEST_CHECK(_test_dirents_count(efs, paths[i], EINA_TRUE) ==
+				count);
+	}
+
+	eguebfs_options_default_get(&opts);
+	docs = eguebfs_mount_documents(NULL, &opts);
+	TEST_CHECK(docs);
+	TEST_CHECK(eguebfs_document_add_file(docs, "one", _test_file, NULL));
+	TEST_CHECK(eguebfs_document_add_file(docs, "two", _test_file, NULL));
+	/* the dots, the stats file and the documents */
+	TEST_CHECK(_test_dirents_count(docs, "/", EINA_FALSE) == 5);
+	TEST_CHECK(_test_dirents_count(docs, "/", EINA_TRUE) == 5);
+	ret = EINA_TRUE;
+done:
+	if (docs)
+		eguebfs_umount(docs);
+	return ret;
+}
+
+/* Only the range written is modified, a write can not start past the end
+ * and a truncation never makes the value longer
+ */
+static Eina_Bool _test_range_commit(Eguebfs *efs)
+{
+	Eina_Bool ret = EINA_FALSE;
+	uint64_t ino = 0;
+	char *path;
+
+	path = _test_text_path(efs, "/svg/g@1/text@1");
+	TEST_CHECK(path);
+	TEST_CHECK(_test_value_is(efs, path, "hello world"));
+
+	TEST_CHECK(!_test_value_write(efs, path, 0, "WORLD", 6));
+	TEST_CHECK(_test_value_is(efs, path, "hello WORLD"));
+	TEST_CHECK(!_test_value_write(efs, path, 0, "J", 0));
+	TEST_CHECK(_test_value_is(efs, path, "Jello WORLD"));
+	/* a write right at the end appends, past it there would be a gap */
+	TEST_CHECK(!_test_value_write(efs, path, 0, "!", 11));
+	TEST_CHECK(_test_value_is(efs, path, "Jello WORLD!"));
+	TEST_CHECK(_test_value_write(efs, path, 0, "?", 13) == EINVAL);
+	TEST_CHECK(_test_value_is(efs, path, "Jello WORLD!"));
+	TEST_CHECK(!_test_value_write(efs, path, O_APPEND, "?", 0));
+	TEST_CHECK(_test_value_is(efs, path, "Jello WORLD!?"));
+
+	TEST_CHECK(!eguebfs_op_resolve(efs, path, &ino, NULL));
+	TEST_CHECK(!eguebfs_op_truncate(efs, ino, 5));
+	TEST_CHECK(_test_value_is(efs, path, "Jello"));
+	TEST_CHECK(!eguebfs_op_truncate(efs, ino, 64));
+	TEST_CHECK(_test_value_is(efs, path, "Jello"));
+
+	TEST_CHECK(!_test_value_write(efs, path, O_TRUNC, "bye", 0));
+	TEST_CHECK(_test_value_is(efs, path, "bye"));
+	ret = EINA_TRUE;
+done:
+	if (ino)
+		eguebfs_op_forget(efs, ino, 1);
+	free(path);
+	return ret;
+}
+
+/* A batch is applied whole or not at all */
+static Eina_Bool _test_batch_rollback(Eguebfs *efs)
+{
+	const char *paths[] = {
+		"/svg/g@1/rect@1/x/base",
+		"/svg/g@1/rect@1/y/base",
+		"/svg/g@1/rect@1/rx/base",
+	};
+	char *before[3] = { NULL, NULL, NULL };
+	Eina_Bool ret = EINA_FALSE;
+	unsigned int i;
+
+	for (i = 0; i < 3; i++)
+		TEST_CHECK(!_test_value_get(efs, paths[i], &before[i]));
+
+	/* a file that does not exist, nothing is set */
+	TEST_CHECK(_test_value_write(efs, "/.batch", 0,
+			"/svg/g@1/rect@1/x/base 7\n"
+			"/svg/g@1/rect@9/x/base 8\n", 0) == EINVAL);
+	for (i = 0; i < 3; i++)
+		TEST_CHECK(_test_value_is(efs, paths[i], before[i]));
+
+	/* a value that can not be set, the ones set before are restored and
+	 * the one that was not there is unset again
+	 */
+	TEST_CHECK(_test_value_write(efs, "/.batch", 0,
+			"/svg/g@1/rect@1/x/base 7\n"
+			"/svg/g@1/rect@1/rx/base 3\n"
+			"/svg/g@1/rect@1/y/base INVALID\n", 0) == EINVAL);
+	for (i = 0; i < 3; i++)
+		TEST_CHECK(_test_value_is(efs, paths[i], before[i]));
+
+	TEST_CHECK(!_test_value_write(efs, "/.batch", 0,
+			"/svg/g@1/rect@1/x/base 7\n"
+			"/svg/g@1/rect@1/y/base 8\n", 0));
+	TEST_CHECK(_test_value_is(efs, paths[0], "7"));
+	TEST_CHECK(_test_value_is(efs, paths[1], "8"));
+	ret = EINA_TRUE;
+done:
+	for (i = 0; i < 3; i++)
+		free(before[i]);
+	return ret;
+}
+
+/* The document parsed as it is walked is the same as the one parsed at
+ * once
+ */
+static Eina_Bool _test_lazy_round_trip(Eguebfs *efs)
+{
+	Eguebfs *lazy;
+	Eina_Strbuf *expected;
+	Eina_Strbuf *dump;
+	Eina_Bool ret = EINA_FALSE;
+
+	expected = eina_strbuf_new();
+	dump = eina_strbuf_new();
+	lazy = _test_mount(EINA_TRUE);
+	TEST_CHECK(lazy);
+	TEST_CHECK(_test_dump(efs, EGUEBFS_OP_ROOT, "", expected));
+	TEST_CHECK(_test_dump(lazy, EGUEBFS_OP_ROOT, "", dump));
+	if (strcmp(eina_strbuf_string_get(dump),
+			eina_strbuf_string_get(expected)))
+	{
+		fprintf(stderr, "parsed as walked:\n%sparsed at once:\n%s",
+				eina_strbuf_string_get(dump),
+				eina_strbuf_string_get(expected));
+		goto done;
+	}
+	ret = EINA_TRUE;
+done:
+	if (lazy)
+		eguebfs_umount(lazy);
+	eina_strbuf_free(dump);
+	eina_strbuf_free(expected);
+	return ret;
+}
+
+typedef struct _Test
+{
+	const char *name;
+	Eina_Bool (*run)(Eguebfs *efs);
+} Test;
+
+/* in order, the ones that modify the document go after the round trip */
+static const Test _tests[] = {
+	{ "readdir_resume", _test_readdir_resume },
+	{ "readdir_inodes", _test_readdir_inodes },
+	{ "lazy_round_trip", _test_lazy_round_trip },
+	{ "range_commit", _test_range_commit },
+	{ "batch_rollback", _test_batch_rollback },
+};
+
+int main(void)
+{
+	Eguebfs *efs;
+	char file[] = "/tmp/eguebfs_test_XXXXXX";
+	unsigned int i;
+	int failed = 0;
+	int fd;
+
+	fd = mkstemp(file);
+	if (fd < 0)
+		return 1;
+	if (write(fd, _test_document, sizeof(_test_document) - 1) !=
+			sizeof(_test_document) - 1)
+	{
+		close(fd);
+		unlink(file);
+		return 1;
+	}
+	close(fd);
+	_test_file = file;
+
+	egueb_dom_init();
+	eguebfs_init();
+	efs = _test_mount(EINA_FALSE);
+	if (!efs)
+	{
+		fprintf(stderr, "Fail to mount %s\n", file);
+		failed = 1;
+		goto shutdown;
+	}
+	for (i = 0; i < sizeof(_tests) / sizeof(_tests[0]); i++)
+	{
+		Eina_Bool ok;
+
+		ok = _tests[i].run(efs);
+		printf("%s: %s\n", _tests[i].name, ok ? "ok" : "FAIL");
+		if (!ok)
+			failed++;
+	}
+	eguebfs_umount(efs);
+shutdown:
+	eguebfs_shutdown();
+	egueb_dom_shutdown();
+	unlink(file);
+
+	return failed ? 1 : 0;
+}